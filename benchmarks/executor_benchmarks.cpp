@@ -0,0 +1,375 @@
+#include <benchmark/benchmark.h>
+#include "ar/ar.hpp"
+#include "executor_slot.h"
+#include "numbers.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
+
+namespace AR = AsyncRuntime;
+
+
+class counter_task : public AR::task {
+public:
+    explicit counter_task(std::atomic_size_t *c) : counter(c) { }
+    ~counter_task() override = default;
+
+    void execute(const execution_state &) override {
+        counter->fetch_add(1, std::memory_order_relaxed);
+    }
+private:
+    std::atomic_size_t *counter;
+};
+
+
+static AR::ExecutorSlot *slot = nullptr;
+static std::atomic_size_t posted_count{0};
+static std::atomic_size_t executed_count{0};
+static std::atomic_int posted_threads{0};
+
+
+// thread 0 waits until every thread has counted its posts, then until all of them ran
+static void drain(benchmark::State& state, size_t posted) {
+    posted_count.fetch_add(posted, std::memory_order_relaxed);
+    posted_threads.fetch_add(1, std::memory_order_release);
+    state.SetItemsProcessed(static_cast<int64_t>(posted));
+
+    if (state.thread_index() == 0) {
+        while (posted_threads.load(std::memory_order_acquire) < state.threads()) {
+            std::this_thread::yield();
+        }
+        while (executed_count.load(std::memory_order_relaxed) < posted_count.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+
+static void slot_post(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        posted_count = 0;
+        executed_count = 0;
+        posted_threads = 0;
+        slot = new AR::ExecutorSlot(0, "benchmark", AR::GetCPUs());
+    }
+
+    size_t posted = 0;
+    for (auto _ : state) {
+        slot->post(new counter_task(&executed_count));
+        ++posted;
+    }
+
+    drain(state, posted);
+    if (state.thread_index() == 0) {
+        delete slot;
+        slot = nullptr;
+    }
+}
+
+
+static AR::ExecutorWorkGroup *group = nullptr;
+
+
+static void group_post_tagged(benchmark::State& state) {
+    const auto cpus = AR::GetCPUs();
+    if (state.thread_index() == 0) {
+        posted_count = 0;
+        executed_count = 0;
+        posted_threads = 0;
+        std::map<size_t, size_t> cpus_wg;
+        for (size_t i = 0; i < cpus.size(); ++i) { cpus_wg[i] = 0; }
+        group = new AR::ExecutorWorkGroup(0, {"benchmark", 1.0, 1.0, 1}, cpus, cpus_wg);
+        for (uint16_t e = 0; e < 1024; ++e) {
+            group->AddEntity(e);
+        }
+    }
+
+    size_t posted = 0;
+    uint16_t entity = state.thread_index();
+    for (auto _ : state) {
+        auto *t = new counter_task(&executed_count);
+        AR::task::execution_state st;
+        st.tag = AR::Numbers::Pack(0, entity);
+        t->set_execution_state(st);
+        group->Post(t);
+        entity = (entity + 1) % 1024;
+        ++posted;
+    }
+
+    drain(state, posted);
+    if (state.thread_index() == 0) {
+        delete group;
+        group = nullptr;
+    }
+}
+
+
+static void runtime_post(benchmark::State& state) {
+    if (state.range(0) > static_cast<int64_t>(std::thread::hardware_concurrency())) {
+        state.SkipWithError("not enough cpus for the numa nodes");
+        return;
+    }
+
+    AR::RuntimeOptions options;
+    options.virtual_numa_nodes_count = static_cast<int>(state.range(0));
+    AR::SetupRuntime(options);
+
+    std::atomic_size_t executed{0};
+    size_t posted = 0;
+    for (auto _ : state) {
+        AR::Async([&executed]() { executed.fetch_add(1, std::memory_order_relaxed); });
+        ++posted;
+    }
+
+    while (executed.load(std::memory_order_relaxed) < posted) {
+        std::this_thread::yield();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(posted));
+
+    AR::Terminate();
+}
+
+
+static void coroutine_ping_pong(benchmark::State& state) {
+    AR::SetupRuntime();
+    const int messages = static_cast<int>(state.range(0));
+
+    for (auto _ : state) {
+        AR::Channel<int> ping, pong;
+        auto ping_watcher = ping.Watch();
+        auto pong_watcher = pong.Watch();
+
+        auto a = AR::make_coroutine([&](AR::CoroutineHandler* handler, AR::YieldVoid &yield) {
+            for (int i = 0; i < messages; ++i) {
+                ping.Send(i);
+                while (!pong_watcher->TryReceive()) {
+                    AR::Await(pong_watcher->AsyncWait(), handler);
+                }
+            }
+        });
+
+        auto b = AR::make_coroutine([&](AR::CoroutineHandler* handler, AR::YieldVoid &yield) {
+            for (int i = 0; i < messages; ++i) {
+                while (!ping_watcher->TryReceive()) {
+                    AR::Await(ping_watcher->AsyncWait(), handler);
+                }
+                pong.Send(i);
+            }
+        });
+
+        auto future_b = AR::Async(b);
+        auto future_a = AR::Async(a);
+        AR::Await(std::move(future_a));
+        AR::Await(std::move(future_b));
+    }
+    state.SetItemsProcessed(state.iterations() * messages);
+
+    AR::Terminate();
+}
+
+
+static void async_fan_out(benchmark::State& state) {
+    AR::SetupRuntime();
+    const size_t children = static_cast<size_t>(state.range(0));
+    std::atomic_size_t executed{0};
+
+    for (auto _ : state) {
+        executed = 0;
+
+        for (size_t i = 0; i < children; ++i) {
+            AR::Async([&executed]() { executed.fetch_add(1, std::memory_order_relaxed); });
+        }
+
+        // only the spawn is measured
+        state.PauseTiming();
+        while (executed.load(std::memory_order_relaxed) < children) {
+            std::this_thread::yield();
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * children));
+
+    AR::Terminate();
+}
+
+
+static void async_batch_fan_out(benchmark::State& state) {
+    AR::SetupRuntime();
+    const size_t children = static_cast<size_t>(state.range(0));
+    std::atomic_size_t executed{0};
+    std::vector<std::function<void()>> callables(children, [&executed]() {
+        executed.fetch_add(1, std::memory_order_relaxed);
+    });
+
+    for (auto _ : state) {
+        executed = 0;
+
+        AR::AsyncBatch(callables.begin(), callables.end());
+
+        // only the spawn is measured
+        state.PauseTiming();
+        while (executed.load(std::memory_order_relaxed) < children) {
+            std::this_thread::yield();
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * children));
+
+    AR::Terminate();
+}
+
+
+// children complete one after another, as responses of sub-requests arrive
+template< bool joined >
+static void coroutine_fan_in(benchmark::State& state) {
+    AR::SetupRuntime();
+    const auto children = static_cast<size_t>(state.range(0));
+
+    auto fan_in = [children](AR::CoroutineHandler *handler, AR::yield<size_t> &yield) {
+        std::vector<AR::task_promise<size_t>> promises(children);
+        std::vector<AR::future_t<size_t>> futures;
+        futures.reserve(children);
+        for (auto &p : promises) {
+            futures.push_back(p.get_future());
+        }
+
+        // the coroutine can return once the last promise is set, nothing is touched after set_value
+        std::function<void(size_t)> complete = [&promises, &complete](size_t i) {
+            if (i + 1 < promises.size()) {
+                AR::Async([&complete, i]() { complete(i + 1); });
+            }
+            promises[i].set_value(i);
+        };
+        AR::Async([&complete]() { complete(0); });
+
+        size_t sum = 0;
+        if (joined) {
+            AR::Await(AR::WhenAll(futures.begin(), futures.end()), handler);
+            for (auto &f : futures) {
+                sum += f.get();
+            }
+        } else {
+            for (auto &f : futures) {
+                sum += AR::Await(std::move(f), handler);
+            }
+        }
+        return sum;
+    };
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(AR::Await(AR::Async(AR::make_coroutine<size_t>(fan_in))));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * children));
+
+    AR::Terminate();
+}
+
+// round trips to a coroutine of the management group while the analytics group is flooded with cpu bound work
+template<bool with_quota>
+static void work_group_noisy_neighbour(benchmark::State& state) {
+    AR::WorkGroupOption management = {"management", 1.0, 1.0};
+    AR::WorkGroupOption analytics = {"analytics", 4.0, 1.0};
+    analytics.cpu_quota_period_ms = with_quota ? 20 : 0;
+    AR::SetupRuntime({{management, analytics}});
+    const auto management_group = AR::GetWorkGroup("management");
+    const auto analytics_group = AR::GetWorkGroup("analytics");
+
+    std::atomic_bool stop = {false};
+    std::atomic_int64_t analytics_done = {0};
+    std::vector<AR::future_t<void>> flood;
+    for (int i = 0; i < 20000; ++i) {
+        auto coro = AR::make_coroutine([&](AR::CoroutineHandler* handler, AR::YieldVoid &yield) {
+            const auto begin = std::chrono::steady_clock::now();
+            while (!stop.load(std::memory_order_relaxed) &&
+                   std::chrono::steady_clock::now() - begin < std::chrono::microseconds(200)) {
+            }
+            analytics_done.fetch_add(1, std::memory_order_relaxed);
+        });
+        coro->set_execution_state_wg(analytics_group);
+        flood.push_back(AR::Async(coro));
+    }
+
+    for (auto _ : state) {
+        auto ping = AR::make_coroutine<int>([](AR::CoroutineHandler* handler, AR::yield<int> &yield) { return 1; });
+        ping->set_execution_state_wg(management_group);
+        benchmark::DoNotOptimize(AR::Await(AR::Async(ping)));
+    }
+
+    state.counters["analytics_tasks"] = static_cast<double>(analytics_done.load());
+    stop = true;
+    for (auto &f : flood) {
+        AR::Await(std::move(f));
+    }
+    state.SetItemsProcessed(state.iterations());
+    AR::Terminate();
+}
+
+// bursts of blocking tasks on a slot of one worker, an elastic slot activates up to 4 workers for the burst
+template<bool elastic>
+static void slot_blocking_burst(benchmark::State& state) {
+    const auto cpus = AR::GetCPUs();
+    AR::WorkGroupOption option = {"burst", static_cast<double>(cpus.size()), 1.0, 1};
+    if (elastic) {
+        option.max_slot_concurrency = 4;
+        option.scale_queue_size = 4;
+        option.worker_idle_ms = 100;
+    }
+    std::map<size_t, size_t> cpus_wg;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cpus_wg[i] = 0;
+    }
+    AR::ExecutorWorkGroup group(0, option, cpus, cpus_wg);
+    const int tasks = static_cast<int>(state.range(0));
+
+    for (auto _ : state) {
+        std::atomic_int done = {0};
+        for (int i = 0; i < tasks; ++i) {
+            group.Post(AR::make_task([&done]() {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                done.fetch_add(1, std::memory_order_relaxed);
+            }));
+        }
+        while (done.load(std::memory_order_relaxed) < tasks) {
+            std::this_thread::yield();
+        }
+    }
+
+    state.counters["active_workers"] = static_cast<double>(group.GetSlots()[0]->get_active_workers());
+    state.SetItemsProcessed(state.iterations() * tasks);
+    group.Stop();
+}
+
+// post throughput with growing number of producers
+BENCHMARK(slot_post)->ThreadRange(1, 16)->UseRealTime();
+
+// routing of tagged tasks to the entity slots
+BENCHMARK(group_post_tagged)->ThreadRange(1, 16)->UseRealTime();
+
+// routing of untagged posts, the cost doesn't depend on the number of executors
+BENCHMARK(runtime_post)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+// message round trips between two coroutines, resumes go through the worker's next task slot
+BENCHMARK(coroutine_ping_pong)->Arg(1000)->UseRealTime();
+
+// spawning children one by one vs in one batch
+BENCHMARK(async_fan_out)->Arg(10000)->UseRealTime();
+BENCHMARK(async_batch_fan_out)->Arg(10000)->UseRealTime();
+
+// a coroutine awaiting its children one by one vs once with WhenAll
+BENCHMARK_TEMPLATE(coroutine_fan_in, false)->Arg(50)->UseRealTime();
+BENCHMARK_TEMPLATE(coroutine_fan_in, true)->Arg(50)->UseRealTime();
+
+// latency of a light group next to a cpu bound one, without and with the cpu quota of the cpu bound group
+BENCHMARK_TEMPLATE(work_group_noisy_neighbour, false)->Iterations(200)->UseRealTime();
+BENCHMARK_TEMPLATE(work_group_noisy_neighbour, true)->Iterations(200)->UseRealTime();
+
+// a burst of blocking tasks on a fixed and an elastic slot
+BENCHMARK_TEMPLATE(slot_blocking_burst, false)->Arg(256)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_TEMPLATE(slot_blocking_burst, true)->Arg(256)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Run the benchmark
+BENCHMARK_MAIN();
@@ -0,0 +1,143 @@
+#include <benchmark/benchmark.h>
+#include "ar/ar.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#ifdef WITH_PARALLEL_STL
+#include <execution>
+#endif
+
+namespace AR = AsyncRuntime;
+
+
+static std::vector<double> make_values(size_t n) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> dist(0.0, 1000.0);
+    std::vector<double> values(n);
+    for (auto &v : values) {
+        v = dist(rng);
+    }
+    return values;
+}
+
+static double work(double v) {
+    return std::sqrt(v) * std::sin(v) + std::cos(v);
+}
+
+
+static void for_each_serial(benchmark::State& state) {
+    auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        std::for_each(values.begin(), values.end(), [](double &v) { v = work(v); });
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void for_each_ar(benchmark::State& state) {
+    AR::SetupRuntime();
+    auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        AR::parallel_for(values.begin(), values.end(), [](double &v) { v = work(v); });
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    AR::Terminate();
+}
+
+
+static void reduce_serial(benchmark::State& state) {
+    auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(std::accumulate(values.begin(), values.end(), 0.0));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void reduce_ar(benchmark::State& state) {
+    AR::SetupRuntime();
+    auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(AR::parallel_reduce(values.begin(), values.end(), 0.0));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    AR::Terminate();
+}
+
+
+static void sort_serial(benchmark::State& state) {
+    const auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto copy = values;
+        state.ResumeTiming();
+        std::sort(copy.begin(), copy.end());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void sort_ar(benchmark::State& state) {
+    AR::SetupRuntime();
+    const auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto copy = values;
+        state.ResumeTiming();
+        AR::parallel_sort(copy.begin(), copy.end());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    AR::Terminate();
+}
+
+
+#ifdef WITH_PARALLEL_STL
+static void for_each_std_par(benchmark::State& state) {
+    auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        std::for_each(std::execution::par, values.begin(), values.end(), [](double &v) { v = work(v); });
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void reduce_std_par(benchmark::State& state) {
+    auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(std::reduce(std::execution::par, values.begin(), values.end(), 0.0));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void sort_std_par(benchmark::State& state) {
+    const auto values = make_values(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto copy = values;
+        state.ResumeTiming();
+        std::sort(std::execution::par, copy.begin(), copy.end());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+#endif
+
+
+BENCHMARK(for_each_serial)->Arg(1 << 20)->UseRealTime();
+BENCHMARK(for_each_ar)->Arg(1 << 20)->UseRealTime();
+BENCHMARK(reduce_serial)->Arg(1 << 22)->UseRealTime();
+BENCHMARK(reduce_ar)->Arg(1 << 22)->UseRealTime();
+BENCHMARK(sort_serial)->Arg(1 << 20)->UseRealTime();
+BENCHMARK(sort_ar)->Arg(1 << 20)->UseRealTime();
+
+// std::execution::par is backed by TBB in libstdc++
+#ifdef WITH_PARALLEL_STL
+BENCHMARK(for_each_std_par)->Arg(1 << 20)->UseRealTime();
+BENCHMARK(reduce_std_par)->Arg(1 << 22)->UseRealTime();
+BENCHMARK(sort_std_par)->Arg(1 << 20)->UseRealTime();
+#endif
+
+// Run the benchmark
+BENCHMARK_MAIN();
@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+#include "ar/ar.hpp"
+
+#include <random>
+#include <vector>
+
+namespace AR = AsyncRuntime;
+
+
+static AR::resource_pool *pool = nullptr;
+
+
+// every thread allocates a few objects and frees them, as containers and shared pointers of tasks do
+static void pool_allocate_free(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        pool = new AR::resource_pool(128);
+    }
+
+    const size_t batch = 16;
+    std::vector<void *> objects(batch);
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; ++i) {
+            objects[i] = pool->allocate(64);
+        }
+        for (size_t i = 0; i < batch; ++i) {
+            pool->deallocate(objects[i], 64);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+
+    if (state.thread_index() == 0) {
+        delete pool;
+        pool = nullptr;
+    }
+}
+BENCHMARK(pool_allocate_free)->ThreadRange(1, 8)->UseRealTime();
+
+
+// a live set of objects of mixed sizes is replaced one by one, as buffers and frames of coroutines are
+static void pool_mixed_sizes(benchmark::State& state) {
+    // threads free their objects after the loop, the pool outlives them
+    static AR::resource_pool mixed_pool(128);
+
+    const size_t live = 256;
+    std::mt19937 random(static_cast<unsigned>(state.thread_index()));
+    std::uniform_int_distribution<size_t> sizes(16, 4096);
+    std::vector<std::pair<void *, size_t>> objects(live);
+    for (auto &object : objects) {
+        object.second = sizes(random);
+        object.first = mixed_pool.allocate(object.second);
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        auto &object = objects[i++ % live];
+        mixed_pool.deallocate(object.first, object.second);
+        object.second = sizes(random);
+        object.first = mixed_pool.allocate(object.second);
+    }
+    if (state.thread_index() == 0) {
+        state.counters["fragmentation"] = mixed_pool.get_memory_stats().fragmentation;
+    }
+    for (auto &object : objects) {
+        mixed_pool.deallocate(object.first, object.second);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(pool_mixed_sizes)->ThreadRange(1, 8)->UseRealTime();
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,41 @@
+#include <benchmark/benchmark.h>
+#include "ar/ar.hpp"
+
+namespace AR = AsyncRuntime;
+namespace ctx = boost::context;
+
+
+// short lived coroutines, as the children of a recursive computation
+static void coroutine_short_lived(benchmark::State& state) {
+    int sum = 0;
+    for (auto _ : state) {
+        auto coro = AR::make_coroutine<int>([](AR::coroutine_handler *handler, AR::yield<int> &yield) {
+            return 1;
+        });
+        coro->init_promise();
+        auto f = coro->get_future();
+        coro->resume();
+        sum += f.get();
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(coroutine_short_lived)->ThreadRange(1, 8)->UseRealTime();
+
+
+// a stack taken and given back, the first page touched as a coroutine does
+template<class Stack>
+static void stack_allocate_free(benchmark::State& state) {
+    Stack stack(ctx::stack_traits::default_size());
+    for (auto _ : state) {
+        auto sctx = stack.allocate();
+        *(static_cast<volatile char *>(sctx.sp) - 1) = 0;
+        stack.deallocate(sctx);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK_TEMPLATE(stack_allocate_free, AR::basic_fixedsize_stack<ctx::stack_traits>)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(stack_allocate_free, AR::cached_fixedsize_stack<ctx::stack_traits>)->ThreadRange(1, 8)->UseRealTime();
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,67 @@
+#include <benchmark/benchmark.h>
+#include "ar/ar.hpp"
+
+#include <vector>
+
+namespace AR = AsyncRuntime;
+
+
+// per-frame pipeline: input -> width workers -> merge -> width workers -> output
+static void work(std::atomic_size_t &counter) {
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+static void frame_async_await(benchmark::State& state) {
+    AR::SetupRuntime();
+    const auto width = static_cast<size_t>(state.range(0));
+    std::atomic_size_t counter{0};
+
+    for (auto _ : state) {
+        AR::Await(AR::Async([&counter]() { work(counter); }));
+        for (int stage = 0; stage < 2; ++stage) {
+            std::vector<AR::future_t<void>> futures;
+            futures.reserve(width);
+            for (size_t i = 0; i < width; ++i) {
+                futures.push_back(AR::Async([&counter]() { work(counter); }));
+            }
+            for (auto &f : futures) {
+                AR::Await(std::move(f));
+            }
+            AR::Await(AR::Async([&counter]() { work(counter); }));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(2 * width + 3));
+    AR::Terminate();
+}
+
+
+static void frame_task_graph(benchmark::State& state) {
+    AR::SetupRuntime();
+    const auto width = static_cast<size_t>(state.range(0));
+    std::atomic_size_t counter{0};
+
+    AR::TaskGraph graph;
+    auto input = graph.Emplace([&counter]() { work(counter); });
+    auto merge = graph.Emplace([&counter]() { work(counter); });
+    auto output = graph.Emplace([&counter]() { work(counter); });
+    for (size_t i = 0; i < width; ++i) {
+        graph.Emplace([&counter]() { work(counter); }).Succeed(input).Precede(merge);
+        graph.Emplace([&counter]() { work(counter); }).Succeed(merge).Precede(output);
+    }
+
+    for (auto _ : state) {
+        AR::Await(graph.Run());
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(2 * width + 3));
+    AR::Terminate();
+}
+
+
+BENCHMARK(frame_async_await)->Arg(8)->Arg(64)->UseRealTime();
+BENCHMARK(frame_task_graph)->Arg(8)->Arg(64)->UseRealTime();
+
+// Run the benchmark
+BENCHMARK_MAIN();
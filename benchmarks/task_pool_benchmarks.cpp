@@ -0,0 +1,69 @@
+#include <benchmark/benchmark.h>
+#include "ar/ar.hpp"
+
+#include <new>
+#include <cstdlib>
+
+namespace AR = AsyncRuntime;
+
+
+static std::atomic_size_t heap_allocations{0};
+
+void *operator new(std::size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+
+static void task_alloc_free(benchmark::State& state) {
+    for (auto _ : state) {
+        auto *t = AR::make_task([]() { return 1; });
+        benchmark::DoNotOptimize(t);
+        delete t;
+    }
+}
+
+
+static void async_await(benchmark::State& state) {
+    AR::SetupRuntime();
+
+    // warm up the pools
+    for (int i = 0; i < 10000; ++i) {
+        AR::Await(AR::Async([i]() { return i; }));
+    }
+
+    const auto pool_stats = AR::task_pool::get_stats();
+    const size_t heap_start = heap_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(AR::Await(AR::Async([]() { return 1; })));
+    }
+    const size_t heap = heap_allocations.load(std::memory_order_relaxed) - heap_start;
+    const size_t pool = AR::task_pool::get_stats().system_allocations - pool_stats.system_allocations;
+
+    state.counters["task_system_allocs_per_async"] = benchmark::Counter(
+            static_cast<double>(pool) / static_cast<double>(state.iterations()));
+    state.counters["heap_allocs_per_async"] = benchmark::Counter(
+            static_cast<double>(heap) / static_cast<double>(state.iterations()));
+
+    AR::Terminate();
+}
+
+
+BENCHMARK(task_alloc_free);
+
+// allocations per Async in steady state
+BENCHMARK(async_await)->UseRealTime();
+
+// Run the benchmark
+BENCHMARK_MAIN();
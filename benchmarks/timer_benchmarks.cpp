@@ -0,0 +1,159 @@
+#include <benchmark/benchmark.h>
+#include "ar/ar.hpp"
+#include "ar/scheduler.hpp"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace AR = AsyncRuntime;
+
+
+// timeouts which almost never fire: post a batch of delayed tasks and cancel them
+static void scheduler_timeout_churn(benchmark::State& state) {
+    AR::Scheduler scheduler([](AR::task *t) { delete t; });
+    const auto timers = static_cast<size_t>(state.range(0));
+    std::vector<AR::CancellationToken> tokens(timers);
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < timers; ++i) {
+            tokens[i] = AR::CancellationToken();
+            auto *t = AR::make_dummy_task();
+            t->set_delay<AR::Timestamp::Milli>(1000 + i);
+            t->set_cancellation(tokens[i]);
+            scheduler.Post(t);
+        }
+        for (auto &token : tokens) {
+            token.Cancel();
+        }
+    }
+
+    state.counters["pending"] = static_cast<double>(scheduler.GetPendingCount());
+    state.counters["wakeups"] = benchmark::Counter(static_cast<double>(scheduler.GetWakeupsCount()),
+                                                   benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * timers);
+}
+
+
+// post and cancel of a timeout while range(0) far timers are outstanding
+static void scheduler_outstanding_timers(benchmark::State& state) {
+    AR::Scheduler scheduler([](AR::task *t) { delete t; });
+    std::mt19937 rng(42);
+    // 1 s .. 1 h
+    std::uniform_int_distribution<AR::Timespan> delays(1000, 3600 * 1000);
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        auto *t = AR::make_dummy_task();
+        t->set_delay<AR::Timestamp::Milli>(delays(rng));
+        scheduler.Post(t);
+    }
+
+    for (auto _ : state) {
+        AR::CancellationToken token;
+        auto *t = AR::make_dummy_task();
+        t->set_delay<AR::Timestamp::Milli>(delays(rng));
+        t->set_cancellation(token);
+        scheduler.Post(t);
+        token.Cancel();
+    }
+
+    state.counters["pending"] = static_cast<double>(scheduler.GetPendingCount());
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+// range(0) timers spread over 10 s are posted and expired in one pass
+static void scheduler_post_expire(benchmark::State& state) {
+    size_t expired = 0;
+    AR::Scheduler scheduler([&expired](AR::task *t) {
+        ++expired;
+        delete t;
+    });
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<AR::Timespan> delays(0, 10 * 1000 * 1000);
+
+    for (auto _ : state) {
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            auto *t = AR::make_dummy_task();
+            t->set_delay<AR::Timestamp::Micro>(delays(rng));
+            scheduler.Post(t);
+        }
+        scheduler.Advance(AR::Timestamp::NowMicro() + 11 * 1000 * 1000);
+    }
+
+    state.counters["expired"] = benchmark::Counter(static_cast<double>(expired), benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+
+// a coroutine waits for a reply with a timeout, the reply always comes first
+static void coroutine_await_timeout(benchmark::State& state) {
+    AR::SetupRuntime();
+    const auto awaits = static_cast<int>(state.range(0));
+
+    for (auto _ : state) {
+        auto coro = AR::make_coroutine<int>([awaits](AR::CoroutineHandler *handler, AR::yield<int> &yield) {
+            int sum = 0;
+            for (int i = 0; i < awaits; ++i) {
+                AR::CancellationToken timeout;
+                AR::AsyncDelayed(timeout, [timeout]() { timeout.Cancel(); }, 1000);
+                sum += AR::Await(AR::Async([i]() { return i; }), handler, timeout);
+                timeout.Cancel();
+            }
+            return sum;
+        });
+        benchmark::DoNotOptimize(AR::Await(AR::Async(coro)));
+    }
+
+    state.SetItemsProcessed(state.iterations() * awaits);
+    AR::Terminate();
+}
+
+
+// range(0) coroutines tick with periods of 40 ms within the slack, every tick of the shared clock resumes them all
+static void ticker_shared_period(benchmark::State& state) {
+    using namespace std::chrono_literals;
+    AR::SetupRuntime();
+    const auto tickers_count = static_cast<size_t>(state.range(0));
+    const int ticks = 5;
+    size_t fires = 0;
+    AR::Timespan lateness = 0;
+
+    for (auto _ : state) {
+        std::vector<std::unique_ptr<AR::Ticker>> tickers;
+        std::vector<AR::future_t<int>> results;
+        for (size_t i = 0; i < tickers_count; ++i) {
+            tickers.push_back(std::make_unique<AR::Ticker>(40ms + std::chrono::microseconds(i % 1000)));
+            auto *ticker = tickers.back().get();
+            auto coro = AR::make_coroutine<int>([ticker](AR::CoroutineHandler *handler, AR::yield<int> &yield) {
+                int n = 0;
+                while (n < ticks && ticker->AwaitTick(handler)) {
+                    ++n;
+                }
+                return n;
+            });
+            results.push_back(AR::Async(coro));
+        }
+        for (auto &result : results) {
+            benchmark::DoNotOptimize(AR::Await(std::move(result)));
+        }
+
+        const auto stats = tickers.front()->GetStats();
+        fires += stats.fires;
+        lateness = std::max(lateness, stats.max_lateness_us);
+    }
+
+    state.counters["fires"] = benchmark::Counter(static_cast<double>(fires), benchmark::Counter::kAvgIterations);
+    state.counters["max_lateness_us"] = static_cast<double>(lateness);
+    state.SetItemsProcessed(state.iterations() * tickers_count * ticks);
+    AR::Terminate();
+}
+
+
+BENCHMARK(scheduler_timeout_churn)->Arg(1000)->Arg(10000)->UseRealTime();
+BENCHMARK(scheduler_outstanding_timers)->Arg(1000)->Arg(1000000)->UseRealTime();
+BENCHMARK(scheduler_post_expire)->Arg(1000000)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(coroutine_await_timeout)->Arg(1000)->UseRealTime();
+BENCHMARK(ticker_shared_period)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+BENCHMARK_MAIN();
@@ -13,6 +13,8 @@ namespace AsyncRuntime {
 
     inline resource_pool * GetDefaultResource();
 
+    inline int GetLocalNumaNode();
+
     template<class T>
     class Allocator {
     public:
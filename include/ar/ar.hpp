@@ -8,6 +8,8 @@
 #include "ar/profiler.hpp"
 #include "ar/channel.hpp"
 #include "ar/triple_buffer.hpp"
+#include "ar/parallel.hpp"
+#include "ar/task_graph.hpp"
 
 
 #endif //AR_ARRAY_H
\ No newline at end of file
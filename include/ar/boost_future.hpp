@@ -0,0 +1,63 @@
+#ifndef AR_BOOST_FUTURE_H
+#define AR_BOOST_FUTURE_H
+
+#ifndef BOOST_THREAD_PROVIDES_FUTURE
+#define BOOST_THREAD_PROVIDES_FUTURE 1
+#endif
+#ifndef BOOST_THREAD_PROVIDES_FUTURE_CONTINUATION
+#define BOOST_THREAD_PROVIDES_FUTURE_CONTINUATION 1
+#endif
+
+#include "ar/future.hpp"
+
+#include <boost/thread/future.hpp>
+#include <memory>
+
+namespace AsyncRuntime {
+
+    /**
+     * @brief converts a runtime future to boost::future, for the code built around boost continuations
+     */
+    template< typename T >
+    boost::future<T> to_boost_future(task_future<T> && future) {
+        auto promise = std::make_shared<boost::promise<T>>();
+        auto res = promise->get_future();
+        future.then([promise](task_future<T> f) {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    f.get();
+                    promise->set_value();
+                } else {
+                    promise->set_value(f.get());
+                }
+            } catch (...) {
+                promise->set_exception(boost::current_exception());
+            }
+        });
+        return res;
+    }
+
+    /**
+     * @brief converts boost::future to a runtime future, e.g. to Await it in a coroutine
+     */
+    template< typename T >
+    task_future<T> from_boost_future(boost::future<T> && future) {
+        auto promise = std::make_shared<task_promise<T>>();
+        auto res = promise->get_future();
+        future.then(boost::launch::sync, [promise](boost::future<T> f) {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    f.get();
+                    promise->set_value();
+                } else {
+                    promise->set_value(f.get());
+                }
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+        return res;
+    }
+}
+
+#endif //AR_BOOST_FUTURE_H
@@ -0,0 +1,132 @@
+#ifndef AR_CANCELLATION_H
+#define AR_CANCELLATION_H
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+
+namespace AsyncRuntime {
+
+    namespace detail {
+        class cancellation_state;
+    }
+
+    /**
+     * @brief the future of a cancelled operation is resolved with it
+     */
+    class OperationCancelled : public std::runtime_error {
+    public:
+        OperationCancelled() : std::runtime_error("operation cancelled") { }
+    };
+
+    /**
+     * @class cancellation_callback
+     * @brief Intrusive node called once when its token is cancelled.
+     *
+     * The node is owned by the registrant, on_cancel() is called on the thread which cancels
+     * the token, after the node is unlinked. remove_callback() returning false means on_cancel()
+     * was called or is running, the node must stay alive until it returns.
+     */
+    class cancellation_callback {
+        friend class detail::cancellation_state;
+    public:
+        virtual void on_cancel() noexcept = 0;
+    protected:
+        ~cancellation_callback() = default;
+    private:
+        cancellation_callback *prev = nullptr;
+        cancellation_callback *next = nullptr;
+        bool linked = false;
+    };
+
+    namespace detail {
+
+        /**
+         * @class cancellation_state
+         * @brief Shared state of a token: the flag and the list of callbacks.
+         */
+        class cancellation_state {
+        public:
+            void add_ref() noexcept {
+                refs.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void release() noexcept {
+                if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    delete this;
+                }
+            }
+
+            bool is_cancelled() const noexcept {
+                return cancelled.load(std::memory_order_acquire);
+            }
+
+            /**
+             * @return false if the token is already cancelled, the callback isn't linked then
+             */
+            bool add_callback(cancellation_callback *callback) noexcept;
+
+            /**
+             * @return true if the callback was unlinked before it was called
+             */
+            bool remove_callback(cancellation_callback *callback) noexcept;
+
+            void cancel() noexcept;
+
+            /**
+             * @brief queries if callbacks are linked at the time of this call
+             */
+            bool has_callbacks() noexcept {
+                std::lock_guard<std::mutex> lock(mutex);
+                return head != nullptr;
+            }
+        private:
+            std::atomic_uint            refs = {1};
+            std::atomic_bool            cancelled = {false};
+            std::mutex                  mutex;
+            cancellation_callback       *head = nullptr;
+        };
+    }
+
+    /**
+     * @class CancellationToken
+     * @brief Cancels the tasks, delayed tasks and awaits it's attached to.
+     *
+     * Copies share the state. A cancelled delayed task is removed from its scheduler at once,
+     * a cancelled task doesn't run, their futures are resolved with OperationCancelled.
+     */
+    class CancellationToken {
+    public:
+        CancellationToken() : state(new detail::cancellation_state) { }
+
+        CancellationToken(const CancellationToken &other) noexcept : state(other.state) {
+            state->add_ref();
+        }
+
+        CancellationToken &operator=(const CancellationToken &other) noexcept {
+            other.state->add_ref();
+            state->release();
+            state = other.state;
+            return *this;
+        }
+
+        ~CancellationToken() { state->release(); }
+
+        void Cancel() const noexcept { state->cancel(); }
+
+        bool IsCancelled() const noexcept { return state->is_cancelled(); }
+
+        void ThrowIfCancelled() const {
+            if (IsCancelled()) {
+                throw OperationCancelled();
+            }
+        }
+
+        detail::cancellation_state *GetState() const noexcept { return state; }
+    private:
+        detail::cancellation_state *state;
+    };
+}
+
+#endif //AR_CANCELLATION_H
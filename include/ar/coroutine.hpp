@@ -4,6 +4,7 @@
 #include "ar/task.hpp"
 #include "ar/stack.hpp"
 #include "ar/pooled_stack.hpp"
+#include "ar/stack_cache.hpp"
 #include "ar/allocators.hpp"
 
 #include <config.hpp>
@@ -56,6 +57,8 @@ namespace AsyncRuntime {
             execution_state.tag = tag;
             execution_state.processor = INVALID_OBJECT_ID;
         }
+
+        void set_execution_state_priority(TaskPriority priority) { execution_state.priority = priority; }
     protected:
         void create();
 
@@ -125,8 +128,12 @@ namespace AsyncRuntime {
     public:
         coroutine() = default;
 
-        explicit coroutine(coroutine::Fn &&f) : fn(f), end{false}, resource{nullptr} {
-            continuation = ctx::continuation(ctx::callcc(std::allocator_arg, basic_fixedsize_stack<ctx::stack_traits>(), [this](ctx::continuation &&c) {
+        /**
+         * @brief the stack is taken from the stack_cache, bound to the numa node that runs the coroutine
+         */
+        explicit coroutine(coroutine::Fn &&f, const stack_options &options = {}) : fn(f), end{false}, resource{nullptr} {
+            cached_fixedsize_stack<ctx::stack_traits> stack(options.size, GetLocalNumaNode());
+            continuation = ctx::continuation(ctx::callcc(std::allocator_arg, stack, [this](ctx::continuation &&c) {
                 y.continuation = std::move(c);
                 y.continuation = y.continuation.resume();
                 call();
@@ -305,6 +312,20 @@ namespace AsyncRuntime {
         return std::allocate_shared<coroutine<Ret>>(Allocator<coroutine<Ret>>(resource), std::forward<Fn>(fn), resource);
     }
 
+    /**
+     * @brief coroutine with a stack of its own size
+     */
+    template <typename Ret = void, typename Fn, typename ...Arguments>
+    std::shared_ptr<coroutine<Ret>> make_coroutine(stack_options options, Fn &&fn, Arguments &&... args) {
+        return std::make_shared<coroutine<Ret>>(std::bind(std::forward<Fn>(fn), std::placeholders::_1, std::placeholders::_2, std::forward<Arguments>(args)...),
+                options);
+    }
+
+    template <typename Ret = void, typename Fn>
+    std::shared_ptr<coroutine<Ret>> make_coroutine(stack_options options, Fn &&fn) {
+        return std::make_shared<coroutine<Ret>>(std::forward<Fn>(fn), options);
+    }
+
     typedef coroutine_handler CoroutineHandler;
     typedef yield<void> YieldVoid;
 }
@@ -1,14 +1,21 @@
 #ifndef AR_CPU_HELPER_HPP
 #define AR_CPU_HELPER_HPP
 
+#include <string>
 #include <thread>
 #include <vector>
 
+#define AR_SYSFS_CPU_ROOT "/sys/devices/system/cpu"
+
 namespace AsyncRuntime {
 
     struct CPU {
         size_t      id;
         size_t      numa_node_id;
+        // the lowest cpu of the core: hyperthread siblings share it
+        size_t      core_id = 0;
+        // the lowest cpu sharing the last level cache with this one
+        size_t      llc_id = 0;
     };
 
     struct NumaNode {
@@ -18,9 +25,48 @@ namespace AsyncRuntime {
 
     int SetAffinity(std::thread & thread, const AsyncRuntime::CPU &affinity_cpu);
 
+    /**
+     * @brief cpus the process may run on, with their cores and cache domains
+     */
     std::vector<CPU> GetCPUs();
     std::vector<NumaNode> GetNumaNodes();
     std::vector<NumaNode> GetManualNumaNodes(int count);
+
+    /**
+     * @brief parses a cpu list of sysfs and cgroups, as "0-3,8,10-11"
+     */
+    std::vector<size_t> ParseCpuList(const std::string &list);
+
+    /**
+     * @brief cpus of the affinity mask of the process and of the cpuset of its cgroup, empty if unknown
+     */
+    std::vector<size_t> GetAllowedCPUs();
+
+    /**
+     * @brief reads the topology of the online cpus from a sysfs tree as /sys/devices/system/cpu
+     * @param allowed cpus to keep, all online cpus if empty
+     * @return cpus ordered by id, empty if the tree can't be read
+     */
+    std::vector<CPU> ReadCPUs(const std::string &sysfs_cpu_root, const std::vector<size_t> &allowed = {});
+
+    /**
+     * @brief memory bound to a numa node with mbind, plain memory for node -1 or a single node system
+     * @return memory to be freed with NumaFree, nullptr if out of memory
+     */
+    void *NumaAlloc(size_t size, int numa_node);
+
+    void NumaFree(void *ptr);
+
+    /**
+     * @brief binds pages not touched yet to a numa node, nothing for node -1 or a single node system
+     * @param ptr page aligned memory, as of mmap
+     */
+    void NumaBind(void *ptr, size_t size, int numa_node);
+
+    /**
+     * @brief numa node of the cpu the calling thread runs on, -1 if unknown
+     */
+    int GetCurrentNumaNode();
 }
 
 #endif //AR_CPU_HELPER_HPP
@@ -239,7 +239,7 @@ namespace AsyncRuntime::Dataflow {
             future_res = f.share();
 
             if (terminated_callback) {
-                future_res.then(boost::launch::sync, [terminated_callback](boost::shared_future<int> f) {
+                future_res.then([terminated_callback](AsyncRuntime::shared_future_t<int> f) {
                     int res = f.get();
                     if (terminated_callback) {
                         terminated_callback(res);
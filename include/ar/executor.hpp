@@ -4,6 +4,9 @@
 #include "ar/task.hpp"
 #include "ar/metricer.hpp"
 #include "ar/scheduler.hpp"
+#include "ar/thread_executor.hpp"
+
+#include <functional>
 
 #ifdef USE_TESTS
 class EXECUTOR_TEST_FRIEND;
@@ -16,6 +19,29 @@ namespace AsyncRuntime {
         double                          cap;
         double                          util;
         int                             slot_concurrency = 0;
+        // min queue size of a worker on an other numa node to steal from it, 0 - don't steal across numa nodes
+        int                             numa_steal_threshold = 0;
+        // spin budget of an idle worker before it parks, in explore rounds; the budget adapts between min and max
+        // to how soon parked workers are woken up. 0 - defaults. latency sensitive groups: raise both,
+        // batch groups: keep max_spin small to park quickly
+        int                             min_spin = 0;
+        int                             max_spin = 0;
+        // period of moving entities between slots by their measured cpu time (needs MEASURE_CPU_TIME), 0 - off
+        int                             rebalance_interval_ms = 0;
+        // spread between the most and the least loaded slot, relative to the average slot load, that triggers a move
+        double                          rebalance_threshold = 0.25;
+        // tick of the timing wheel of delayed tasks, us; 0 - SCHEDULER_TICK_US
+        int                             timer_tick_us = 0;
+        // period of the cpu quota, ms: the group runs tasks for at most cpus * util / cap of every period,
+        // by the execution time of its tasks (thread cpu time with MEASURE_CPU_TIME), and waits over it. 0 - off
+        int                             cpu_quota_period_ms = 0;
+        // elastic slots: a slot starts slot_concurrency workers and activates more, up to max_slot_concurrency, when
+        // a worker sees scale_queue_size tasks in its queue or a task queued for scale_delay_us. 0 - fixed
+        int                             max_slot_concurrency = 0;
+        int                             scale_queue_size = 64;
+        int                             scale_delay_us = 1000;
+        // a worker parked for this time without a wakeup is deactivated, down to one per slot. 0 - never
+        int                             worker_idle_ms = 0;
     };
 
     enum ExecutorType {
@@ -26,6 +52,8 @@ namespace AsyncRuntime {
 
 #define MAX_ENTITIES 500
 #define MAX_GROUPS 10
+// entity ids are 16 bit, the routing table of a work group covers all of them
+#define MAX_ENTITY_ID (1 << 16)
 
     class IExecutor: public BaseObject {
     public:
@@ -35,6 +63,11 @@ namespace AsyncRuntime {
 
         virtual void Post(task *task) = 0;
 
+        /**
+         * @brief posts n tasks, executors override it to route and wake up workers once per batch
+         */
+        virtual void PostBatch(task **tasks, size_t n);
+
         virtual uint16_t AddEntity(void *ptr);
 
         virtual void DeleteEntity(uint16_t id);
@@ -63,34 +96,127 @@ namespace AsyncRuntime {
     };
 
     class ExecutorSlot;
+    class EntityBalancer;
+    class CpuQuota;
+    class Executor;
 
     class ExecutorWorkGroup {
     public:
         ExecutorWorkGroup(int id,
                           const WorkGroupOption & option,
                           const std::vector<AsyncRuntime::CPU> &cpus,
-                          std::map<size_t, size_t>& cpus_wg);
+                          std::map<size_t, size_t>& cpus_wg,
+                          Executor *executor = nullptr);
         ~ExecutorWorkGroup();
 
         void MakeMetrics(const std::string &executor_name, const std::shared_ptr<Mon::IMetricer> &m);
 
         void Post(task *task);
 
+        void PostBatch(task **tasks, size_t n);
+
+        void AddEntity(uint16_t id);
+
         void DeleteEntity(uint16_t id);
 
+        /**
+         * @brief slot the tasks of an entity are posted to, -1 if the entity is not assigned
+         */
+        int GetEntitySlot(uint16_t id) const { return entities_peer_slot[id].load(std::memory_order_acquire); }
+
+        void Stop();
+
+        void NotifyIdle(ExecutorSlot *busy_slot);
+
+        void SetRemoteGroups(const std::vector<ExecutorWorkGroup*> &groups);
+
         const std::vector<ExecutorSlot*> & GetSlots() const { return slots;}
+
+        const std::vector<ExecutorWorkGroup*> & GetRemoteGroups() const { return remote_groups; }
+
+        bool IsReady() const { return ready.load(std::memory_order_acquire); }
+
+        bool HasRemoteGroups() const { return remote_ready.load(std::memory_order_acquire); }
+
+        size_t GetNumaStealThreshold() const { return numa_steal_threshold; }
+
+        int GetMinSpin() const { return min_spin; }
+
+        int GetMaxSpin() const { return max_spin; }
+
+        Executor *GetExecutor() const { return executor; }
+
+        Scheduler *GetScheduler() const { return scheduler.get(); }
+
+        int GetId() const { return id; }
+
+        bool IsBalancing() const { return balancing; }
+
+        int GetWorkerIdleMs() const { return worker_idle_ms; }
+
+        size_t GetScaleQueueSize() const { return scale_queue_size; }
+
+        Timespan GetScaleDelay() const { return scale_delay_us; }
+
+        void AccountEntity(uint16_t id, uint64_t cpu_time) {
+            entities_cpu_time[id].fetch_add(cpu_time, std::memory_order_relaxed);
+        }
+
+        bool HasQuota() const { return quota != nullptr; }
+
+        /**
+         * @brief takes the execution time of a task out of the cpu quota, ns
+         * @return steady clock time in ns until which the workers must not run tasks, 0 if the group is within the quota
+         */
+        uint64_t ChargeQuota(uint64_t cpu_time, uint64_t now);
+
+        /**
+         * @brief accounts the time a worker has waited for the quota, ns
+         */
+        void AccountThrottled(uint64_t time);
     private:
+        int AssignEntity(uint16_t id);
+
+        void RebalanceLoop();
+
+        void Rebalance();
+
         std::shared_ptr<Mon::IMetricer> metricer;
         std::shared_ptr<Mon::Counter>   workers_count;
         std::shared_ptr<Mon::Counter>   slots_count;
+        std::shared_ptr<Mon::Counter>   migrations_count;
+        std::shared_ptr<Mon::Counter>   quota_cpu_time;
+        std::shared_ptr<Mon::Counter>   quota_throttled_periods;
+        std::shared_ptr<Mon::Counter>   quota_throttled_time;
+        std::vector<std::shared_ptr<Mon::Counter>> slots_cpu_time;
 
         int                             id;
         std::string                     name;
-        std::mutex                      mutex;
-        std::map<uint16_t, int>         entities_peer_slot;
+        Executor                        *executor = nullptr;
+        // slot index per entity id, -1 if the entity is not assigned yet
+        std::unique_ptr<std::atomic_int16_t[]> entities_peer_slot;
+        // cpu time of entities since the last rebalance, ns
+        std::unique_ptr<std::atomic_uint64_t[]> entities_cpu_time;
         std::map<int, int>              cpus_peer_slot;
         std::vector<ExecutorSlot*>      slots;
+        std::vector<ExecutorWorkGroup*> remote_groups;
+        std::atomic_bool                ready = {false};
+        std::atomic_bool                remote_ready = {false};
+        size_t                          numa_steal_threshold = 0;
+        int                             min_spin = 0;
+        int                             max_spin = 0;
+        bool                            balancing = false;
+        int                             rebalance_interval_ms = 0;
+        int                             worker_idle_ms = 0;
+        size_t                          scale_queue_size = 0;
+        Timespan                        scale_delay_us = 0;
+        std::unique_ptr<EntityBalancer> balancer;
+        ThreadExecutor                  rebalancer_th;
+        std::mutex                      rebalance_mutex;
+        std::condition_variable         rebalance_cv;
+        bool                            rebalance_stop = false;
         std::unique_ptr<Scheduler>      scheduler;
+        std::unique_ptr<CpuQuota>       quota;
     };
 
     class Executor  : public IExecutor {
@@ -112,6 +238,11 @@ namespace AsyncRuntime {
 
         const std::vector<std::thread::id> & GetThreadIds() const { return thread_ids; }
 
+        /**
+         * @brief numa node of the cpus of the executor, -1 if it has no cpus
+         */
+        int GetNumaNode() const { return cpus.empty() ? -1 : static_cast<int>(cpus.front().numa_node_id); }
+
         void MakeMetrics(const std::shared_ptr<Mon::IMetricer> &m) override;
 
         uint16_t AddEntity(void *ptr) override;
@@ -119,8 +250,57 @@ namespace AsyncRuntime {
         virtual void DeleteEntity(uint16_t id) override;
 
         void Post(task *task) override;
+
+        void PostBatch(task **tasks, size_t n) override;
+
+        void Stop();
+
+        void SetRemoteExecutors(const std::vector<Executor*> &executors);
+
+        /**
+         * @brief executor of the calling worker thread, nullptr for other threads
+         */
+        static Executor *Current() noexcept;
+
+        /**
+         * @brief work group of the calling worker thread, INVALID_OBJECT_ID for other threads
+         */
+        static ObjectID CurrentWorkGroup() noexcept;
+
+        /**
+         * @brief tasks in the queue of the calling worker thread, 0 for other threads
+         */
+        static size_t LocalQueueSize() noexcept;
+
+        /**
+         * @brief pushes a task to the queue of the calling worker thread, idle siblings steal it from there
+         * @return false if the calling thread isn't a worker
+         */
+        static bool PostLocal(task *task);
+
+        /**
+         * @brief runs the task on top of the calling worker's queue if accept takes it, lets a worker run its own
+         * forked work while waiting for it; a task not taken goes to the worker's inbox and runs after the wait
+         * @return false if the calling thread isn't a worker or there was no task to take
+         */
+        static bool RunLocal(const std::function<bool(task *)> &accept);
     private:
+        friend class ExecutorSlot;
+
+        static void SetCurrent(Executor *executor) noexcept;
+
+        /**
+         * @brief the cpu with the fewest active workers of all groups, for a worker being activated
+         * @param llc_id last level cache domain of the slot, preferred among equally loaded cpus
+         */
+        CPU AcquireCpu(size_t llc_id);
+
+        void ReleaseCpu(size_t cpu_id);
+
         std::atomic_uint16_t                                     entities_inc;
+        std::vector<CPU>                                         cpus;
+        // active workers per cpu
+        std::unique_ptr<std::atomic_int[]>                       cpu_workers;
         std::vector<ExecutorWorkGroup*>                          groups;
         ExecutorWorkGroup                                        *main_group;
         std::vector<std::thread::id>                             thread_ids;
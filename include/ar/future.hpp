@@ -0,0 +1,703 @@
+#ifndef AR_FUTURE_H
+#define AR_FUTURE_H
+
+#include "ar/task_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace AsyncRuntime {
+
+    namespace detail {
+        class future_state_base;
+
+        template< typename T >
+        class when_state;
+    }
+
+    template< typename T >
+    class task_future;
+
+    template< typename T >
+    class task_shared_future;
+
+    template< typename T >
+    class task_promise;
+
+    /**
+     * @class future_waiter
+     * @brief Intrusive node waiting for a future to become ready.
+     *
+     * The node is owned by the waiter (e.g. lives on a suspended coroutine stack),
+     * the state only links it. notify() is called once, on the thread which
+     * satisfies the promise; the node must not be touched by the state after that.
+     */
+    class future_waiter {
+        friend class detail::future_state_base;
+    public:
+        virtual void notify() noexcept = 0;
+    protected:
+        ~future_waiter() = default;
+    private:
+        future_waiter *next_waiter = nullptr;
+    };
+
+    namespace detail {
+
+        /**
+         * @class future_state_base
+         * @brief Shared state of a promise and its futures.
+         *
+         * A single atomic word holds the ready flag, the flag of blocked threads and
+         * the stack of waiters, so a promise with one coroutine awaiting it is satisfied
+         * with one exchange and a future is awaited with one CAS. Blocked threads wait
+         * in a striped parking lot instead of a mutex and a condition variable per state.
+         */
+        class future_state_base {
+        public:
+            void add_ref() noexcept {
+                refs.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void release() noexcept {
+                if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    destroy();
+                }
+            }
+
+            bool is_ready() const noexcept {
+                return (word.load(std::memory_order_acquire) & kReady) != 0;
+            }
+
+            bool is_satisfied() const noexcept {
+                return satisfied.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief links the waiter to the state
+             * @return false if the state is already ready, the waiter isn't linked then
+             */
+            bool add_waiter(future_waiter *waiter) noexcept {
+                uintptr_t current = word.load(std::memory_order_acquire);
+                do {
+                    if (current & kReady) {
+                        return false;
+                    }
+                    waiter->next_waiter = reinterpret_cast<future_waiter *>(current & kWaitersMask);
+                } while (!word.compare_exchange_weak(current,
+                                                     reinterpret_cast<uintptr_t>(waiter) | (current & kBlocked),
+                                                     std::memory_order_release,
+                                                     std::memory_order_acquire));
+                return true;
+            }
+
+            void wait() noexcept;
+
+            bool wait_until(std::chrono::steady_clock::time_point deadline) noexcept;
+
+            const std::exception_ptr &get_exception() const noexcept { return exception; }
+
+            void set_exception(std::exception_ptr e) {
+                satisfy();
+                exception = std::move(e);
+                mark_ready();
+            }
+        protected:
+            future_state_base() = default;
+            virtual ~future_state_base() = default;
+
+            virtual void destroy() noexcept = 0;
+
+            void satisfy();
+
+            void unsatisfy() noexcept {
+                satisfied.store(false, std::memory_order_relaxed);
+            }
+
+            void mark_ready() noexcept;
+
+            static void *allocate(size_t size, size_t align) {
+                if (align > alignof(std::max_align_t)) {
+                    return ::operator new(size, std::align_val_t(align));
+                }
+                return task_pool::allocate(size);
+            }
+
+            static void deallocate(void *ptr, size_t size, size_t align) noexcept {
+                if (align > alignof(std::max_align_t)) {
+                    ::operator delete(ptr, size, std::align_val_t(align));
+                } else {
+                    task_pool::deallocate(ptr, size);
+                }
+            }
+
+            std::exception_ptr exception;
+        private:
+            static constexpr uintptr_t kReady = 1;
+            static constexpr uintptr_t kBlocked = 2;
+            static constexpr uintptr_t kWaitersMask = ~(kReady | kBlocked);
+
+            std::atomic<uintptr_t> word = {0};
+            std::atomic_uint refs = {1};
+            std::atomic_bool satisfied = {false};
+        };
+
+        template< typename T >
+        class future_state : public future_state_base {
+        public:
+            static future_state *make() {
+                return new (allocate(sizeof(future_state), alignof(future_state))) future_state;
+            }
+
+            template< typename U >
+            void set_value(U &&v) {
+                satisfy();
+                try {
+                    value.emplace(std::forward<U>(v));
+                } catch (...) {
+                    // as std::promise, the state stays unsatisfied
+                    unsatisfy();
+                    throw;
+                }
+                mark_ready();
+            }
+
+            T &get_value() noexcept { return *value; }
+        private:
+            void destroy() noexcept override {
+                this->~future_state();
+                deallocate(this, sizeof(future_state), alignof(future_state));
+            }
+
+            std::optional<T> value;
+        };
+
+        template< >
+        class future_state<void> : public future_state_base {
+        public:
+            static future_state *make() {
+                return new (allocate(sizeof(future_state), alignof(future_state))) future_state;
+            }
+
+            void set_value() {
+                satisfy();
+                mark_ready();
+            }
+        private:
+            void destroy() noexcept override {
+                this->~future_state();
+                deallocate(this, sizeof(future_state), alignof(future_state));
+            }
+        };
+
+        /**
+         * @brief continuation of then(), resolves its own promise with the result of the callable
+         */
+        template< typename Future, typename F, typename R >
+        class future_continuation final : public future_waiter {
+        public:
+            future_continuation(Future &&parent, F &&fn) : parent(std::move(parent)), fn(std::move(fn)) { }
+
+            static future_continuation *make(Future &&parent, F &&fn) {
+                void *ptr = task_pool::allocate(sizeof(future_continuation));
+                return new (ptr) future_continuation(std::move(parent), std::move(fn));
+            }
+
+            task_future<R> get_future() { return promise.get_future(); }
+
+            void notify() noexcept override {
+                try {
+                    if constexpr (std::is_void_v<R>) {
+                        fn(std::move(parent));
+                        promise.set_value();
+                    } else {
+                        promise.set_value(fn(std::move(parent)));
+                    }
+                } catch (...) {
+                    if (!promise.is_satisfied()) {
+                        promise.set_exception(std::current_exception());
+                    }
+                }
+
+                this->~future_continuation();
+                task_pool::deallocate(this, sizeof(future_continuation));
+            }
+        private:
+            Future          parent;
+            F               fn;
+            task_promise<R> promise;
+        };
+
+        /**
+         * @class when_state
+         * @brief State of a joined future: WhenAll (T = void) or WhenAny (T = size_t, index of the first ready).
+         *
+         * One countdown for all awaited futures, the waiter nodes linked to them are allocated
+         * in the same block. Every linked node holds a reference to the state until it's notified.
+         */
+        template< typename T >
+        class when_state final : public future_state<T> {
+            class node final : public future_waiter {
+            public:
+                node(when_state *owner, size_t index) noexcept : owner(owner), index(index) { }
+
+                void notify() noexcept override {
+                    owner->arrive(index);
+                    owner->release();
+                }
+            private:
+                when_state  *owner;
+                size_t      index;
+            };
+        public:
+            static when_state *make(size_t n) {
+                void *ptr = future_state_base::allocate(block_size(n), alignof(when_state));
+                return new (ptr) when_state(n);
+            }
+
+            /**
+             * @brief links the next awaited future, futures are indexed in the order of linking
+             */
+            template< typename Future >
+            void link(Future &future) {
+                const size_t index = linked++;
+                if constexpr (!std::is_void_v<T>) {
+                    if (remaining.load(std::memory_order_relaxed) == 0) {
+                        return;
+                    }
+                }
+
+                auto *waiter = new (nodes() + index) node(this, index);
+                this->add_ref();
+                if (!future.add_waiter(waiter)) {
+                    this->release();
+                    arrive(index);
+                }
+            }
+
+            /**
+             * @brief called once after linking, the reference of the linking side goes to the future
+             */
+            task_future<T> get_future() {
+                if (count == 0) {
+                    if constexpr (std::is_void_v<T>) {
+                        this->set_value();
+                    } else {
+                        this->set_value(static_cast<size_t>(-1));
+                    }
+                }
+                return task_future<T>(this);
+            }
+        private:
+            explicit when_state(size_t n) noexcept
+                : count(n)
+                , remaining(std::is_void_v<T> ? n : 1) { }
+
+            static size_t block_size(size_t n) noexcept {
+                return sizeof(when_state) + n * sizeof(node);
+            }
+
+            node *nodes() noexcept {
+                return reinterpret_cast<node *>(this + 1);
+            }
+
+            void arrive(size_t index) noexcept {
+                if constexpr (std::is_void_v<T>) {
+                    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        this->set_value();
+                    }
+                } else {
+                    if (remaining.exchange(0, std::memory_order_acq_rel) != 0) {
+                        this->set_value(index);
+                    }
+                }
+            }
+
+            void destroy() noexcept override {
+                const size_t size = block_size(count);
+                this->~when_state();
+                future_state_base::deallocate(this, size, alignof(when_state));
+            }
+
+            const size_t        count;
+            size_t              linked = 0;
+            std::atomic_size_t  remaining;
+        };
+
+        template< typename F, typename = void >
+        struct is_waitable : std::false_type { };
+
+        template< typename F >
+        struct is_waitable<F, std::void_t<decltype(std::declval<F &>().add_waiter(std::declval<future_waiter *>()))>>
+                : std::true_type { };
+
+        template< typename F >
+        constexpr bool is_waitable_v = is_waitable<std::decay_t<F>>::value;
+
+        template< typename T >
+        struct shared_result { typedef const T & type; };
+
+        template< >
+        struct shared_result<void> { typedef void type; };
+
+        template< typename Future, typename F >
+        using continuation_result_t = std::invoke_result_t<std::decay_t<F>, Future>;
+
+        inline void check_state(const future_state_base *state) {
+            if (state == nullptr) {
+                throw std::future_error(std::future_errc::no_state);
+            }
+        }
+
+        template< typename Clock, typename Duration >
+        std::chrono::steady_clock::time_point to_steady(const std::chrono::time_point<Clock, Duration> &time_point) {
+            if constexpr (std::is_same_v<Clock, std::chrono::steady_clock>) {
+                return std::chrono::time_point_cast<std::chrono::steady_clock::duration>(time_point);
+            } else {
+                return std::chrono::steady_clock::now() +
+                       std::chrono::duration_cast<std::chrono::steady_clock::duration>(time_point - Clock::now());
+            }
+        }
+    }
+
+    /**
+     * @class task_future
+     * @brief Unique future of the runtime tasks.
+     *
+     * get() moves the result out and invalidates the future. Continuations added
+     * with then() run on the thread which satisfies the promise, or immediately
+     * if the future is already ready.
+     */
+    template< typename T >
+    class task_future {
+        friend class task_promise<T>;
+        friend class task_shared_future<T>;
+        friend class detail::when_state<T>;
+    public:
+        task_future() noexcept = default;
+
+        task_future(task_future &&other) noexcept : state(other.state) { other.state = nullptr; }
+
+        task_future &operator=(task_future &&other) noexcept {
+            if (this != &other) {
+                reset();
+                state = other.state;
+                other.state = nullptr;
+            }
+            return *this;
+        }
+
+        task_future(const task_future &) = delete;
+        task_future &operator=(const task_future &) = delete;
+
+        ~task_future() { reset(); }
+
+        bool valid() const noexcept { return state != nullptr; }
+
+        bool is_ready() const noexcept { return state != nullptr && state->is_ready(); }
+
+        bool has_value() const noexcept { return is_ready() && !state->get_exception(); }
+
+        bool has_exception() const noexcept { return is_ready() && state->get_exception(); }
+
+        std::exception_ptr get_exception_ptr() const {
+            wait();
+            return state->get_exception();
+        }
+
+        void wait() const {
+            detail::check_state(state);
+            state->wait();
+        }
+
+        template< typename Rep, typename Period >
+        std::future_status wait_for(const std::chrono::duration<Rep, Period> &rtime) const {
+            return wait_until(std::chrono::steady_clock::now() + rtime);
+        }
+
+        template< typename Clock, typename Duration >
+        std::future_status wait_until(const std::chrono::time_point<Clock, Duration> &time_point) const {
+            detail::check_state(state);
+            return state->wait_until(detail::to_steady(time_point)) ? std::future_status::ready
+                                                                    : std::future_status::timeout;
+        }
+
+        T get() {
+            wait();
+            auto *s = state;
+            state = nullptr;
+            struct release_guard {
+                detail::future_state<T> *s;
+                ~release_guard() { s->release(); }
+            } guard{s};
+
+            if (s->get_exception()) {
+                std::rethrow_exception(s->get_exception());
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return std::move(s->get_value());
+            }
+        }
+
+        task_shared_future<T> share() { return task_shared_future<T>(std::move(*this)); }
+
+        /**
+         * @brief attaches a continuation, the future is moved into it
+         * @param fn callable taking task_future<T>
+         * @return future of the continuation result
+         */
+        template< typename F >
+        task_future<detail::continuation_result_t<task_future<T>, F>> then(F &&fn) {
+            using R = detail::continuation_result_t<task_future<T>, F>;
+            using continuation_type = detail::future_continuation<task_future<T>, std::decay_t<F>, R>;
+
+            detail::check_state(state);
+            auto *s = state;
+            auto *continuation = continuation_type::make(std::move(*this), std::decay_t<F>(std::forward<F>(fn)));
+            auto future = continuation->get_future();
+            if (!s->add_waiter(continuation)) {
+                continuation->notify();
+            }
+            return future;
+        }
+
+        /**
+         * @brief links an external waiter, see future_waiter
+         * @return false if the future is already ready
+         */
+        bool add_waiter(future_waiter *waiter) {
+            detail::check_state(state);
+            return state->add_waiter(waiter);
+        }
+    private:
+        explicit task_future(detail::future_state<T> *s) noexcept : state(s) { }
+
+        void reset() noexcept {
+            if (state != nullptr) {
+                state->release();
+                state = nullptr;
+            }
+        }
+
+        detail::future_state<T> *state = nullptr;
+    };
+
+    /**
+     * @class task_shared_future
+     * @brief Copyable future, any number of copies can wait and read the result.
+     */
+    template< typename T >
+    class task_shared_future {
+    public:
+        task_shared_future() noexcept = default;
+
+        task_shared_future(task_future<T> &&other) noexcept : state(other.state) { other.state = nullptr; }
+
+        task_shared_future(const task_shared_future &other) noexcept : state(other.state) {
+            if (state != nullptr) {
+                state->add_ref();
+            }
+        }
+
+        task_shared_future(task_shared_future &&other) noexcept : state(other.state) { other.state = nullptr; }
+
+        task_shared_future &operator=(const task_shared_future &other) noexcept {
+            if (this != &other) {
+                if (other.state != nullptr) {
+                    other.state->add_ref();
+                }
+                reset();
+                state = other.state;
+            }
+            return *this;
+        }
+
+        task_shared_future &operator=(task_shared_future &&other) noexcept {
+            if (this != &other) {
+                reset();
+                state = other.state;
+                other.state = nullptr;
+            }
+            return *this;
+        }
+
+        ~task_shared_future() { reset(); }
+
+        bool valid() const noexcept { return state != nullptr; }
+
+        bool is_ready() const noexcept { return state != nullptr && state->is_ready(); }
+
+        bool has_value() const noexcept { return is_ready() && !state->get_exception(); }
+
+        bool has_exception() const noexcept { return is_ready() && state->get_exception(); }
+
+        std::exception_ptr get_exception_ptr() const {
+            wait();
+            return state->get_exception();
+        }
+
+        void wait() const {
+            detail::check_state(state);
+            state->wait();
+        }
+
+        template< typename Rep, typename Period >
+        std::future_status wait_for(const std::chrono::duration<Rep, Period> &rtime) const {
+            return wait_until(std::chrono::steady_clock::now() + rtime);
+        }
+
+        template< typename Clock, typename Duration >
+        std::future_status wait_until(const std::chrono::time_point<Clock, Duration> &time_point) const {
+            detail::check_state(state);
+            return state->wait_until(detail::to_steady(time_point)) ? std::future_status::ready
+                                                                    : std::future_status::timeout;
+        }
+
+        typename detail::shared_result<T>::type get() const {
+            wait();
+            if (state->get_exception()) {
+                std::rethrow_exception(state->get_exception());
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return state->get_value();
+            }
+        }
+
+        /**
+         * @brief attaches a continuation, it gets a copy of this future
+         * @param fn callable taking task_shared_future<T>
+         * @return future of the continuation result
+         */
+        template< typename F >
+        task_future<detail::continuation_result_t<task_shared_future<T>, F>> then(F &&fn) const {
+            using R = detail::continuation_result_t<task_shared_future<T>, F>;
+            using continuation_type = detail::future_continuation<task_shared_future<T>, std::decay_t<F>, R>;
+
+            detail::check_state(state);
+            auto *continuation = continuation_type::make(task_shared_future<T>(*this), std::decay_t<F>(std::forward<F>(fn)));
+            auto future = continuation->get_future();
+            if (!state->add_waiter(continuation)) {
+                continuation->notify();
+            }
+            return future;
+        }
+
+        /**
+         * @brief links an external waiter, see future_waiter
+         * @return false if the future is already ready
+         */
+        bool add_waiter(future_waiter *waiter) const {
+            detail::check_state(state);
+            return state->add_waiter(waiter);
+        }
+    private:
+        void reset() noexcept {
+            if (state != nullptr) {
+                state->release();
+                state = nullptr;
+            }
+        }
+
+        detail::future_state<T> *state = nullptr;
+    };
+
+    /**
+     * @class task_promise
+     * @brief Producer side of task_future.
+     *
+     * The shared state comes from the task pool, so a promise and its future cost no
+     * heap allocation. A promise destroyed unsatisfied after its future was retrieved
+     * resolves the future with std::future_errc::broken_promise.
+     */
+    template< typename T >
+    class task_promise {
+    public:
+        task_promise() : state(detail::future_state<T>::make()) { }
+
+        task_promise(task_promise &&other) noexcept : state(other.state), retrieved(other.retrieved) {
+            other.state = nullptr;
+            other.retrieved = false;
+        }
+
+        task_promise &operator=(task_promise &&other) noexcept {
+            if (this != &other) {
+                abandon();
+                state = other.state;
+                retrieved = other.retrieved;
+                other.state = nullptr;
+                other.retrieved = false;
+            }
+            return *this;
+        }
+
+        task_promise(const task_promise &) = delete;
+        task_promise &operator=(const task_promise &) = delete;
+
+        ~task_promise() { abandon(); }
+
+        task_future<T> get_future() {
+            detail::check_state(state);
+            if (retrieved) {
+                throw std::future_error(std::future_errc::future_already_retrieved);
+            }
+            retrieved = true;
+            state->add_ref();
+            return task_future<T>(state);
+        }
+
+        template< typename U = T, typename = std::enable_if_t<!std::is_void_v<U>>>
+        void set_value(const U &v) {
+            detail::check_state(state);
+            state->set_value(v);
+        }
+
+        template< typename U = T, typename = std::enable_if_t<!std::is_void_v<U>>>
+        void set_value(U &&v) {
+            detail::check_state(state);
+            state->set_value(std::forward<U>(v));
+        }
+
+        template< typename U = T, typename = std::enable_if_t<std::is_void_v<U>>>
+        void set_value() {
+            detail::check_state(state);
+            state->set_value();
+        }
+
+        void set_exception(std::exception_ptr e) {
+            detail::check_state(state);
+            state->set_exception(std::move(e));
+        }
+
+        template< typename E >
+        void set_exception(E e) {
+            set_exception(std::make_exception_ptr(e));
+        }
+
+        bool is_satisfied() const noexcept { return state != nullptr && state->is_satisfied(); }
+    private:
+        void abandon() noexcept {
+            if (state != nullptr) {
+                if (retrieved && !state->is_satisfied()) {
+                    try {
+                        state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+                    } catch (...) {
+                        // satisfied concurrently
+                    }
+                }
+                state->release();
+                state = nullptr;
+            }
+        }
+
+        detail::future_state<T> *state;
+        bool retrieved = false;
+    };
+}
+
+#endif //AR_FUTURE_H
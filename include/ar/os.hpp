@@ -32,6 +32,11 @@
 
 #include <string>
 
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#define AR_HAS_MM_PAUSE
+#endif
+
 #if defined(__i386__) || defined(__x86_64__)
 #define TF_CACHELINE_SIZE 64
 #elif defined(__powerpc64__)
@@ -112,11 +117,14 @@ namespace AsyncRuntime {
     }
 
 // Procedure: relax_cpu
-//inline void relax_cpu() {
-//#ifdef TF_HAS_MM_PAUSE
-//  _mm_pause();
-//#endif
-//}
+// hints the cpu that the thread is spinning, frees pipeline resources for the sibling hyperthread
+    inline void relax_cpu() {
+#ifdef AR_HAS_MM_PAUSE
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
 
 }
 
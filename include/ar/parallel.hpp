@@ -0,0 +1,385 @@
+#ifndef AR_PARALLEL_H
+#define AR_PARALLEL_H
+
+#include "ar/runtime.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// with the default grain a range is cut into at most this many chunks per cpu
+#define PARALLEL_CHUNKS_PER_CPU 16
+// parallel_sort sorts blocks of at least this many elements serially
+#define PARALLEL_SORT_MIN_BLOCK 2048
+
+namespace AsyncRuntime {
+
+    struct parallel_options {
+        /** @brief work group to run on, INVALID_OBJECT_ID - the group of the calling worker or the main group */
+        ObjectID work_group = INVALID_OBJECT_ID;
+        /** @brief min number of elements of a task, 0 - derived from the range size and the number of cpus */
+        size_t grain = 0;
+        /** @brief handler of the calling coroutine, the coroutine is suspended instead of blocking its worker */
+        CoroutineHandler *handler = nullptr;
+    };
+
+    namespace detail {
+
+        inline size_t parallel_cpus() {
+            return std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+
+        class parallel_join;
+
+        /**
+         * @brief forked task of a parallel call
+         */
+        class parallel_chunk : public task {
+        public:
+            explicit parallel_chunk(const parallel_join *join) : join(join) { }
+
+            const parallel_join *get_join() const noexcept { return join; }
+        private:
+            const parallel_join *join;
+        };
+
+        /**
+         * @class parallel_join
+         * @brief Counts the forked tasks of a parallel call, keeps the first exception.
+         */
+        class parallel_join {
+        public:
+            parallel_join() : future(promise.get_future()) { }
+
+            void fork() noexcept {
+                pending.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            void done() {
+                if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (error) {
+                        promise.set_exception(error);
+                    } else {
+                        promise.set_value();
+                    }
+                }
+            }
+
+            void fail(std::exception_ptr e) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::move(e);
+                }
+                cancelled.store(true, std::memory_order_relaxed);
+            }
+
+            bool is_cancelled() const noexcept {
+                return cancelled.load(std::memory_order_relaxed);
+            }
+
+            /**
+             * @brief a coroutine is suspended, a worker runs the chunks of this call left in its queue, then
+             * it blocks as other threads do until the stolen ones are done
+             */
+            void wait(CoroutineHandler *handler) {
+                if (handler != nullptr) {
+                    Await(std::move(future), handler);
+                    return;
+                }
+
+                if (Executor::Current() != nullptr) {
+                    auto own = [this](task *t) {
+                        auto *chunk = dynamic_cast<parallel_chunk *>(t);
+                        return chunk != nullptr && chunk->get_join() == this;
+                    };
+                    while (!future.is_ready() && Executor::RunLocal(own)) {
+                    }
+                }
+                future.get();
+            }
+        private:
+            std::atomic_size_t      pending = {1};
+            std::atomic_bool        cancelled = {false};
+            std::mutex              mutex;
+            std::exception_ptr      error;
+            task_promise<void>      promise;
+            task_future<void>       future;
+        };
+
+        /**
+         * @class parallel_range
+         * @brief Runs body(begin, end) over [0, n) with lazy binary splitting.
+         *
+         * A task takes the range chunk by chunk and splits off the upper half only when
+         * the queue of its worker is empty, i.e. when idle siblings have nothing to steal.
+         * The halves go to the worker's own queue, so a busy runtime runs the range with
+         * a few large tasks and an idle one spreads it over all workers.
+         */
+        template< class Body >
+        class parallel_range {
+            class range_task : public parallel_chunk {
+            public:
+                range_task(parallel_range *range, size_t begin, size_t end)
+                    : parallel_chunk(&range->join), range(range), begin(begin), end(end) { }
+
+                void execute(const execution_state &state) override {
+                    task::state = state;
+                    range->run(begin, end);
+                    range->join.done();
+                }
+            private:
+                parallel_range *range;
+                size_t begin;
+                size_t end;
+            };
+        public:
+            parallel_range(Body &body, size_t grain, ObjectID work_group)
+                : body(body)
+                , grain(grain)
+                , work_group(work_group) { }
+
+            void run(size_t begin, size_t end) {
+                try {
+                    while (end - begin > grain && !join.is_cancelled()) {
+                        if (should_split()) {
+                            size_t middle = begin + (end - begin) / 2;
+                            fork(middle, end);
+                            end = middle;
+                        } else {
+                            body(begin, begin + grain);
+                            begin += grain;
+                        }
+                    }
+
+                    if (!join.is_cancelled()) {
+                        body(begin, end);
+                    }
+                } catch (...) {
+                    join.fail(std::current_exception());
+                }
+            }
+
+            parallel_join join;
+        private:
+            bool is_local() const noexcept {
+                return Executor::CurrentWorkGroup() == work_group;
+            }
+
+            bool should_split() const noexcept {
+                return !is_local() || Executor::LocalQueueSize() == 0;
+            }
+
+            void fork(size_t begin, size_t end) {
+                join.fork();
+                auto *t = new range_task(this, begin, end);
+                if (is_local() && Executor::PostLocal(t)) {
+                    return;
+                }
+
+                t->set_execution_state_wg(work_group);
+                IExecutor *executor = Executor::Current();
+                if (executor == nullptr) {
+                    executor = Runtime::g_runtime->GetMainExecutor();
+                }
+                executor->Post(t);
+            }
+
+            Body        &body;
+            size_t      grain;
+            ObjectID    work_group;
+        };
+
+        /**
+         * @brief first[begin] op ... op first[end - 1], the range isn't empty
+         */
+        template< class T, class RandomIt, class BinaryOp >
+        T fold(RandomIt first, size_t begin, size_t end, BinaryOp &op) {
+            T acc = first[begin];
+            for (size_t i = begin + 1; i < end; ++i) {
+                acc = op(std::move(acc), first[i]);
+            }
+            return acc;
+        }
+
+        template< class Body >
+        void parallel_run(size_t n, Body &&body, const parallel_options &options) {
+            if (n == 0) {
+                return;
+            }
+
+            size_t grain = options.grain;
+            if (grain == 0) {
+                grain = std::max<size_t>(1, n / (PARALLEL_CHUNKS_PER_CPU * parallel_cpus()));
+            }
+
+            ObjectID work_group = options.work_group;
+            if (work_group == INVALID_OBJECT_ID) {
+                work_group = Executor::CurrentWorkGroup();
+            }
+            if (work_group == INVALID_OBJECT_ID) {
+                // the main work group
+                work_group = 0;
+            }
+
+            parallel_range<std::remove_reference_t<Body>> range(body, grain, work_group);
+            range.run(0, n);
+            range.join.done();
+            range.join.wait(options.handler);
+        }
+    }
+
+    /**
+     * @brief calls f for every element of a random access range
+     */
+    template< class RandomIt, class F, typename = std::enable_if_t<!std::is_integral_v<RandomIt>> >
+    void parallel_for(RandomIt first, RandomIt last, F f, const parallel_options &options = {}) {
+        detail::parallel_run(static_cast<size_t>(std::distance(first, last)), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                f(first[i]);
+            }
+        }, options);
+    }
+
+    /**
+     * @brief calls f for every index of [begin, end)
+     */
+    template< class Index, class F, typename = std::enable_if_t<std::is_integral_v<Index>>, typename = void >
+    void parallel_for(Index begin, Index end, F f, const parallel_options &options = {}) {
+        if (end <= begin) {
+            return;
+        }
+        detail::parallel_run(static_cast<size_t>(end - begin), [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                f(static_cast<Index>(begin + i));
+            }
+        }, options);
+    }
+
+    /**
+     * @brief writes op(x) of every element x of the range to d_first
+     * @return iterator past the last written element
+     */
+    template< class RandomIt, class OutputIt, class UnaryOp >
+    OutputIt parallel_transform(RandomIt first, RandomIt last, OutputIt d_first, UnaryOp op,
+                                const parallel_options &options = {}) {
+        const auto n = static_cast<size_t>(std::distance(first, last));
+        detail::parallel_run(n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                d_first[i] = op(first[i]);
+            }
+        }, options);
+        return d_first + n;
+    }
+
+    /**
+     * @brief reduces the range with an associative op, partial results are combined in the range order
+     */
+    template< class RandomIt, class T, class BinaryOp = std::plus<> >
+    T parallel_reduce(RandomIt first, RandomIt last, T init, BinaryOp op = {}, const parallel_options &options = {}) {
+        std::mutex mutex;
+        std::vector<std::pair<size_t, T>> partials;
+
+        detail::parallel_run(static_cast<size_t>(std::distance(first, last)), [&](size_t begin, size_t end) {
+            auto partial = std::make_pair(begin, detail::fold<T>(first, begin, end, op));
+            std::lock_guard<std::mutex> lock(mutex);
+            partials.push_back(std::move(partial));
+        }, options);
+
+        std::sort(partials.begin(), partials.end(), [](const auto &l, const auto &r) { return l.first < r.first; });
+        for (auto &partial : partials) {
+            init = op(std::move(init), std::move(partial.second));
+        }
+        return init;
+    }
+
+    /**
+     * @brief inclusive scan seeded with init: d_first[i] = init op first[0] op ... op first[i]
+     *
+     * Two passes over blocks: block sums in parallel, a serial scan of the sums,
+     * then every block is scanned from its offset in parallel. d_first can be first.
+     * @return iterator past the last written element
+     */
+    template< class RandomIt, class OutputIt, class T, class BinaryOp = std::plus<> >
+    OutputIt parallel_scan(RandomIt first, RandomIt last, OutputIt d_first, T init, BinaryOp op = {},
+                           const parallel_options &options = {}) {
+        const auto n = static_cast<size_t>(std::distance(first, last));
+        if (n == 0) {
+            return d_first;
+        }
+
+        const size_t blocks = std::min(n, PARALLEL_CHUNKS_PER_CPU * detail::parallel_cpus());
+        auto bound = [n, blocks](size_t k) { return n * k / blocks; };
+
+        parallel_options block_options = options;
+        block_options.grain = 1;
+
+        std::vector<T> offsets(blocks, init);
+        detail::parallel_run(blocks, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                if (k + 1 == blocks) {
+                    // the last block sum isn't needed
+                    continue;
+                }
+                offsets[k + 1] = detail::fold<T>(first, bound(k), bound(k + 1), op);
+            }
+        }, block_options);
+
+        for (size_t k = 1; k < blocks; ++k) {
+            offsets[k] = op(offsets[k - 1], std::move(offsets[k]));
+        }
+
+        detail::parallel_run(blocks, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                T acc = offsets[k];
+                for (size_t i = bound(k); i < bound(k + 1); ++i) {
+                    acc = op(std::move(acc), first[i]);
+                    d_first[i] = acc;
+                }
+            }
+        }, block_options);
+
+        return d_first + n;
+    }
+
+    /**
+     * @brief sorts the range: blocks are sorted in parallel, then merged pairwise in parallel rounds
+     */
+    template< class RandomIt, class Compare = std::less<> >
+    void parallel_sort(RandomIt first, RandomIt last, Compare comp = {}, const parallel_options &options = {}) {
+        const auto n = static_cast<size_t>(std::distance(first, last));
+        size_t blocks = 1;
+        while (blocks < 4 * detail::parallel_cpus() && n / (blocks * 2) >= PARALLEL_SORT_MIN_BLOCK) {
+            blocks *= 2;
+        }
+
+        if (blocks == 1) {
+            std::sort(first, last, comp);
+            return;
+        }
+
+        auto bound = [first, n, blocks](size_t k) { return first + n * k / blocks; };
+
+        parallel_options block_options = options;
+        block_options.grain = 1;
+
+        detail::parallel_run(blocks, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                std::sort(bound(k), bound(k + 1), comp);
+            }
+        }, block_options);
+
+        for (size_t width = 1; width < blocks; width *= 2) {
+            detail::parallel_run(blocks / (2 * width), [&](size_t begin, size_t end) {
+                for (size_t p = begin; p < end; ++p) {
+                    std::inplace_merge(bound(2 * p * width), bound((2 * p + 1) * width), bound((2 * p + 2) * width), comp);
+                }
+            }, block_options);
+        }
+    }
+}
+
+#endif //AR_PARALLEL_H
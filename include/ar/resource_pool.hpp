@@ -1,17 +1,77 @@
 #ifndef AR_RESOURCE_POOL_H
 #define AR_RESOURCE_POOL_H
 
+#include <atomic>
+#include <cstdint>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 #include <boost/pool/pool.hpp>
 
+#define MAX_NUMA_POOLS 64
+
 namespace AsyncRuntime {
 
+    namespace Mon {
+        class Counter;
+        class IMetricer;
+    }
+
     struct default_allocation_tag { };
 
+    /**
+     * @brief boost pool allocator of blocks bound to the numa node of the pool that grows
+     */
+    struct numa_user_allocator {
+        typedef std::size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+
+        static char *malloc(size_type bytes);
+
+        static void free(char *block);
+    };
+
+    namespace detail {
+        struct pool_central;
+        struct pool_thread_cache;
+    }
+
+    /**
+     * @class resource_pool
+     * @brief Pool of size classes in units of the chunk size.
+     *
+     * An allocation is rounded up to its size class: 1 to 4 chunks, then 4 classes per power of two,
+     * every class has its own free list. Allocations go through a cache of the calling thread, which
+     * takes objects from the shared free lists and gives them back in batches; an object may be freed
+     * by any thread. Allocations over 256 chunks are taken from the system one by one.
+     */
     class resource_pool {
     public:
-        resource_pool(size_t chunk_sz = 128, size_t nnext_size = 1024, size_t nmax_size = 0);
+        struct memory_stats {
+            // bytes of the blocks of the classes and of the large objects
+            size_t      reserved = 0;
+            // bytes asked for by the live allocations
+            size_t      requested = 0;
+            // share of the reserved bytes not asked for: rounding to classes and free objects
+            double      fragmentation = 0;
+        };
+
+        struct cache_stats {
+            // allocations and frees served by thread caches
+            size_t      hits = 0;
+            // batches taken from and given back to the shared pool
+            size_t      refills = 0;
+            size_t      flushes = 0;
+            // chunks held by thread caches
+            size_t      cached = 0;
+        };
+
+        /**
+         * @param numa_node node the memory of the pool is bound to, -1 for any
+         */
+        resource_pool(size_t chunk_sz = 128, size_t nnext_size = 1024, size_t nmax_size = 0, int numa_node = -1);
         ~resource_pool();
 
         resource_pool(const resource_pool & other) = delete;
@@ -22,14 +82,59 @@ namespace AsyncRuntime {
 
         void *allocate(size_t size);
 
+        /**
+         * @param size size given to allocate
+         */
         void deallocate(void *ptr, size_t size);
 
+        /**
+         * @brief frees an allocation of one chunk
+         */
         void deallocate(void *ptr);
+
+        int get_numa_node() const { return numa_node.load(std::memory_order_relaxed); }
+
+        void set_numa_node(int node) { numa_node.store(node, std::memory_order_relaxed); }
+
+        /**
+         * @brief allocations of the pool, and those made by workers of an other numa node
+         */
+        size_t get_allocations_count() const;
+
+        size_t get_remote_allocations_count() const;
+
+        /**
+         * @brief statistics of the cache of the calling thread
+         */
+        cache_stats get_thread_cache_stats() const;
+
+        /**
+         * @brief statistics of the caches of all threads, exited ones included but their cached chunks
+         */
+        cache_stats get_cache_stats() const;
+
+        memory_stats get_memory_stats() const;
+
+        void make_metrics(const std::shared_ptr<Mon::IMetricer> &metricer, const std::map<std::string, std::string> &labels);
     private:
+        detail::pool_thread_cache *local_cache() const;
+
+        void refill(detail::pool_thread_cache &cache, size_t size_class);
+
+        void flush(detail::pool_thread_cache &cache, size_t size_class);
+
+        void report(detail::pool_thread_cache &cache);
+
+        /**
+         * @brief accounts an allocation, or a free for a negative size, out of thread caches
+         */
+        void account_shared(int node, int64_t size);
 
-        std::mutex mutex;
         size_t chunk_size;
-        boost::pool<> pool;
+        std::shared_ptr<detail::pool_central> central;
+        std::atomic_int numa_node;
+        std::shared_ptr<Mon::Counter> m_allocations_count;
+        std::shared_ptr<Mon::Counter> m_remote_allocations_count;
     };
 
     void DeleteResource(resource_pool *pool);
@@ -52,7 +157,27 @@ namespace AsyncRuntime {
 
         void delete_resource(resource_pool *pool);
 
-        resource_pool *get_default_resource() { return default_pool; }
+        /**
+         * @brief the default pool of a numa node
+         * @param index index of the cpu executor of the node, -1 for the pool of threads out of executors
+         */
+        resource_pool *get_default_resource(int index = -1) {
+            if (index >= 0 && index < MAX_NUMA_POOLS) {
+                auto *pool = node_pools[index].load(std::memory_order_acquire);
+                if (pool != nullptr) {
+                    return pool;
+                }
+            }
+            return default_pool;
+        }
+
+        /**
+         * @brief default pools of the cpu executors, bound to their numa nodes
+         * @param numa_nodes numa node of an executor by its index
+         */
+        void create_node_resources(const std::vector<int> &numa_nodes);
+
+        void make_metrics(const std::shared_ptr<Mon::IMetricer> &metricer);
 
     private:
         void create_default_resource(size_t chunk_sz = 128, size_t nnext_size = 1024, size_t nmax_size = 0);
@@ -60,6 +185,8 @@ namespace AsyncRuntime {
         std::mutex mutex;
         std::vector<resource_pool *> pools;
         resource_pool *default_pool = nullptr;
+        // kept until the manager is deleted, memory taken from them can outlive the executors
+        std::atomic<resource_pool *> node_pools[MAX_NUMA_POOLS] = {};
     };
 }
 
@@ -6,19 +6,42 @@
 #include "ar/metricer.hpp"
 #include "ar/resource_pool.hpp"
 
+#include <iterator>
+
 namespace AsyncRuntime {
     class Ticker;
 
+    namespace detail {
+        class ticker_clock;
+    }
+
     struct RuntimeOptions {
         std::vector<WorkGroupOption> work_groups_option = {};
         int virtual_numa_nodes_count = 0; //for debug
+        size_t warm_stacks = 0; //coroutine stacks of the default size pre-faulted per numa node
     };
 
+    /**
+     * @brief task of a batch element: a copy of the callable or the resume of the coroutine
+     */
+    template<class Callable>
+    inline auto make_batch_task(const Callable &f) {
+        return make_task(Callable(f));
+    }
+
+    template<typename Ret>
+    inline coroutine_task<Ret> *make_batch_task(const std::shared_ptr<coroutine<Ret>> &coroutine) {
+        coroutine->init_promise();
+        return (coroutine_task<Ret> *)coroutine->resume_task();
+    }
+
     class Runtime {
         friend class Processor;
 
         friend class Ticker;
 
+        friend class detail::ticker_clock;
+
         friend class Scheduler;
 
         friend class coroutine_handler;
@@ -48,8 +71,16 @@ namespace AsyncRuntime {
 
         void DeleteResource(resource_pool *pool);
 
+        /**
+         * @brief the default pool of the numa node whose executor runs untagged work of the calling thread
+         */
         resource_pool *GetDefaultResource();
 
+        /**
+         * @brief numa node whose executor runs untagged work of the calling thread, -1 on a single node
+         */
+        int GetLocalNumaNode() const;
+
         void Setup(const RuntimeOptions &options = {});
 
         void Setup(Runtime *other);
@@ -60,14 +91,39 @@ namespace AsyncRuntime {
                 class... Arguments>
         auto Async(Callable &&f, Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))>;
 
+        template<class Callable,
+                class... Arguments>
+        auto Async(TaskPriority priority, Callable &&f, Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))>;
+
         template< typename Ret >
         future_t<Ret> Async(const std::shared_ptr<coroutine<Ret>> & coroutine);
 
+        template<class Callable,
+                class... Arguments>
+        auto Async(const CancellationToken &token, Callable &&f, Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))>;
+
         template<class Callable,
                 class... Arguments>
         auto AsyncDelayed(Callable &&f, Timespan delay_ms,
                           Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))>;
 
+        template<class Callable,
+                class... Arguments>
+        auto AsyncDelayed(const CancellationToken &token, Callable &&f, Timespan delay_ms,
+                          Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))>;
+
+        template<class Callable,
+                class... Arguments>
+        auto AsyncDelayed(TaskPriority priority, Callable &&f, Timespan delay_ms,
+                          Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))>;
+
+        /**
+         * @brief posts a range of callables or coroutines with one routing and one wakeup of the workers
+         * @return futures in the order of the range
+         */
+        template<class Iterator>
+        auto AsyncBatch(Iterator first, Iterator last) -> std::vector<decltype(make_batch_task(*first)->get_future())>;
+
         template<typename ExecutorType,
                 typename TaskType,
                 class... Arguments>
@@ -80,6 +136,9 @@ namespace AsyncRuntime {
         template<typename Rep, typename Period>
         future_t<void> AsyncSleep(const std::chrono::duration<Rep, Period> &rtime);
 
+        template<typename Rep, typename Period>
+        future_t<void> AsyncSleep(const std::chrono::duration<Rep, Period> &rtime, const CancellationToken &token);
+
         template<class Ret>
         Ret Await(future_t<Ret> && future);
 
@@ -92,6 +151,12 @@ namespace AsyncRuntime {
         template<class Ret>
         Ret Await(shared_future_t<Ret> && future, CoroutineHandler *handler);
 
+        /**
+         * @brief await which throws OperationCancelled in the coroutine as soon as the token is cancelled
+         */
+        template<class Ret>
+        Ret Await(future_t<Ret> && future, CoroutineHandler *handler, const CancellationToken &token);
+
         [[nodiscard]] const IExecutor *GetMainExecutor() const { return main_executor; }
 
         IExecutor *GetMainExecutor() { return main_executor; }
@@ -124,22 +189,41 @@ namespace AsyncRuntime {
     protected:
         std::shared_ptr<Mon::Counter> coroutine_counter;
     private:
+        class CoroutineWaiter;
+
+        class CancellableWaiter;
+
         void SetupWorkGroups(const std::vector<WorkGroupOption> &work_groups_option);
 
         void CheckRuntime();
 
         void Post(task *t);
 
+        void PostBatch(task **tasks, size_t n);
+
         void CreateDefaultExecutors(int virtual_numa_nodes_count = 0);
 
+        /**
+         * @brief pre-faulted coroutine stacks for the numa nodes of the cpu executors
+         */
+        void ReserveStacks(size_t count);
+
         void CreateMetrics();
 
-        IExecutor *FetchExecutor(ExecutorType type, const EntityTag &tag);
+        IExecutor *FetchExecutor(const EntityTag &tag) const;
+
+        IExecutor *FetchFreeExecutor() const;
 
-        IExecutor *FetchFreeExecutor(ExecutorType type);
+        const Executor *GetLocalExecutor() const;
+
+        void UpdateFreeExecutor();
 
         std::vector<WorkGroupOption> work_groups_option;
         std::map<size_t, IExecutor *> executors;
+        // cpu executors by numa node, the index is the executor id packed into entity tags
+        std::vector<Executor *> cpu_executors;
+        // cpu executor with the least entities, target of untagged posts from non worker threads
+        std::atomic<Executor *> free_executor = {nullptr};
         IExecutor *main_executor;
         IExecutor *io_executor;
         bool is_setup;
@@ -152,8 +236,43 @@ namespace AsyncRuntime {
     -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
         CheckRuntime();
         auto task = make_task(std::bind(std::forward<Callable>(f), std::forward<Arguments>(args)...));
+        auto future = task->get_future();
+        Post(task);
+        return future;
+    }
+
+    template<class Callable, class... Arguments>
+    auto Runtime::Async(TaskPriority priority, Callable &&f, Arguments &&... args)
+    -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        CheckRuntime();
+        auto task = make_task(std::bind(std::forward<Callable>(f), std::forward<Arguments>(args)...));
+        task->set_execution_state_priority(priority);
+        auto future = task->get_future();
         Post(task);
-        return task->get_future();
+        return future;
+    }
+
+    template<class Callable, class... Arguments>
+    auto Runtime::Async(const CancellationToken &token, Callable &&f, Arguments &&... args)
+    -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        CheckRuntime();
+        auto task = make_task(std::bind(std::forward<Callable>(f), std::forward<Arguments>(args)...));
+        task->set_cancellation(token);
+        auto future = task->get_future();
+        Post(task);
+        return future;
+    }
+
+    template<class Callable, class... Arguments>
+    auto Runtime::AsyncDelayed(const CancellationToken &token, Callable &&f, Timespan delay_ms, Arguments &&... args)
+    -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        CheckRuntime();
+        auto task = make_task(std::bind(std::forward<Callable>(f), std::forward<Arguments>(args)...));
+        task->template set_delay<Timestamp::Milli>(delay_ms);
+        task->set_cancellation(token);
+        auto future = task->get_future();
+        Post(task);
+        return future;
     }
 
     template<class Callable, class... Arguments>
@@ -162,8 +281,21 @@ namespace AsyncRuntime {
         CheckRuntime();
         auto task = make_task(std::bind(std::forward<Callable>(f), std::forward<Arguments>(args)...));
         task->template set_delay<Timestamp::Milli>(delay_ms);
+        auto future = task->get_future();
         Post(task);
-        return task->get_future();
+        return future;
+    }
+
+    template<class Callable, class... Arguments>
+    auto Runtime::AsyncDelayed(TaskPriority priority, Callable &&f, Timespan delay_ms, Arguments &&... args)
+    -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        CheckRuntime();
+        auto task = make_task(std::bind(std::forward<Callable>(f), std::forward<Arguments>(args)...));
+        task->template set_delay<Timestamp::Milli>(delay_ms);
+        task->set_execution_state_priority(priority);
+        auto future = task->get_future();
+        Post(task);
+        return future;
     }
 
     template< typename Ret >
@@ -176,13 +308,47 @@ namespace AsyncRuntime {
         return std::move(future);
     }
 
+    template<class Iterator>
+    auto Runtime::AsyncBatch(Iterator first, Iterator last)
+    -> std::vector<decltype(make_batch_task(*first)->get_future())> {
+        CheckRuntime();
+        std::vector<decltype(make_batch_task(*first)->get_future())> futures;
+        std::vector<task *> tasks;
+        if constexpr (std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>) {
+            const auto n = static_cast<size_t>(std::distance(first, last));
+            futures.reserve(n);
+            tasks.reserve(n);
+        }
+
+        for (; first != last; ++first) {
+            auto *task = make_batch_task(*first);
+            futures.push_back(task->get_future());
+            tasks.push_back(task);
+        }
+
+        PostBatch(tasks.data(), tasks.size());
+        return futures;
+    }
+
     template<typename Rep, typename Period>
     future_t<void> Runtime::AsyncSleep(const std::chrono::duration<Rep, Period> &rtime) {
         CheckRuntime();
         auto task = make_dummy_task();
         task->set_delay<std::chrono::duration<Rep, Period> >(rtime.count());
+        auto future = task->get_future();
         Post(task);
-        return task->get_future();
+        return future;
+    }
+
+    template<typename Rep, typename Period>
+    future_t<void> Runtime::AsyncSleep(const std::chrono::duration<Rep, Period> &rtime, const CancellationToken &token) {
+        CheckRuntime();
+        auto task = make_dummy_task();
+        task->set_delay<std::chrono::duration<Rep, Period> >(rtime.count());
+        task->set_cancellation(token);
+        auto future = task->get_future();
+        Post(task);
+        return future;
     }
 
     template<typename ExecutorType, typename TaskType, class... Arguments>
@@ -191,8 +357,9 @@ namespace AsyncRuntime {
         CheckRuntime();
         auto task = new TaskType(std::forward<Arguments>(args)...);
         const std::type_info &eti = typeid(ExecutorType);
+        auto future = task->get_future();
         ((ExecutorType *) executors.at(eti.hash_code()))->Post(task);
-        return task->get_future();
+        return future;
     }
 
     template<typename ExecutorType, typename TaskType>
@@ -217,38 +384,131 @@ namespace AsyncRuntime {
         return future.get();
     }
 
+    /**
+     * @brief resumes a coroutine suspended on a future, lives on the coroutine stack
+     */
+    class Runtime::CoroutineWaiter final : public future_waiter {
+    public:
+        explicit CoroutineWaiter(coroutine_handler *handler) : handler(handler) { }
+
+        void notify() noexcept override {
+            Runtime::g_runtime->Post(handler->resume_task());
+        }
+    private:
+        coroutine_handler *handler;
+    };
+
     template< class Ret >
     Ret Runtime::Await(future_t<Ret> && future, coroutine_handler *handler) {
-        if (!future.has_value() && !future.has_exception()) {
-            future_t<Ret> done_future;
-            handler->suspend_with([&future, &done_future](coroutine_handler *handler) {
-                done_future = future.then(boost::launch::sync, [handler](future_t<Ret> f) {
-                    auto task = handler->resume_task();
-                    Runtime::g_runtime->Post(task);
-                    return f.get();
-                });
+        if (!future.is_ready()) {
+            CoroutineWaiter waiter(handler);
+            handler->suspend_with([&future, &waiter](coroutine_handler *) {
+                if (!future.add_waiter(&waiter)) {
+                    waiter.notify();
+                }
             });
-            return done_future.get();
-        } else {
-            return future.get();
         }
+        return future.get();
     }
 
     template< class Ret >
     Ret Runtime::Await(shared_future_t<Ret> && future, coroutine_handler *handler) {
-        if (!future.has_value() && !future.has_exception()) {
-            future_t<Ret> done_future;
-            handler->suspend_with([&future, &done_future](coroutine_handler *handler) {
-                done_future = future.then(boost::launch::sync, [handler](shared_future_t<Ret> f) {
-                    auto task = handler->resume_task();
-                    Runtime::g_runtime->Post(task);
-                    return f.get();
-                });
+        if (!future.is_ready()) {
+            CoroutineWaiter waiter(handler);
+            handler->suspend_with([&future, &waiter](coroutine_handler *) {
+                if (!future.add_waiter(&waiter)) {
+                    waiter.notify();
+                }
+            });
+        }
+        return future.get();
+    }
+
+    /**
+     * @class Runtime::CancellableWaiter
+     * @brief Waits for a future and a token at once, whichever comes first resumes the coroutine.
+     *
+     * Lives on the heap: the future and the token may call it after the coroutine has gone on.
+     * The resume goes out once the waiter has fired and is registered with both, so the coroutine
+     * never unregisters it from the token before it's registered.
+     */
+    class Runtime::CancellableWaiter final : public future_waiter, public cancellation_callback {
+    public:
+        explicit CancellableWaiter(coroutine_handler *handler) : handler(handler) { }
+
+        static void *operator new(std::size_t size) { return task_pool::allocate(size); }
+
+        static void operator delete(void *ptr, std::size_t size) noexcept { task_pool::deallocate(ptr, size); }
+
+        void notify() noexcept override {
+            resume(false);
+            release();
+        }
+
+        void on_cancel() noexcept override {
+            resume(true);
+            release();
+        }
+
+        void release() noexcept {
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+
+        bool is_cancelled() const noexcept { return cancelled; }
+
+        /**
+         * @brief called once the waiter is registered with the future and the token
+         */
+        void arm() noexcept {
+            if (arms.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                Runtime::g_runtime->Post(handler->resume_task());
+            }
+        }
+    private:
+        void resume(bool by_cancel) noexcept {
+            if (!fired.exchange(true, std::memory_order_acq_rel)) {
+                cancelled = by_cancel;
+                arm();
+            }
+        }
+
+        coroutine_handler   *handler;
+        // the coroutine, the future and the token
+        std::atomic_uint    refs = {3};
+        // the firing and the registrations
+        std::atomic_uint    arms = {2};
+        std::atomic_bool    fired = {false};
+        bool                cancelled = false;
+    };
+
+    template< class Ret >
+    Ret Runtime::Await(future_t<Ret> && future, coroutine_handler *handler, const CancellationToken &token) {
+        token.ThrowIfCancelled();
+        if (!future.is_ready()) {
+            auto *waiter = new CancellableWaiter(handler);
+            auto *cancellation = token.GetState();
+            handler->suspend_with([&future, waiter, cancellation](coroutine_handler *) {
+                if (!future.add_waiter(waiter)) {
+                    waiter->notify();
+                }
+                if (!cancellation->add_callback(waiter)) {
+                    waiter->on_cancel();
+                }
+                waiter->arm();
             });
-            return done_future.get();
-        } else {
-            return future.get();
+
+            const bool cancelled = waiter->is_cancelled();
+            if (cancellation->remove_callback(waiter)) {
+                waiter->release();
+            }
+            waiter->release();
+            if (cancelled) {
+                throw OperationCancelled();
+            }
         }
+        return future.get();
     }
 
     template<typename ExecutorType,
@@ -319,6 +579,62 @@ namespace AsyncRuntime {
     }
 
 
+    /**
+     * @brief async call, the task doesn't run if the token is cancelled before it starts
+     * @tparam Callable
+     * @param token cancellation token, the future is resolved with OperationCancelled then
+     */
+    template<class Callable,
+            class... Arguments>
+    inline auto Async(const CancellationToken &token, Callable &&f, Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        return Runtime::g_runtime->Async(token, std::forward<Callable>(f), std::forward<Arguments>(args)...);
+    }
+
+    /**
+     * @brief async call with priority
+     * @tparam Callable
+     * @param priority priority of the task in the worker queue
+     */
+    template<class Callable,
+            class... Arguments>
+    inline auto Async(TaskPriority priority, Callable &&f, Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        return Runtime::g_runtime->Async(priority, std::forward<Callable>(f), std::forward<Arguments>(args)...);
+    }
+
+    /**
+     * @brief delayed async call
+     * @tparam Callable
+     * @param delay_ms delay in milliseconds
+     */
+    template<class Callable,
+            class... Arguments>
+    inline auto AsyncDelayed(Callable &&f, Timespan delay_ms, Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        return Runtime::g_runtime->AsyncDelayed(std::forward<Callable>(f), delay_ms, std::forward<Arguments>(args)...);
+    }
+
+    /**
+     * @brief cancellable delayed async call, a cancel removes the task from the scheduler at once
+     * @tparam Callable
+     * @param delay_ms delay in milliseconds
+     */
+    template<class Callable,
+            class... Arguments>
+    inline auto AsyncDelayed(const CancellationToken &token, Callable &&f, Timespan delay_ms, Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        return Runtime::g_runtime->AsyncDelayed(token, std::forward<Callable>(f), delay_ms, std::forward<Arguments>(args)...);
+    }
+
+    /**
+     * @brief delayed async call with priority
+     * @tparam Callable
+     * @param priority priority of the task in the worker queue
+     * @param delay_ms delay in milliseconds
+     */
+    template<class Callable,
+            class... Arguments>
+    inline auto AsyncDelayed(TaskPriority priority, Callable &&f, Timespan delay_ms, Arguments &&... args) -> future_t<decltype(std::forward<Callable>(f)(std::forward<Arguments>(args)...))> {
+        return Runtime::g_runtime->AsyncDelayed(priority, std::forward<Callable>(f), delay_ms, std::forward<Arguments>(args)...);
+    }
+
     /**
      * @brief async call
      * @tparam CoroutineType
@@ -328,6 +644,16 @@ namespace AsyncRuntime {
         return Runtime::g_runtime->Async(coroutine);
     }
 
+    /**
+     * @brief async call of every callable or coroutine of the range, posted as one batch
+     * @tparam Iterator
+     * @return futures in the order of the range
+     */
+    template<class Iterator>
+    inline auto AsyncBatch(Iterator first, Iterator last) {
+        return Runtime::g_runtime->AsyncBatch(first, last);
+    }
+
     /**
      * @brief await
      * @tparam Ret
@@ -375,6 +701,59 @@ namespace AsyncRuntime {
         return Runtime::g_runtime->Await<Ret>(std::forward<shared_future_t<Ret>>(future), handler);
     }
 
+    /**
+     * @brief await aborted by the token: OperationCancelled is thrown in the coroutine, the future is dropped
+     */
+    template<class Ret>
+    inline Ret Await(future_t<Ret> && future, CoroutineHandler *handler, const CancellationToken &token) {
+        return Runtime::g_runtime->Await<Ret>(std::forward<future_t<Ret>>(future), handler, token);
+    }
+
+
+    /**
+     * @brief future ready when all futures are ready, Await it to resume a coroutine once for all of them
+     * @param futures futures of any result types, they stay valid and are read after the wait
+     */
+    template<class... Futures, typename = std::enable_if_t<(detail::is_waitable_v<Futures> && ...)>>
+    inline future_t<void> WhenAll(Futures &... futures) {
+        auto *state = detail::when_state<void>::make(sizeof...(Futures));
+        (state->link(futures), ...);
+        return state->get_future();
+    }
+
+    /**
+     * @brief future ready when all futures of the range are ready
+     */
+    template<class Iterator, typename = std::enable_if_t<!detail::is_waitable_v<Iterator>>>
+    inline future_t<void> WhenAll(Iterator first, Iterator last) {
+        auto *state = detail::when_state<void>::make(static_cast<size_t>(std::distance(first, last)));
+        for (; first != last; ++first) {
+            state->link(*first);
+        }
+        return state->get_future();
+    }
+
+    /**
+     * @brief future of the index of the first ready future, SIZE_MAX if there are none
+     */
+    template<class... Futures, typename = std::enable_if_t<(detail::is_waitable_v<Futures> && ...)>>
+    inline future_t<size_t> WhenAny(Futures &... futures) {
+        auto *state = detail::when_state<size_t>::make(sizeof...(Futures));
+        (state->link(futures), ...);
+        return state->get_future();
+    }
+
+    /**
+     * @brief future of the index of the first ready future of the range, SIZE_MAX if it's empty
+     */
+    template<class Iterator, typename = std::enable_if_t<!detail::is_waitable_v<Iterator>>>
+    inline future_t<size_t> WhenAny(Iterator first, Iterator last) {
+        auto *state = detail::when_state<size_t>::make(static_cast<size_t>(std::distance(first, last)));
+        for (; first != last; ++first) {
+            state->link(*first);
+        }
+        return state->get_future();
+    }
 
 /**
      * @brief
@@ -398,6 +777,14 @@ namespace AsyncRuntime {
         return Runtime::g_runtime->AsyncSleep<Rep, Period>(rtime);
     }
 
+    /**
+     * @brief cancellable async sleep, the future is resolved with OperationCancelled on cancel
+     */
+    template<typename Rep, typename Period>
+    inline future_t<void> AsyncSleep(const std::chrono::duration<Rep, Period> &rtime, const CancellationToken &token) {
+        return Runtime::g_runtime->AsyncSleep<Rep, Period>(rtime, token);
+    }
+
     /**
      * @brief
      * @return
@@ -405,6 +792,10 @@ namespace AsyncRuntime {
     inline resource_pool * GetDefaultResource() {
         return Runtime::g_runtime->GetDefaultResource();
     }
+
+    inline int GetLocalNumaNode() {
+        return (Runtime::g_runtime != nullptr) ? Runtime::g_runtime->GetLocalNumaNode() : -1;
+    }
 }
 
 
@@ -2,30 +2,114 @@
 #define AR_WORK_SCHEDULER_H
 
 #include "ar/task.hpp"
-#include "ar/thread_executor.hpp"
+#include "ar/timestamp.hpp"
 
-#include <queue>
-#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+// default tick of the timing wheel, us
+#define SCHEDULER_TICK_US 100
+// slots of a wheel level are bits of one word
+#define SCHEDULER_SLOT_BITS 6
+#define SCHEDULER_LEVELS 6
 
 namespace AsyncRuntime {
 
+    /**
+     * @class Scheduler
+     * @brief Hierarchical timing wheel of delayed tasks, it has no thread of its own.
+     *
+     * A level has 64 slots of 64^level ticks, a timer is linked to the level of the highest tick digit
+     * where it differs from the current tick, so a post and a cancel are O(1). Slots of upper levels are
+     * cascaded down when the current tick comes to them. Timers beyond the top level wait at its end
+     * and are linked again from there.
+     * The owner expires due timers with Advance(): workers do it between tasks and before parking,
+     * one parked worker keeps the next deadline and parks until it (see Keep()).
+     */
     class Scheduler {
-        typedef std::priority_queue<task *, std::vector < task * >, task::less_than_by_delay_ptr>
-        TasksPq;
     public:
-        explicit Scheduler(const std::function<void(task *)> &task_callback);
+        /**
+         * @param task_callback gets the tasks whose delay has expired
+         * @param wakeup_callback called when a post makes the next deadline earlier than the kept one
+         * @param tick_us resolution of the wheel, tasks expire at most a tick late
+         */
+        explicit Scheduler(const std::function<void(task *)> &task_callback,
+                           const std::function<void()> &wakeup_callback = nullptr,
+                           Timespan tick_us = SCHEDULER_TICK_US);
         ~Scheduler();
 
+        /**
+         * @brief the task is passed to the callback when its delay expires, if the token of the task
+         * is cancelled before, it's removed at once and its future is resolved with OperationCancelled
+         */
         void Post(task *task);
+
+        /**
+         * @brief passes the tasks due by now to the callback on the calling thread
+         * @return number of expired tasks
+         */
+        size_t Advance(Timespan now = TIMESTAMP_NOW_MICRO());
+
+        /**
+         * @brief time of the next event of the wheel (an expiry or a cascade), INT64_MAX if it's empty
+         */
+        Timespan GetNextDeadline() const { return next_deadline.load(std::memory_order_acquire); }
+
+        /**
+         * @brief a parking thread becomes the keeper of the deadline if it's earlier than the kept one,
+         * only the keeper parks with a timeout
+         */
+        bool Keep(Timespan deadline);
+
+        /**
+         * @brief the keeper is woken up
+         */
+        void Unkeep(Timespan deadline);
+
+        /**
+         * @brief number of delayed tasks waiting for their time
+         */
+        size_t GetPendingCount();
+
+        /**
+         * @brief number of times a thread was woken up for timers
+         */
+        size_t GetWakeupsCount() const { return wakeups_count.load(std::memory_order_relaxed); }
+
+        Timespan GetTick() const { return tick_us; }
     private:
-        void SchedulerLoop();
+        class Timer;
+
+        static constexpr uint64_t kSlots = uint64_t(1) << SCHEDULER_SLOT_BITS;
+        static constexpr uint64_t kSlotMask = kSlots - 1;
+
+        void Cancel(Timer *timer);
+
+        void Link(Timer *timer);
+
+        void Unlink(Timer *timer);
+
+        void Cascade(unsigned level, Timer *&expired);
+
+        uint64_t NextEvent() const;
+
+        void UpdateDeadline();
 
         std::function<void(task *)> task_callback;
-        ThreadExecutor scheduler_th;
-        std::atomic_bool is_continue;
-        TasksPq delayed_task;
-        std::condition_variable delayed_task_cv;
-        std::mutex delayed_task_mutex;
+        std::function<void()>       wakeup_callback;
+        const Timespan              tick_us;
+        std::atomic<Timespan>       next_deadline = {INT64_MAX};
+        std::atomic<Timespan>       keeper_deadline = {INT64_MAX};
+        std::atomic_size_t          wakeups_count = {0};
+
+        std::mutex                  mutex;
+        uint64_t                    current;
+        size_t                      pending = 0;
+        Timer                       *wheel[SCHEDULER_LEVELS][kSlots] = {};
+        // non empty slots of a level
+        uint64_t                    occupied[SCHEDULER_LEVELS] = {};
     };
 }
 #endif //AR_WORK_SCHEDULER_H
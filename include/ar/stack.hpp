@@ -1,6 +1,8 @@
 #ifndef AR_STACK_H
 #define AR_STACK_H
 
+#include "ar/cpu_helper.hpp"
+
 #include <boost/context/continuation.hpp>
 
 #include <cstdlib>
@@ -12,12 +14,17 @@ namespace AsyncRuntime {
     class basic_fixedsize_stack {
     private:
         std::size_t     size_;
+        int             numa_node_;
 
     public:
         typedef traitsT traits_type;
 
-        basic_fixedsize_stack( std::size_t size = traits_type::default_size() ) BOOST_NOEXCEPT_OR_NOTHROW :
-                size_( size) {
+        /**
+         * @param numa_node node to bind the stack to, -1 for any
+         */
+        basic_fixedsize_stack( std::size_t size = traits_type::default_size(), int numa_node = -1 ) BOOST_NOEXCEPT_OR_NOTHROW :
+                size_( size),
+                numa_node_( numa_node) {
                 }
 
         ctx::stack_context allocate() {
@@ -27,7 +34,7 @@ namespace AsyncRuntime {
             throw std::bad_alloc();
         }
 #else
-            void * vp = std::malloc( size_);
+            void * vp = NumaAlloc( size_, numa_node_);
             if ( ! vp) {
                 throw std::bad_alloc();
             }
@@ -51,7 +58,7 @@ namespace AsyncRuntime {
 #if defined(BOOST_CONTEXT_USE_MAP_STACK)
             ::munmap( vp, sctx.size);
 #else
-            std::free( vp);
+            NumaFree( vp);
 #endif
         }
     };
@@ -0,0 +1,149 @@
+#ifndef AR_STACK_CACHE_H
+#define AR_STACK_CACHE_H
+
+#include "ar/metricer.hpp"
+
+#include <boost/assert.hpp>
+#include <boost/context/stack_context.hpp>
+#include <boost/context/stack_traits.hpp>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace AsyncRuntime {
+    namespace ctx = boost::context;
+
+    namespace detail {
+        struct stack_thread_cache;
+    }
+
+    /**
+     * @brief stack of a coroutine
+     */
+    struct stack_options {
+        // usable bytes, rounded up to whole pages
+        std::size_t     size = ctx::stack_traits::default_size();
+    };
+
+    /**
+     * @class stack_cache
+     * @brief Coroutine stacks mapped with a guard page below them, recycled instead of unmapped.
+     *
+     * A write past the end of a stack faults on its guard page instead of overwriting memory.
+     * Freed stacks stay in a cache of the freeing thread, those it can't hold go to a shared list
+     * per size and numa node, the rest are unmapped. The shared lists can be filled with pre-faulted
+     * stacks ahead of time, as the runtime does at setup with RuntimeOptions::warm_stacks.
+     */
+    class stack_cache {
+    public:
+        struct stats {
+            // allocations served by the caches and by new mappings
+            size_t      hits = 0;
+            size_t      misses = 0;
+            double      hit_rate = 0;
+            // bytes of the mapped stacks, live and cached, guard pages excluded
+            size_t      resident = 0;
+            // stacks held by thread caches and shared lists
+            size_t      cached = 0;
+        };
+
+        /**
+         * @brief the cache of the process, it is never deleted: threads give their stacks back on exit
+         */
+        static stack_cache &instance();
+
+        stack_cache(const stack_cache & other) = delete;
+        stack_cache(stack_cache && other) = delete;
+
+        stack_cache& operator=(const stack_cache & other) = delete;
+        stack_cache& operator=(stack_cache && other) = delete;
+
+        /**
+         * @param numa_node node to bind a new stack to, -1 for any
+         */
+        ctx::stack_context allocate(size_t size, int numa_node = -1);
+
+        /**
+         * @param numa_node node given to allocate
+         */
+        void deallocate(ctx::stack_context & sctx, int numa_node = -1);
+
+        /**
+         * @brief maps stacks with their pages touched into the shared list
+         */
+        void reserve(size_t count, size_t size, int numa_node = -1);
+
+        stats get_stats() const;
+
+        void make_metrics(const std::shared_ptr<Mon::IMetricer> &metricer);
+
+        /**
+         * @brief size of a stack rounded up to whole pages
+         */
+        static size_t get_stack_size(size_t size);
+    private:
+        friend struct detail::stack_thread_cache;
+
+        stack_cache() = default;
+
+        /**
+         * @brief gives a stack to the shared lists under their mutex, unmaps it when they are full
+         */
+        void release(void *stack, size_t size, int numa_node);
+
+        void *map(size_t size, int numa_node);
+
+        void unmap(void *stack, size_t size);
+
+        void report();
+
+        mutable std::mutex mutex;
+        // bottoms of free stacks, above their guard pages
+        std::map<std::pair<size_t, int>, std::vector<void *>> free_stacks;
+        size_t shared_count = 0;
+        std::atomic_size_t hits = {0};
+        std::atomic_size_t misses = {0};
+        std::atomic_size_t resident = {0};
+        std::atomic_size_t cached = {0};
+        size_t reported_hits = 0;
+        size_t reported_misses = 0;
+        std::shared_ptr<Mon::Counter> m_hits_count;
+        std::shared_ptr<Mon::Counter> m_misses_count;
+    };
+
+    /**
+     * @brief stack allocator of boost::context taking stacks of the stack_cache
+     */
+    template< typename traitsT >
+    class cached_fixedsize_stack {
+    private:
+        std::size_t     size_;
+        int             numa_node_;
+
+    public:
+        typedef traitsT traits_type;
+
+        /**
+         * @param numa_node node to bind the stack to, -1 for any
+         */
+        cached_fixedsize_stack( std::size_t size = traits_type::default_size(), int numa_node = -1 ) BOOST_NOEXCEPT_OR_NOTHROW :
+                size_( size),
+                numa_node_( numa_node) {
+        }
+
+        ctx::stack_context allocate() {
+            return stack_cache::instance().allocate( size_, numa_node_);
+        }
+
+        void deallocate( ctx::stack_context & sctx) BOOST_NOEXCEPT_OR_NOTHROW {
+            BOOST_ASSERT( sctx.sp);
+            stack_cache::instance().deallocate( sctx, numa_node_);
+        }
+    };
+}
+
+#endif //AR_STACK_CACHE_H
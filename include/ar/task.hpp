@@ -1,13 +1,14 @@
 #ifndef AR_TASK_H
 #define AR_TASK_H
 
-#define BOOST_THREAD_PROVIDES_FUTURE 1
-#define BOOST_THREAD_PROVIDES_FUTURE_CONTINUATION 1
-
 #include "ar/object.hpp"
 #include "ar/timestamp.hpp"
+#include "ar/os.hpp"
+#include "ar/task_queue.hpp"
+#include "ar/task_pool.hpp"
+#include "ar/future.hpp"
+#include "ar/cancellation.hpp"
 
-#include <boost/thread/future.hpp>
 #include <boost/context/continuation.hpp>
 
 #include <iostream>
@@ -16,14 +17,16 @@
 namespace AsyncRuntime {
     class IExecutor;
 
-    class task_pool;
+    class TaskInbox;
 
     class task {
+        friend class TaskInbox;
     public:
         struct execution_state {
             int64_t tag = INVALID_OBJECT_ID;
             int64_t work_group = INVALID_OBJECT_ID;
             int64_t processor = INVALID_OBJECT_ID;
+            TaskPriority priority = TaskPriority::NORMAL;
             IExecutor *executor = nullptr;
         };
 
@@ -37,7 +40,19 @@ namespace AsyncRuntime {
 
         task &operator=(task const &) = delete;
 
-        virtual ~task() = default;
+        virtual ~task() {
+            if (cancellation != nullptr) {
+                cancellation->release();
+            }
+        }
+
+        static void *operator new(std::size_t size) { return task_pool::allocate(size); }
+
+        static void operator delete(void *ptr, std::size_t size) noexcept { task_pool::deallocate(ptr, size); }
+
+        static void *operator new(std::size_t size, std::align_val_t al) { return ::operator new(size, al); }
+
+        static void operator delete(void *ptr, std::size_t size, std::align_val_t al) noexcept { ::operator delete(ptr, size, al); }
 
         virtual void execute(const execution_state &state) = 0;
 
@@ -49,6 +64,11 @@ namespace AsyncRuntime {
 
         int64_t get_delay() const { return created_at - TIMESTAMP_NOW_MICRO(); }
 
+        /**
+         * @brief time the delay expires at, us
+         */
+        int64_t get_deadline() const { return created_at; }
+
         const execution_state &get_execution_state() const { return state; }
 
         void set_execution_state(const execution_state & new_state) { state = new_state; }
@@ -57,46 +77,50 @@ namespace AsyncRuntime {
 
         void set_execution_state_tag(const int64_t & tag) { state.tag = tag; }
 
+        void set_execution_state_priority(TaskPriority priority) { state.priority = priority; }
+
+        TaskPriority get_priority() const { return state.priority; }
+
         bool delayed() const { return delay > 0; }
 
         virtual bool resolved() { return false; }
+
+        /**
+         * @brief attaches a token, the task doesn't run once it's cancelled
+         */
+        void set_cancellation(const CancellationToken &token) {
+            token.GetState()->add_ref();
+            if (cancellation != nullptr) {
+                cancellation->release();
+            }
+            cancellation = token.GetState();
+        }
+
+        detail::cancellation_state *get_cancellation() const { return cancellation; }
+
+        bool is_cancelled() const { return cancellation != nullptr && cancellation->is_cancelled(); }
+
+        /**
+         * @brief resolves the future of the task instead of running it, the task is deleted after
+         */
+        virtual void cancel() { }
     protected:
         execution_state state;
     private:
+        detail::cancellation_state *cancellation = nullptr;
         int64_t delay;
         int64_t created_at;
+        task *inbox_next = nullptr;
     };
 
     template < typename T >
-    using promise_t = boost::promise<T>;
+    using promise_t = task_promise<T>;
 
     template < typename T >
-    using future_t = boost::future<T>;
+    using future_t = task_future<T>;
 
     template < typename T >
-    using shared_future_t = boost::shared_future<T>;
-
-//    template < typename T >
-//    class task_future : public std::future< T > {
-//    public:
-//
-//    private:
-//    };
-//
-//
-//    template < typename T >
-//    class task_promise : public std::promise< T > {
-//    public:
-//        task_promise();
-//
-//    private:
-//    };
-//
-//    template < typename T >
-//    using promise_t = task_promise<T>;
-//
-//    template < typename T >
-//    using future_t = task_future<T>;
+    using shared_future_t = task_shared_future<T>;
 
     template< typename Fn >
     class base_task : public task {
@@ -117,6 +141,10 @@ namespace AsyncRuntime {
             }
         }
 
+        void cancel() override {
+            promise.set_exception(std::make_exception_ptr(OperationCancelled()));
+        }
+
         future_t<result_type> get_future() { return promise.get_future(); }
     private:
         template<typename T>
@@ -150,6 +178,10 @@ namespace AsyncRuntime {
             }
         }
 
+        void cancel() override {
+            promise.set_exception(std::make_exception_ptr(OperationCancelled()));
+        }
+
         future_t<void> get_future() { return promise.get_future(); }
     private:
         promise_type promise;
@@ -0,0 +1,170 @@
+#ifndef AR_TASK_GRAPH_H
+#define AR_TASK_GRAPH_H
+
+#include "ar/task.hpp"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+namespace AsyncRuntime {
+    namespace detail {
+        struct graph_node {
+            std::function<void()>       work;
+            // condition node: returns the index of the only successor to run, other values - none
+            std::function<int()>        condition;
+            std::string                 name;
+            std::vector<graph_node*>    successors;
+            std::vector<graph_node*>    dependents;
+            // dependents that aren't condition nodes, a node is ready when all of them are done
+            size_t                      strong_dependents = 0;
+            std::atomic_size_t          join_counter = {0};
+        };
+    }
+
+    /**
+     * @class TaskGraph
+     * @brief Static graph of tasks, built once and run many times on a work group.
+     *
+     * Edges are atomic join counters: a node is posted when the last of its predecessors is done,
+     * the first ready successor continues on the same worker, the others go to its local queue.
+     * A condition node (callable returning int) runs only the successor with the returned index,
+     * its edges don't count in join counters, so it can jump back and build a loop.
+     * The graph can't be changed while it runs and must outlive its runs.
+     */
+    class TaskGraph {
+    public:
+        class Node {
+            friend class TaskGraph;
+        public:
+            Node() = default;
+
+            /**
+             * @brief nodes run after this one
+             */
+            template< typename... Nodes >
+            Node &Precede(const Nodes &... nodes) {
+                (AddEdge(node, nodes.node), ...);
+                graph->compiled = false;
+                return *this;
+            }
+
+            /**
+             * @brief this node runs after nodes
+             */
+            template< typename... Nodes >
+            Node &Succeed(const Nodes &... nodes) {
+                (AddEdge(nodes.node, node), ...);
+                graph->compiled = false;
+                return *this;
+            }
+
+            Node &Name(const std::string &name) {
+                node->name = name;
+                return *this;
+            }
+
+            const std::string &GetName() const { return node->name; }
+
+            bool IsCondition() const { return static_cast<bool>(node->condition); }
+
+            size_t SuccessorsCount() const { return node->successors.size(); }
+
+            size_t DependentsCount() const { return node->dependents.size(); }
+
+            bool Empty() const { return node == nullptr; }
+        private:
+            Node(TaskGraph *graph, detail::graph_node *node) : graph(graph), node(node) { }
+
+            static void AddEdge(detail::graph_node *from, detail::graph_node *to) {
+                from->successors.push_back(to);
+                to->dependents.push_back(from);
+            }
+
+            TaskGraph           *graph = nullptr;
+            detail::graph_node  *node = nullptr;
+        };
+
+        /**
+         * @param work_group work group of the nodes, INVALID_OBJECT_ID - the group of the worker that
+         * starts a run or the main group
+         */
+        explicit TaskGraph(ObjectID work_group = INVALID_OBJECT_ID) : work_group(work_group) { }
+
+        TaskGraph(const TaskGraph &) = delete;
+
+        TaskGraph &operator=(const TaskGraph &) = delete;
+
+        /**
+         * @brief adds a node: void() - static node, int() - condition node
+         */
+        template< typename Callable >
+        Node Emplace(Callable &&f);
+
+        /**
+         * @brief runs the graph times times in a row
+         * @return future satisfied after the last run or with the exception of a node, runs of the graph
+         * requested while it runs are queued
+         */
+        future_t<void> Run(size_t times = 1);
+
+        /**
+         * @brief runs the graph until predicate returns true, it's checked after each run
+         */
+        future_t<void> RunUntil(std::function<bool()> predicate);
+
+        size_t NodesCount() const { return nodes.size(); }
+
+        bool Empty() const { return nodes.empty(); }
+    private:
+        class NodeTask;
+
+        struct Topology {
+            std::function<bool()>   predicate;
+            ObjectID                work_group;
+            task_promise<void>      promise;
+        };
+
+        void Compile();
+        void StartRun(const Topology &topology, detail::graph_node *&next);
+        void Schedule(detail::graph_node *node, detail::graph_node *&next);
+        void Place(detail::graph_node *node, detail::graph_node *&next);
+        void Post(detail::graph_node *node);
+        void Invoke(detail::graph_node *node);
+        void Fail(std::exception_ptr e);
+        void Complete(detail::graph_node *&next);
+
+        ObjectID                                            work_group;
+        ObjectID                                            run_group = INVALID_OBJECT_ID;
+        std::vector<std::unique_ptr<detail::graph_node>>    nodes;
+        std::vector<detail::graph_node*>                    sources;
+        bool                                                compiled = false;
+
+        std::mutex                                          mutex;
+        std::deque<Topology>                                topologies;
+        std::atomic_size_t                                  pending = {0};
+        std::atomic_bool                                    cancelled = {false};
+        std::exception_ptr                                  error;
+    };
+
+    template< typename Callable >
+    TaskGraph::Node TaskGraph::Emplace(Callable &&f) {
+        auto node = std::make_unique<detail::graph_node>();
+        if constexpr (std::is_same_v<std::invoke_result_t<Callable>, int>) {
+            node->condition = std::forward<Callable>(f);
+        } else {
+            node->work = std::forward<Callable>(f);
+        }
+        nodes.push_back(std::move(node));
+        compiled = false;
+        return Node(this, nodes.back().get());
+    }
+}
+
+#endif //AR_TASK_GRAPH_H
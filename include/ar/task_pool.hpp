@@ -0,0 +1,53 @@
+#ifndef AR_TASK_POOL_H
+#define AR_TASK_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace AsyncRuntime {
+
+    struct task_pool_stats {
+        /** @brief slabs taken from the system */
+        size_t slabs_count = 0;
+        /** @brief orphaned slabs of exited threads, waiting to be adopted */
+        size_t orphaned_slabs_count = 0;
+        /** @brief allocations served by the system allocator: new slabs and blocks too large for a size class */
+        size_t system_allocations = 0;
+        /** @brief blocks returned to their slab by other threads */
+        size_t remote_frees = 0;
+    };
+
+    /**
+     * @class task_pool
+     * @brief Slab allocator for task objects.
+     *
+     * Every thread allocates from its own slabs of fixed size blocks, so
+     * allocation and a free on the allocating thread don't synchronize.
+     * A block freed by another thread is queued to a thread local batch and
+     * returned to its slab with a single CAS per batch, the owner reclaims
+     * returned blocks when its free list runs dry. A new slab is bound to
+     * the numa node of the allocating thread. Slabs of exited threads
+     * are adopted by new threads, slabs are never returned to the system.
+     */
+    class task_pool {
+    public:
+        /** @brief block sizes are multiples of this */
+        static constexpr size_t block_align = 64;
+        /** @brief blocks larger than this go to the system allocator */
+        static constexpr size_t max_block_size = 512;
+        static constexpr size_t slab_size = 64 * 1024;
+
+        static void *allocate(size_t size);
+
+        static void deallocate(void *ptr, size_t size) noexcept;
+
+        /**
+         * @brief returns the blocks queued by this thread to their slabs
+         */
+        static void flush() noexcept;
+
+        static task_pool_stats get_stats() noexcept;
+    };
+}
+
+#endif //AR_TASK_POOL_H
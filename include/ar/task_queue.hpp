@@ -245,6 +245,19 @@ Task C: 2
         */
         T steal(unsigned priority);
 
+        /**
+        @brief steals up to half of the items from the queue
+
+        @param dst queue of the thief (only its owner can call this function)
+
+        For every priority value up to a half (at least one) of the items
+        is stolen and pushed to @c dst with the same priority.
+        Every item is claimed with its own CAS on the top index, so the owner
+        of the queue keeps popping without synchronization.
+        Returns the number of the stolen items.
+        */
+        size_t steal_half(TaskQueue &dst);
+
     private:
         TF_NO_INLINE Array *resize_array(Array *a, unsigned p, std::int64_t b, std::int64_t t);
     };
@@ -400,6 +413,24 @@ Task C: 2
         return item;
     }
 
+// Function: steal_half
+    template<typename T, unsigned TF_MAX_PRIORITY>
+    size_t TaskQueue<T, TF_MAX_PRIORITY>::steal_half(TaskQueue &dst) {
+        size_t stolen = 0;
+        for (unsigned p = 0; p < TF_MAX_PRIORITY; p++) {
+            size_t n = size(p);
+            for (size_t k = (n + 1) / 2; k > 0; --k) {
+                auto item = steal(p);
+                if (!item) {
+                    break;
+                }
+                dst.push(item, p);
+                ++stolen;
+            }
+        }
+        return stolen;
+    }
+
 // Function: capacity
     template<typename T, unsigned TF_MAX_PRIORITY>
     int64_t TaskQueue<T, TF_MAX_PRIORITY>::capacity() const noexcept {
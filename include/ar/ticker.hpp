@@ -3,38 +3,109 @@
 
 
 #include <iostream>
+#include <memory>
 #include "ar/task.hpp"
 #include "ar/timestamp.hpp"
 #include "ar/coroutine.hpp"
 
+// tickers whose periods differ by less than this part of the period share one clock
+#define TICKER_SLACK 0.05
+
 
 namespace AsyncRuntime {
 
+    namespace detail {
+        class ticker_clock;
+    }
+
+    struct TickerStats {
+        // ticks delivered; of them without waiting, because the ticker was behind its clock
+        size_t      ticks = 0;
+        size_t      late_ticks = 0;
+        // ticks of the clock the ticker was too busy to take
+        size_t      missed_ticks = 0;
+        // period of the shared clock and its difference from the requested period, us
+        Timespan    period_us = 0;
+        Timespan    drift_us = 0;
+        // delayed tasks fired by the clock for all its tickers, and how late they are, us
+        size_t      fires = 0;
+        Timespan    mean_lateness_us = 0;
+        Timespan    max_lateness_us = 0;
+        // tickers on the clock, this one included
+        size_t      shared_with = 0;
+    };
 
     /**
-     * @brief
      * @class Ticker
+     * @brief Periodic ticks on a clock shared with the other tickers of the same period.
+     *
+     * Tickers of one work group whose periods are within the slack share one clock: one delayed task
+     * per period fires all their ticks as a batch. Ticks are on the grid of the clock, a ticker which is
+     * behind it gets the missed tick at once. The ticker is attached to its clock by the first tick, the
+     * delayed task of the clock goes to the scheduler of the work group wg; a tick AsyncTick waits
+     * for is resolved by a task in the execution state given to it, as its tag, work group and priority.
      */
     class Ticker {
     public:
         template< typename Rep, typename Period >
-        explicit Ticker(const std::chrono::duration<Rep, Period>& rtime, ObjectID wg = 0):
+        explicit Ticker(const std::chrono::duration<Rep, Period>& rtime, ObjectID wg = INVALID_OBJECT_ID, double slack = TICKER_SLACK):
             delay( Timestamp::Cast<std::chrono::duration<Rep, Period>, Timestamp::Micro>(rtime.count()) )
-            , last_tick_ts(TIMESTAMP_NOW_MICRO())
+            , work_group(wg)
+            , slack(slack)
             , is_continue {true}
             { };
-        ~Ticker() = default;
+        ~Ticker();
+
+        Ticker(const Ticker &) = delete;
+
+        Ticker &operator=(const Ticker &) = delete;
 
+        /**
+         * @brief stops the ticker, a pending tick is resolved with false
+         */
         void Stop();
 
         future_t<bool> AsyncTick();
         future_t<bool> AsyncTick(const task::execution_state& execution_state);
         future_t<bool> AsyncTick(CoroutineHandler* handler);
+
+        /**
+         * @brief suspends the coroutine until the next tick, without a future
+         * @return false if the ticker is stopped
+         */
+        bool AwaitTick(CoroutineHandler* handler);
+
+        TickerStats GetStats() const;
     private:
-        Timespan                        last_tick_ts;
-        Timespan                        delay;
-        //std::shared_ptr<Result<bool>>   tick_result;
-        std::atomic_bool                is_continue;
+        friend class detail::ticker_clock;
+
+        /**
+         * @brief attaches the ticker to a clock on the first tick
+         */
+        detail::ticker_clock *GetClock();
+
+        Timespan                                delay;
+        ObjectID                                work_group;
+        double                                  slack;
+        std::atomic_bool                        is_continue;
+        std::shared_ptr<detail::ticker_clock>   clock;
+
+        // guarded by the mutex of the clock
+        bool                                    attached = false;
+        Ticker                                  *prev = nullptr;
+        Ticker                                  *next = nullptr;
+        bool                                    linked = false;
+        // the waiter: a suspended coroutine and its result, or a promise
+        CoroutineHandler                        *handler = nullptr;
+        bool                                    *result = nullptr;
+        std::unique_ptr<promise_t<bool>>        promise;
+        // a tick of the clock resolves the promise by a task in the execution state given to AsyncTick
+        task::execution_state                   state;
+        // the last tick of the clock taken
+        int64_t                                 seen = 0;
+        size_t                                  ticks = 0;
+        size_t                                  late_ticks = 0;
+        size_t                                  missed_ticks = 0;
     };
 }
 
@@ -0,0 +1,62 @@
+#include "ar/cancellation.hpp"
+
+using namespace AsyncRuntime;
+using namespace AsyncRuntime::detail;
+
+
+bool cancellation_state::add_callback(cancellation_callback *callback) noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (is_cancelled()) {
+        return false;
+    }
+
+    callback->prev = nullptr;
+    callback->next = head;
+    if (head != nullptr) {
+        head->prev = callback;
+    }
+    head = callback;
+    callback->linked = true;
+    return true;
+}
+
+
+bool cancellation_state::remove_callback(cancellation_callback *callback) noexcept {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!callback->linked) {
+        return false;
+    }
+
+    if (callback->prev != nullptr) {
+        callback->prev->next = callback->next;
+    } else {
+        head = callback->next;
+    }
+    if (callback->next != nullptr) {
+        callback->next->prev = callback->prev;
+    }
+    callback->linked = false;
+    return true;
+}
+
+
+void cancellation_state::cancel() noexcept {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (cancelled.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    // callbacks run unlocked, they can remove other callbacks or cancel other tokens
+    while (head != nullptr) {
+        auto *callback = head;
+        head = callback->next;
+        if (head != nullptr) {
+            head->prev = nullptr;
+        }
+        callback->linked = false;
+
+        lock.unlock();
+        callback->on_cancel();
+        lock.lock();
+    }
+}
@@ -1,11 +1,30 @@
 #include "ar/cpu_helper.hpp"
 #include "config.hpp"
 #include <math.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
 
 #ifdef USE_NUMA
 #include <numa.h>
 #endif
 
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// cpuset of the cgroup of the process, v2 and v1 hierarchies
+#define CGROUP_CPUSET_V2 "/sys/fs/cgroup/cpuset.cpus.effective"
+#define CGROUP_CPUSET_V1 "/sys/fs/cgroup/cpuset/cpuset.effective_cpus"
+
+namespace fs = std::filesystem;
+
 static bool _numa_available() {
     #ifdef USE_NUMA
         return numa_available() >= 0;
@@ -24,17 +43,41 @@ static int _numa_node_of_cpu(int i) {
 }
 
 
-static int _get_numa_nodes_count() {
+static bool _numa_bindable(int node) {
 #ifdef USE_NUMA
-    return numa_max_node() + 1;
+    static const bool multiple_nodes = _numa_available() && numa_max_node() > 0;
+    return multiple_nodes && node >= 0 && node <= numa_max_node();
 #else
-    return 1;
+    return false;
 #endif
 }
 
 
+static bool _read_line(const fs::path &path, std::string &line) {
+    std::ifstream file(path);
+    return file.is_open() && std::getline(file, line) && !line.empty();
+}
+
+
+static bool _read_cpu_list(const fs::path &path, std::vector<size_t> &cpus) {
+    std::string line;
+    if (!_read_line(path, line)) {
+        return false;
+    }
+    cpus = AsyncRuntime::ParseCpuList(line);
+    return !cpus.empty();
+}
+
+
+static std::vector<size_t> _intersect(const std::vector<size_t> &l, const std::vector<size_t> &r) {
+    std::vector<size_t> result;
+    std::set_intersection(l.begin(), l.end(), r.begin(), r.end(), std::back_inserter(result));
+    return result;
+}
+
+
 int AsyncRuntime::SetAffinity(std::thread & thread, const AsyncRuntime::CPU &affinity_cpu) {
-#ifdef USE_NUMA
+#if defined(__linux__)
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);
     CPU_SET(affinity_cpu.id, &cpuset);
@@ -45,40 +88,217 @@ int AsyncRuntime::SetAffinity(std::thread & thread, const AsyncRuntime::CPU &aff
 }
 
 
-std::vector<AsyncRuntime::CPU> AsyncRuntime::GetCPUs() {
+std::vector<size_t> AsyncRuntime::ParseCpuList(const std::string &list) {
+    std::vector<size_t> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        const std::string range = list.substr(pos, end - pos);
+        pos = end + 1;
+
+        const size_t dash = range.find('-');
+        try {
+            const size_t first = std::stoul(range.substr(0, dash));
+            const size_t last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash + 1));
+            for (size_t cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::exception &) {
+            // blank or malformed range
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+
+std::vector<size_t> AsyncRuntime::GetAllowedCPUs() {
+    std::vector<size_t> allowed;
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) == 0) {
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpuset)) {
+                allowed.push_back(cpu);
+            }
+        }
+    }
+
+    std::vector<size_t> cgroup;
+    if (_read_cpu_list(CGROUP_CPUSET_V2, cgroup) || _read_cpu_list(CGROUP_CPUSET_V1, cgroup)) {
+        allowed = allowed.empty() ? cgroup : _intersect(allowed, cgroup);
+    }
+#endif
+    return allowed;
+}
+
+
+std::vector<AsyncRuntime::CPU> AsyncRuntime::ReadCPUs(const std::string &sysfs_cpu_root, const std::vector<size_t> &allowed) {
     std::vector<AsyncRuntime::CPU> cpus;
-    for (int i = 0; i < std::thread::hardware_concurrency(); ++i) {
+    const fs::path root(sysfs_cpu_root);
+    std::vector<size_t> online;
+    if (!_read_cpu_list(root / "online", online)) {
+        return cpus;
+    }
+    if (!allowed.empty()) {
+        online = _intersect(online, allowed);
+    }
+
+    for (size_t id : online) {
+        const fs::path dir = root / ("cpu" + std::to_string(id));
         AsyncRuntime::CPU cpu = {};
-        cpu.id = i;
-        cpu.numa_node_id = _numa_node_of_cpu(i);
+        cpu.id = id;
+
+        std::vector<size_t> siblings;
+        if (_read_cpu_list(dir / "topology" / "core_cpus_list", siblings) ||
+            _read_cpu_list(dir / "topology" / "thread_siblings_list", siblings)) {
+            cpu.core_id = siblings.front();
+        } else {
+            cpu.core_id = id;
+        }
+
+        // the highest level of data or unified cache, the package if there is no cache information
+        int llc_level = -1;
+        std::error_code ec;
+        for (fs::directory_iterator it(dir / "cache", ec), end; !ec && it != end; it.increment(ec)) {
+            std::string level, type;
+            std::vector<size_t> shared;
+            if (it->path().filename().string().rfind("index", 0) != 0 ||
+                !_read_line(it->path() / "level", level) ||
+                (_read_line(it->path() / "type", type) && type == "Instruction") ||
+                !_read_cpu_list(it->path() / "shared_cpu_list", shared)) {
+                continue;
+            }
+            const int cache_level = std::atoi(level.c_str());
+            if (cache_level > llc_level) {
+                llc_level = cache_level;
+                cpu.llc_id = shared.front();
+            }
+        }
+        if (llc_level < 0) {
+            std::vector<size_t> package;
+            if (_read_cpu_list(dir / "topology" / "package_cpus_list", package) ||
+                _read_cpu_list(dir / "topology" / "core_siblings_list", package)) {
+                cpu.llc_id = package.front();
+            }
+        }
+
+        bool has_node = false;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            const std::string name = it->path().filename().string();
+            if (name.size() > 4 && name.rfind("node", 0) == 0 && std::isdigit(static_cast<unsigned char>(name[4]))) {
+                cpu.numa_node_id = std::stoul(name.substr(4));
+                has_node = true;
+                break;
+            }
+        }
+        if (!has_node) {
+            cpu.numa_node_id = _numa_node_of_cpu(static_cast<int>(id));
+        }
+
         cpus.push_back(cpu);
     }
-    return std::move(cpus);
+    return cpus;
 }
 
 
-std::vector<AsyncRuntime::NumaNode> AsyncRuntime::GetNumaNodes() {
-    std::vector<NumaNode> nodes(_get_numa_nodes_count());
+void *AsyncRuntime::NumaAlloc(size_t size, int numa_node) {
+#ifdef USE_NUMA
+    if (_numa_bindable(numa_node)) {
+        // mbind works on whole pages
+        static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t bound_size = (size + page_size - 1) / page_size * page_size;
+        void *ptr = std::aligned_alloc(page_size, bound_size);
+        NumaBind(ptr, bound_size, numa_node);
+        return ptr;
+    }
+#endif
+    return std::malloc(size);
+}
+
+
+void AsyncRuntime::NumaBind(void *ptr, size_t size, int numa_node) {
+#ifdef USE_NUMA
+    if (ptr != nullptr && _numa_bindable(numa_node)) {
+        numa_tonode_memory(ptr, size, numa_node);
+    }
+#endif
+}
+
+
+int AsyncRuntime::GetCurrentNumaNode() {
+#if defined(USE_NUMA) && defined(__linux__)
+    const int cpu = sched_getcpu();
+    if (cpu >= 0 && _numa_available()) {
+        return _numa_node_of_cpu(cpu);
+    }
+#endif
+    return -1;
+}
+
+
+void AsyncRuntime::NumaFree(void *ptr) {
+    std::free(ptr);
+}
+
+
+std::vector<AsyncRuntime::CPU> AsyncRuntime::GetCPUs() {
+    const auto allowed = GetAllowedCPUs();
+    auto cpus = ReadCPUs(AR_SYSFS_CPU_ROOT, allowed);
+    if (!cpus.empty()) {
+        return cpus;
+    }
+
+    // no sysfs: every cpu is a core with its own cache
     for (int i = 0; i < std::thread::hardware_concurrency(); ++i) {
+        if (!allowed.empty() && !std::binary_search(allowed.begin(), allowed.end(), static_cast<size_t>(i))) {
+            continue;
+        }
         AsyncRuntime::CPU cpu = {};
         cpu.id = i;
         cpu.numa_node_id = _numa_node_of_cpu(i);
-        nodes[cpu.numa_node_id].id = cpu.numa_node_id;
-        nodes[cpu.numa_node_id].cpus.push_back(cpu);
+        cpu.core_id = i;
+        cpu.llc_id = i;
+        cpus.push_back(cpu);
     }
-    return nodes;
+    return cpus;
+}
+
+
+std::vector<AsyncRuntime::NumaNode> AsyncRuntime::GetNumaNodes() {
+    // nodes without allowed cpus are left out
+    std::map<size_t, NumaNode> nodes;
+    for (const auto &cpu : GetCPUs()) {
+        auto &node = nodes[cpu.numa_node_id];
+        node.id = cpu.numa_node_id;
+        node.cpus.push_back(cpu);
+    }
+
+    std::vector<NumaNode> result;
+    for (auto &it : nodes) {
+        result.push_back(std::move(it.second));
+    }
+    return result;
 }
 
 
 std::vector<AsyncRuntime::NumaNode> AsyncRuntime::GetManualNumaNodes(int count) {
+    auto cpus = GetCPUs();
+    // the cpus of a cache domain go to the same node
+    std::stable_sort(cpus.begin(), cpus.end(), [](const CPU &l, const CPU &r) { return l.llc_id < r.llc_id; });
+    count = std::max(1, std::min(count, static_cast<int>(cpus.size())));
+
+    // the cpus keep their physical node for memory binding
     std::vector<NumaNode> nodes(count);
-    int node_cpus_count = static_cast<int>((float)std::thread::hardware_concurrency())/(float)count;
-    for (int i = 0; i < std::thread::hardware_concurrency(); ++i) {
-        AsyncRuntime::CPU cpu = {};
-        cpu.id = i;
-        cpu.numa_node_id = floor(static_cast<float>(i)/static_cast<float>(node_cpus_count));
-        nodes[cpu.numa_node_id].id = cpu.numa_node_id;
-        nodes[cpu.numa_node_id].cpus.push_back(cpu);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        const size_t node = i * count / cpus.size();
+        nodes[node].id = node;
+        nodes[node].cpus.push_back(cpus[i]);
     }
     return nodes;
-}
\ No newline at end of file
+}
@@ -0,0 +1,58 @@
+#include "cpu_placement.h"
+
+#include <tuple>
+#include <unordered_map>
+
+using namespace AsyncRuntime;
+
+
+size_t AsyncRuntime::PickCpu(const std::vector<CPU> &cpus, const std::function<size_t(size_t)> &usage, size_t llc_id) {
+    std::unordered_map<size_t, size_t> cores_usage;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cores_usage[cpus[i].core_id] += usage(i);
+    }
+
+    size_t best = 0;
+    std::tuple<size_t, bool, size_t> best_key;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        const auto key = std::make_tuple(usage(i),
+                                         llc_id != ANY_LLC && cpus[i].llc_id != llc_id,
+                                         cores_usage[cpus[i].core_id]);
+        if (i == 0 || key < best_key) {
+            best = i;
+            best_key = key;
+        }
+    }
+    return best;
+}
+
+
+std::vector<size_t> AsyncRuntime::PlaceSlot(const std::vector<CPU> &cpus, std::map<size_t, size_t> &cpus_wg, size_t concurrency) {
+    std::vector<size_t> placed;
+    if (cpus.empty()) {
+        return placed;
+    }
+
+    // the domain with the lowest average usage, the larger one of equals
+    std::map<size_t, std::pair<size_t, size_t>> domains;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        auto &domain = domains[cpus[i].llc_id];
+        domain.first += cpus_wg[i];
+        domain.second++;
+    }
+    size_t llc_id = domains.begin()->first;
+    for (const auto &it : domains) {
+        const auto &best = domains[llc_id];
+        const size_t load = it.second.first * best.second, best_load = best.first * it.second.second;
+        if (load < best_load || (load == best_load && it.second.second > best.second)) {
+            llc_id = it.first;
+        }
+    }
+
+    for (size_t c = 0; c < concurrency; ++c) {
+        const size_t i = PickCpu(cpus, [&cpus_wg](size_t i) { return cpus_wg[i]; }, llc_id);
+        cpus_wg[i]++;
+        placed.push_back(i);
+    }
+    return placed;
+}
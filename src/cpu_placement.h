@@ -0,0 +1,37 @@
+#ifndef AR_CPU_PLACEMENT_H
+#define AR_CPU_PLACEMENT_H
+
+#include "ar/cpu_helper.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <map>
+#include <vector>
+
+#define ANY_LLC std::numeric_limits<size_t>::max()
+
+namespace AsyncRuntime {
+
+    /**
+     * @brief index of the cpu for one more busy worker
+     *
+     * The cpu with the fewest workers wins; among equally used cpus one of the llc domain, then one
+     * whose hyperthread siblings run the fewest workers, then the lowest index.
+     * @param usage number of workers on the cpu of an index
+     * @param llc_id preferred last level cache domain, ANY_LLC for none
+     */
+    size_t PickCpu(const std::vector<CPU> &cpus, const std::function<size_t(size_t)> &usage, size_t llc_id = ANY_LLC);
+
+    /**
+     * @brief cpus for the workers of a slot
+     *
+     * The slot goes to the least used llc domain and takes its cpus one by one with PickCpu, so it
+     * stays in the domain while the domain has free cpus and its workers don't share cores.
+     * @param cpus_wg number of workers on the cpu of an index, the placed workers are added
+     * @return indexes of the cpus
+     */
+    std::vector<size_t> PlaceSlot(const std::vector<CPU> &cpus, std::map<size_t, size_t> &cpus_wg, size_t concurrency);
+}
+
+#endif //AR_CPU_PLACEMENT_H
@@ -0,0 +1,50 @@
+#include "cpu_quota.h"
+
+#include <algorithm>
+
+using namespace AsyncRuntime;
+
+
+CpuQuota::CpuQuota(uint64_t period, uint64_t budget, uint64_t now)
+    : period(std::max<uint64_t>(period, 1))
+    , budget(std::max<uint64_t>(budget, 1))
+    , tokens(static_cast<int64_t>(this->budget))
+    , next_refill(now + this->period) {
+}
+
+
+bool CpuQuota::refill(uint64_t now) noexcept {
+    uint64_t refill_at = next_refill.load(std::memory_order_acquire);
+    if (now < refill_at) {
+        return false;
+    }
+
+    const uint64_t periods = (now - refill_at) / period + 1;
+    if (!next_refill.compare_exchange_strong(refill_at, refill_at + periods * period, std::memory_order_acq_rel)) {
+        // refilled by an other worker
+        return false;
+    }
+
+    // a debt is paid back by the following periods, an idle group doesn't save up more than one budget
+    const auto cap = static_cast<int64_t>(budget);
+    int64_t current = tokens.load(std::memory_order_relaxed);
+    int64_t filled;
+    do {
+        const auto missing = static_cast<uint64_t>(cap - current);
+        filled = periods > missing / budget ? cap : current + static_cast<int64_t>(periods * budget);
+    } while (!tokens.compare_exchange_weak(current, filled, std::memory_order_relaxed));
+    return true;
+}
+
+
+uint64_t CpuQuota::throttled_until() noexcept {
+    if (tokens.load(std::memory_order_relaxed) > 0) {
+        return 0;
+    }
+
+    const uint64_t refill_at = next_refill.load(std::memory_order_acquire);
+    if (throttled_refill.exchange(refill_at, std::memory_order_relaxed) != refill_at) {
+        throttled_periods.fetch_add(1, std::memory_order_relaxed);
+    }
+    return refill_at;
+}
@@ -0,0 +1,63 @@
+#ifndef AR_CPU_QUOTA_H
+#define AR_CPU_QUOTA_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace AsyncRuntime {
+
+    /**
+     * @class CpuQuota
+     * @brief Token bucket of the cpu time of a work group.
+     *
+     * Every period puts the budget into the bucket, the bucket holds at most one budget. Workers take
+     * the measured execution time of their tasks out of it; while the bucket is empty or in debt the
+     * group is throttled, a task longer than the rest of the budget is paid back by the next periods.
+     * Times are in ns of a monotonic clock given by the caller.
+     */
+    class CpuQuota {
+    public:
+        CpuQuota(uint64_t period, uint64_t budget, uint64_t now);
+
+        void account(uint64_t cpu_time) noexcept {
+            tokens.fetch_sub(static_cast<int64_t>(cpu_time), std::memory_order_relaxed);
+            consumed.fetch_add(cpu_time, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief puts the budgets of the periods passed since the last refill into the bucket
+         * @return true if this call has refilled the bucket
+         */
+        bool refill(uint64_t now) noexcept;
+
+        /**
+         * @brief end of the throttling: the next refill if the bucket is empty, 0 if the group may run
+         */
+        uint64_t throttled_until() noexcept;
+
+        /**
+         * @brief cpu time accounted since the last call
+         */
+        uint64_t take_consumed() noexcept { return consumed.exchange(0, std::memory_order_relaxed); }
+
+        /**
+         * @brief periods the group has been throttled in since the last call
+         */
+        uint64_t take_throttled_periods() noexcept { return throttled_periods.exchange(0, std::memory_order_relaxed); }
+
+        uint64_t get_period() const { return period; }
+
+        uint64_t get_budget() const { return budget; }
+    private:
+        const uint64_t          period;
+        const uint64_t          budget;
+        std::atomic_int64_t     tokens;
+        std::atomic_uint64_t    next_refill;
+        // the refill time of the last throttled period, counts every period once
+        std::atomic_uint64_t    throttled_refill = {0};
+        std::atomic_uint64_t    throttled_periods = {0};
+        std::atomic_uint64_t    consumed = {0};
+    };
+}
+
+#endif //AR_CPU_QUOTA_H
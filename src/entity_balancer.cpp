@@ -0,0 +1,106 @@
+#include "entity_balancer.h"
+
+#include <algorithm>
+#include <cmath>
+
+// weight of the last period in the smoothed load of an entity
+#define LOAD_SMOOTHING 0.5
+
+using namespace AsyncRuntime;
+
+EntityBalancer::EntityBalancer(double threshold, size_t cooldown, size_t max_migrations)
+    : threshold(threshold)
+    , cooldown(cooldown)
+    , max_migrations(max_migrations) {
+}
+
+std::vector<EntityBalancer::Migration> EntityBalancer::balance(const std::vector<EntityLoad> &loads, size_t slots_count) {
+    std::vector<Migration> migrations;
+    ++round;
+
+    slot_loads.assign(slots_count, 0.0);
+    for (const auto &l : loads) {
+        if (l.slot < 0 || l.slot >= (int)slots_count) {
+            continue;
+        }
+
+        auto &state = entities[l.entity];
+        state.load = state.load * (1.0 - LOAD_SMOOTHING) + (double)l.cpu_time * LOAD_SMOOTHING;
+        state.round = round;
+        slot_loads[l.slot] += state.load;
+    }
+
+    // forget deleted entities
+    for (auto it = entities.begin(); it != entities.end();) {
+        if (it->second.round != round) {
+            it = entities.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (slots_count < 2) {
+        return migrations;
+    }
+
+    double total = 0;
+    for (double load : slot_loads) {
+        total += load;
+    }
+    if (total <= 0) {
+        return migrations;
+    }
+    const double avg = total / (double)slots_count;
+
+    std::vector<int> entity_slots(loads.size());
+    for (size_t i = 0; i < loads.size(); ++i) {
+        entity_slots[i] = loads[i].slot;
+    }
+
+    for (size_t m = 0; m < max_migrations; ++m) {
+        auto [min_it, max_it] = std::minmax_element(slot_loads.begin(), slot_loads.end());
+        const int from = (int)(max_it - slot_loads.begin());
+        const int to = (int)(min_it - slot_loads.begin());
+        const double spread = *max_it - *min_it;
+        if (spread <= threshold * avg) {
+            break;
+        }
+
+        // the entity closest to the half of the spread brings both slots closest to each other
+        int candidate = -1;
+        double candidate_distance = 0;
+        for (size_t i = 0; i < loads.size(); ++i) {
+            if (entity_slots[i] != from) {
+                continue;
+            }
+
+            const auto &state = entities[loads[i].entity];
+            if (state.moved_round != 0 && round - state.moved_round <= cooldown) {
+                continue;
+            }
+
+            if (state.load <= 0 || state.load >= spread) {
+                continue;
+            }
+
+            double distance = std::fabs(state.load - spread / 2);
+            if (candidate < 0 || distance < candidate_distance) {
+                candidate = (int)i;
+                candidate_distance = distance;
+            }
+        }
+
+        if (candidate < 0) {
+            break;
+        }
+
+        auto &state = entities[loads[candidate].entity];
+        slot_loads[from] -= state.load;
+        slot_loads[to] += state.load;
+        state.moved_round = round;
+        entity_slots[candidate] = to;
+        migrations.push_back({loads[candidate].entity, from, to});
+    }
+
+    return migrations;
+}
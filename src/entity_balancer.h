@@ -0,0 +1,70 @@
+#ifndef AR_ENTITY_BALANCER_H
+#define AR_ENTITY_BALANCER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+
+namespace AsyncRuntime {
+
+    /**
+     * @class EntityBalancer
+     * @brief Decides which entities to move between the slots of a work group.
+     *
+     * Gets the cpu time spent by every entity during the last period, smooths it
+     * and moves entities from the most loaded slot to the least loaded one while
+     * the spread between them exceeds the threshold. A move never overshoots
+     * (the moved load is less than the spread) and a moved entity stays put for
+     * a few periods, so entities don't bounce between slots.
+     */
+    class EntityBalancer {
+    public:
+        struct EntityLoad {
+            uint16_t    entity;
+            int         slot;
+            uint64_t    cpu_time;
+        };
+
+        struct Migration {
+            uint16_t    entity;
+            int         from;
+            int         to;
+        };
+
+        /**
+         * @param threshold max allowed spread between slot loads, relative to the average slot load
+         * @param cooldown number of periods a moved entity can't be moved again
+         * @param max_migrations max moves per period
+         */
+        EntityBalancer(double threshold, size_t cooldown, size_t max_migrations);
+
+        /**
+         * @brief accounts the loads of the last period and plans migrations
+         * @param loads loads of all assigned entities, entities not listed are forgotten
+         * @param slots_count number of slots in the work group
+         * @return migrations to apply
+         */
+        std::vector<Migration> balance(const std::vector<EntityLoad> &loads, size_t slots_count);
+
+        /**
+         * @brief smoothed loads of the slots after the last balance()
+         */
+        const std::vector<double> & get_slot_loads() const { return slot_loads; }
+    private:
+        struct EntityState {
+            double      load = 0;
+            size_t      moved_round = 0;
+            size_t      round = 0;
+        };
+
+        double                                      threshold;
+        size_t                                      cooldown;
+        size_t                                      max_migrations;
+        size_t                                      round = 0;
+        std::unordered_map<uint16_t, EntityState>   entities;
+        std::vector<double>                         slot_loads;
+    };
+}
+
+#endif //AR_ENTITY_BALANCER_H
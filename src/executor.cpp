@@ -3,7 +3,16 @@
 #include "ar/runtime.hpp"
 #include <utility>
 #include "executor_slot.h"
+#include "entity_balancer.h"
+#include "cpu_quota.h"
+#include "cpu_placement.h"
 #include "numbers.h"
+#include "config.hpp"
+
+// periods a migrated entity stays in its new slot
+#define REBALANCE_COOLDOWN 4
+// max entity migrations per rebalance period
+#define MAX_MIGRATIONS 4
 
 using namespace AsyncRuntime;
 
@@ -24,43 +33,193 @@ void IExecutor::DeleteEntity(uint16_t id) {
     }
 }
 
+void IExecutor::PostBatch(task **tasks, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        Post(tasks[i]);
+    }
+}
+
 ExecutorWorkGroup::ExecutorWorkGroup(int id,
                                      const WorkGroupOption & option,
                                      const std::vector<AsyncRuntime::CPU> &cpus,
-                                     std::map<size_t, size_t>& cpus_wg) : id(id) {
+                                     std::map<size_t, size_t>& cpus_wg,
+                                     Executor *executor) : id(id), executor(executor) {
     int slot_concurrency = (option.slot_concurrency > 0)? option.slot_concurrency : std::thread::hardware_concurrency();
     int max_cpus = (int) ((double) cpus.size() * (1.0 / (option.cap / option.util)));
     max_cpus = std::min(std::max(1, max_cpus), (int)cpus.size());
     int slots_count = max_cpus/slot_concurrency;
     slots_count = std::max(1, slots_count);
+    // workers of an elastic slot beyond slot_concurrency start inactive
+    const int max_concurrency = std::max(slot_concurrency, option.max_slot_concurrency);
     name = option.name;
+    worker_idle_ms = std::max(0, option.worker_idle_ms);
+    scale_queue_size = static_cast<size_t>(std::max(1, option.scale_queue_size));
+    scale_delay_us = std::max(1, option.scale_delay_us);
+    numa_steal_threshold = std::max(0, option.numa_steal_threshold);
+    min_spin = std::max(0, option.min_spin);
+    max_spin = std::max(0, option.max_spin);
+
+    entities_peer_slot.reset(new std::atomic_int16_t[MAX_ENTITY_ID]);
+    for (int e = 0; e < MAX_ENTITY_ID; ++e) {
+        entities_peer_slot[e].store(-1, std::memory_order_relaxed);
+    }
+
+#if defined(MEASURE_CPU_TIME)
+    if (option.rebalance_interval_ms > 0 && slots_count > 1) {
+        balancing = true;
+        rebalance_interval_ms = option.rebalance_interval_ms;
+        balancer = std::make_unique<EntityBalancer>(std::max(0.0, option.rebalance_threshold),
+                                                    REBALANCE_COOLDOWN,
+                                                    MAX_MIGRATIONS);
+        entities_cpu_time.reset(new std::atomic_uint64_t[MAX_ENTITY_ID]);
+        for (int e = 0; e < MAX_ENTITY_ID; ++e) {
+            entities_cpu_time[e].store(0, std::memory_order_relaxed);
+        }
+    }
+#endif
+
+    if (option.cpu_quota_period_ms > 0) {
+        // the share of the cpus the group gets by cap and util, as for the number of its cpus
+        const double share = std::min(std::max(option.util / option.cap, 0.0), 1.0) * (double) cpus.size();
+        const uint64_t period = static_cast<uint64_t>(option.cpu_quota_period_ms) * 1000 * 1000;
+        quota = std::make_unique<CpuQuota>(period, static_cast<uint64_t>((double) period * share),
+                                           std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                   std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // workers of the slots expire the timers, the scheduler must be there before them
+    scheduler = std::make_unique<Scheduler>([this](task *task) {
+        Post(task);
+    }, [this]() {
+        NotifyIdle(nullptr);
+    }, option.timer_tick_us > 0 ? option.timer_tick_us : SCHEDULER_TICK_US);
 
     for (int i = 0; i < slots_count; ++i) {
         std::vector<AsyncRuntime::CPU> slot_cpus;
 
-        for (int c = 0; c < slot_concurrency; ++c) {
-            auto it = min_element(cpus_wg.begin(), cpus_wg.end(),
-                                  [](std::pair<size_t, size_t> l, std::pair<size_t, size_t> r) -> bool { return l.second < r.second; });
-            it->second++;
-            slot_cpus.push_back(cpus[it->first]);
-            cpus_peer_slot[cpus[it->first].id] = i;
+        for (size_t c : PlaceSlot(cpus, cpus_wg, slot_concurrency)) {
+            slot_cpus.push_back(cpus[c]);
+            cpus_peer_slot[cpus[c].id] = i;
+        }
+        // the executor places them again when they are activated, in the domain of the slot
+        for (int c = slot_concurrency; c < max_concurrency; ++c) {
+            slot_cpus.push_back(slot_cpus.front());
         }
 
-        auto slot = new ExecutorSlot(i, option.name, slot_cpus);
+        auto slot = new ExecutorSlot(i, option.name, slot_cpus, this, slot_concurrency);
         slots.push_back(slot);
     }
 
-    scheduler = std::make_unique<Scheduler>([this](task *task) {
-        Post(task);
-    });
+    ready.store(true, std::memory_order_release);
+
+    if (balancing) {
+        rebalancer_th.Submit([this] { RebalanceLoop(); });
+    }
+
 }
 
 ExecutorWorkGroup::~ExecutorWorkGroup() {
+    Stop();
     for (auto slot: slots) {
         delete slot;
     }
 }
 
+void ExecutorWorkGroup::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(rebalance_mutex);
+        rebalance_stop = true;
+    }
+    rebalance_cv.notify_one();
+    rebalancer_th.Join();
+
+    // all workers must be stopped before any slot is deleted, they steal from each other
+    for (auto slot: slots) {
+        slot->stop();
+    }
+}
+
+void ExecutorWorkGroup::NotifyIdle(ExecutorSlot *busy_slot) {
+    if (!IsReady()) {
+        return;
+    }
+
+    for (auto slot: slots) {
+        if (slot != busy_slot && slot->notify_idle()) {
+            return;
+        }
+    }
+}
+
+uint64_t ExecutorWorkGroup::ChargeQuota(uint64_t cpu_time, uint64_t now) {
+    quota->account(cpu_time);
+    if (quota->refill(now) && quota_cpu_time) {
+        quota_cpu_time->Increment(static_cast<double>(quota->take_consumed()) / 1e9);
+    }
+    return quota->throttled_until();
+}
+
+void ExecutorWorkGroup::AccountThrottled(uint64_t time) {
+    if (quota_throttled_time) {
+        quota_throttled_time->Increment(static_cast<double>(time) / 1e9);
+        quota_throttled_periods->Increment(static_cast<double>(quota->take_throttled_periods()));
+    }
+}
+
+void ExecutorWorkGroup::SetRemoteGroups(const std::vector<ExecutorWorkGroup*> &groups) {
+    if (HasRemoteGroups()) {
+        return;
+    }
+
+    remote_groups = groups;
+    remote_ready.store(true, std::memory_order_release);
+}
+
+void ExecutorWorkGroup::RebalanceLoop() {
+    std::unique_lock<std::mutex> lock(rebalance_mutex);
+    while (!rebalance_cv.wait_for(lock, std::chrono::milliseconds(rebalance_interval_ms),
+                                  [this] { return rebalance_stop; })) {
+        Rebalance();
+    }
+}
+
+void ExecutorWorkGroup::Rebalance() {
+    std::vector<EntityBalancer::EntityLoad> loads;
+    std::vector<uint64_t> slots_time(slots.size(), 0);
+    for (int e = 0; e < MAX_ENTITY_ID; ++e) {
+        uint64_t cpu_time = entities_cpu_time[e].load(std::memory_order_relaxed);
+        if (cpu_time > 0) {
+            cpu_time = entities_cpu_time[e].exchange(0, std::memory_order_relaxed);
+        }
+
+        int slot_id = entities_peer_slot[e].load(std::memory_order_acquire);
+        if (slot_id < 0) {
+            continue;
+        }
+
+        loads.push_back({static_cast<uint16_t>(e), slot_id, cpu_time});
+        slots_time[slot_id] += cpu_time;
+    }
+
+    for (const auto &migration : balancer->balance(loads, slots.size())) {
+        // the entity could be deleted or reassigned meanwhile
+        int16_t expected = static_cast<int16_t>(migration.from);
+        if (entities_peer_slot[migration.entity].compare_exchange_strong(expected,
+                                                                         static_cast<int16_t>(migration.to),
+                                                                         std::memory_order_acq_rel)) {
+            slots[migration.from]->delete_entity();
+            slots[migration.to]->add_entity();
+            if (migrations_count) {
+                migrations_count->Increment();
+            }
+        }
+    }
+
+    for (size_t i = 0; i < slots_cpu_time.size(); ++i) {
+        slots_cpu_time[i]->Increment(static_cast<double>(slots_time[i]) / 1e9);
+    }
+}
+
 void ExecutorWorkGroup::MakeMetrics(const std::string &executor_name, const std::shared_ptr<Mon::IMetricer> &m) {
     metricer = m;
     if (metricer) {
@@ -80,6 +239,93 @@ void ExecutorWorkGroup::MakeMetrics(const std::string &executor_name, const std:
                     {"group",    name},
                     {"slot",     std::to_string(slot->id)},
             });
+
+            slot->m_steals_count = metricer->MakeCounter("ar_steals_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+
+            slot->m_stolen_tasks_count = metricer->MakeCounter("ar_stolen_tasks_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+
+            slot->m_group_steals_count = metricer->MakeCounter("ar_group_steals_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+
+            slot->m_numa_steals_count = metricer->MakeCounter("ar_numa_steals_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+
+            slot->m_parks_count = metricer->MakeCounter("ar_parks_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+
+            slot->m_unparks_count = metricer->MakeCounter("ar_unparks_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+
+            slot->m_run_next_count = metricer->MakeCounter("ar_run_next_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+
+            slot->m_activations_count = metricer->MakeCounter("ar_worker_activations_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+
+            slot->m_deactivations_count = metricer->MakeCounter("ar_worker_deactivations_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+                    {"slot",     std::to_string(slot->id)},
+            });
+        }
+
+        if (balancing) {
+            std::lock_guard<std::mutex> lock(rebalance_mutex);
+            migrations_count = metricer->MakeCounter("ar_entity_migrations_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+            });
+
+            for (auto *slot: slots) {
+                slots_cpu_time.push_back(metricer->MakeCounter("ar_slot_cpu_time", {
+                        {"executor", executor_name},
+                        {"group",    name},
+                        {"slot",     std::to_string(slot->id)},
+                }));
+            }
+        }
+
+        if (quota) {
+            quota_cpu_time = metricer->MakeCounter("ar_quota_cpu_time", {
+                    {"executor", executor_name},
+                    {"group",    name},
+            });
+
+            quota_throttled_periods = metricer->MakeCounter("ar_quota_throttled_periods_count", {
+                    {"executor", executor_name},
+                    {"group",    name},
+            });
+
+            quota_throttled_time = metricer->MakeCounter("ar_quota_throttled_time", {
+                    {"executor", executor_name},
+                    {"group",    name},
+            });
         }
 
         workers_count->Increment(cpus_peer_slot.size());
@@ -87,19 +333,54 @@ void ExecutorWorkGroup::MakeMetrics(const std::string &executor_name, const std:
     }
 }
 
+void ExecutorWorkGroup::AddEntity(uint16_t id) {
+    AssignEntity(id);
+}
+
 void ExecutorWorkGroup::DeleteEntity(uint16_t id) {
-    std::lock_guard<std::mutex> lock(mutex);
-    auto slot_it = entities_peer_slot.find(id);
-    if (slot_it != entities_peer_slot.end()) {
-        slots[slot_it->second]->delete_entity();
-        entities_peer_slot.erase(slot_it);
+    int slot_id = entities_peer_slot[id].exchange(-1, std::memory_order_acq_rel);
+    if (slot_id >= 0) {
+        slots[slot_id]->delete_entity();
     }
 }
 
+int ExecutorWorkGroup::AssignEntity(uint16_t id) {
+    int slot_id = entities_peer_slot[id].load(std::memory_order_acquire);
+    if (slot_id >= 0) {
+        return slot_id;
+    }
+
+    auto free_slot_it = min_element(slots.begin(), slots.end(),
+                                    [](ExecutorSlot *l, ExecutorSlot *r) -> bool {
+                                        return l->get_util() < r->get_util();
+                                    });
+    auto *free_slot = *free_slot_it;
+    int16_t expected = -1;
+    if (entities_peer_slot[id].compare_exchange_strong(expected, static_cast<int16_t>(free_slot->get_id()),
+                                                       std::memory_order_acq_rel)) {
+        free_slot->add_entity();
+        return free_slot->get_id();
+    }
+    // assigned concurrently by another thread
+    return expected;
+}
+
 void ExecutorWorkGroup::Post(task *task) {
     task->set_execution_state_wg(id);
     if (task->get_delay() <= 0) {
         const auto& state = task->get_execution_state();
+        // tagged tasks follow their entity, the slot keeps the worker affinity if the processor is its own
+        if (state.tag != INVALID_OBJECT_ID) {
+            uint16_t id, entity;
+            Numbers::Unpack(state.tag, id, entity);
+            int slot_id = entities_peer_slot[entity].load(std::memory_order_acquire);
+            if (slot_id < 0) {
+                slot_id = AssignEntity(entity);
+            }
+            slots[slot_id]->post(task);
+            return;
+        }
+
         if (state.processor != INVALID_OBJECT_ID) {
             auto slot_it = cpus_peer_slot.find(state.processor);
             if (slot_it != cpus_peer_slot.end()) {
@@ -108,44 +389,45 @@ void ExecutorWorkGroup::Post(task *task) {
             }
         }
 
-        {
-            if (state.tag != INVALID_OBJECT_ID) {
-                std::lock_guard<std::mutex> lock(mutex);
-                uint16_t id, entity;
-                Numbers::Unpack(state.tag, id, entity);
-                auto slot_it = entities_peer_slot.find(entity);
-                if (slot_it == entities_peer_slot.end()) {
-                    auto free_slot_it = min_element(slots.begin(), slots.end(),
-                                                    [](ExecutorSlot *l, ExecutorSlot *r) -> bool {
-                                                        return l->get_util() < r->get_util();
-                                                    });
-                    auto *free_slot = *free_slot_it;
-                    free_slot->add_entity();
-                    entities_peer_slot[entity] = free_slot->get_id();
-                    free_slot->post(task);
-                } else {
-                    slots[slot_it->second]->post(task);
-                }
-            } else {
-                slots[0]->post(task);
-            }
-        }
+        slots[0]->post(task);
     } else {
         scheduler->Post(task);
     }
 }
 
+void ExecutorWorkGroup::PostBatch(task **tasks, size_t n) {
+    // tasks without a tag, processor or delay go to the slot inbox in one push, the others one by one
+    size_t plain = 0;
+    for (size_t i = 0; i < n; ++i) {
+        task *t = tasks[i];
+        const auto& state = t->get_execution_state();
+        if (t->get_delay() > 0 || state.tag != INVALID_OBJECT_ID || state.processor != INVALID_OBJECT_ID) {
+            Post(t);
+        } else {
+            t->set_execution_state_wg(id);
+            tasks[plain++] = t;
+        }
+    }
+
+    slots[0]->post_batch(tasks, plain);
+}
+
 Executor::Executor(const std::string &name_,
                    const std::vector<AsyncRuntime::CPU> &cpus,
                    const std::vector<WorkGroupOption> & work_groups_option)
                    : IExecutor(name_, kCPU_EXECUTOR)
-                   , entities_inc{0} {
+                   , entities_inc{0}
+                   , cpus(cpus)
+                   , cpu_workers(new std::atomic_int[cpus.size()]) {
 
     std::map<size_t, size_t> cpus_wg = {};
-    for (int i = 0; i < cpus.size(); ++i) { cpus_wg[i] = 0; }
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cpus_wg[i] = 0;
+        cpu_workers[i].store(0, std::memory_order_relaxed);
+    }
 
     for (int i = 0; i < work_groups_option.size(); ++i) {
-        auto group = new ExecutorWorkGroup(i, work_groups_option[i], cpus, cpus_wg);
+        auto group = new ExecutorWorkGroup(i, work_groups_option[i], cpus, cpus_wg, this);
         for(const auto *slot : group->GetSlots()) {
             auto slot_thread_ids = slot->get_thread_ids();
             for(auto thread_id : slot_thread_ids) {
@@ -156,15 +438,84 @@ Executor::Executor(const std::string &name_,
         groups.push_back(group);
     }
 
+    // the workers active from the start
+    for (const auto &it : cpus_wg) {
+        cpu_workers[it.first].fetch_add(static_cast<int>(it.second), std::memory_order_relaxed);
+    }
+
     main_group = groups[0];
 }
 
 Executor::~Executor() {
+    Stop();
     for (auto group : groups) {
         delete group;
     }
 }
 
+void Executor::Stop() {
+    for (auto group : groups) {
+        group->Stop();
+    }
+}
+
+void Executor::SetRemoteExecutors(const std::vector<Executor*> &executors) {
+    for (size_t i = 0; i < groups.size(); ++i) {
+        std::vector<ExecutorWorkGroup*> remote_groups;
+        for (auto *executor : executors) {
+            if (executor != this && i < executor->groups.size()) {
+                remote_groups.push_back(executor->groups[i]);
+            }
+        }
+        groups[i]->SetRemoteGroups(remote_groups);
+    }
+}
+
+namespace {
+    thread_local Executor *current_executor = nullptr;
+}
+
+Executor *Executor::Current() noexcept {
+    return current_executor;
+}
+
+void Executor::SetCurrent(Executor *executor) noexcept {
+    current_executor = executor;
+}
+
+CPU Executor::AcquireCpu(size_t llc_id) {
+    const size_t best = PickCpu(cpus, [this](size_t i) {
+        return static_cast<size_t>(std::max(0, cpu_workers[i].load(std::memory_order_relaxed)));
+    }, llc_id);
+    cpu_workers[best].fetch_add(1, std::memory_order_relaxed);
+    return cpus[best];
+}
+
+void Executor::ReleaseCpu(size_t cpu_id) {
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i].id == cpu_id) {
+            cpu_workers[i].fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+ObjectID Executor::CurrentWorkGroup() noexcept {
+    return ExecutorSlot::local_work_group();
+}
+
+size_t Executor::LocalQueueSize() noexcept {
+    return ExecutorSlot::local_queue_size();
+}
+
+bool Executor::PostLocal(task *task) {
+    return ExecutorSlot::local_post(task);
+}
+
+bool Executor::RunLocal(const std::function<bool(task *)> &accept) {
+    return ExecutorSlot::local_run(accept);
+}
+
 void Executor::MakeMetrics(const std::shared_ptr<Mon::IMetricer> &m) {
     metricer = m;
     if (metricer) {
@@ -179,7 +530,11 @@ uint16_t Executor::AddEntity(void *ptr) {
     int e = entities_inc.fetch_add(1, std::memory_order_relaxed);
     if (e >= 65500) {
         entities_inc.store(0, std::memory_order_relaxed);
-        return 0;
+        e = 0;
+    }
+    // assign the entity to a slot of every group now, so posts only read the routing table
+    for (auto group : groups) {
+        group->AddEntity(e);
     }
     return e;
 }
@@ -205,5 +560,22 @@ void Executor::Post(task *task) {
     }
 }
 
+void Executor::PostBatch(task **tasks, size_t n) {
+    // consecutive tasks of the same work group are posted together
+    size_t begin = 0;
+    while (begin < n) {
+        int64_t work_group = tasks[begin]->get_execution_state().work_group;
+        size_t end = begin;
+        for (; end < n && tasks[end]->get_execution_state().work_group == work_group; ++end) {
+            auto execute_state = tasks[end]->get_execution_state();
+            execute_state.executor = this;
+            tasks[end]->set_execution_state(execute_state);
+        }
+
+        auto *group = (work_group != INVALID_OBJECT_ID) ? groups[work_group] : main_group;
+        group->PostBatch(tasks + begin, end - begin);
+        begin = end;
+    }
+}
 
 
@@ -1,32 +1,98 @@
 #include "executor_slot.h"
+#include "ar/executor.hpp"
 #include "numbers.h"
-
-#define MAX_STEALS 24
+#include "config.hpp"
+
+#if defined(MEASURE_CPU_TIME)
+#include <boost/chrono/thread_clock.hpp>
+#endif
+
+// default spin budget of an idle worker, in explore rounds
+#define MIN_SPIN 4
+#define MAX_SPIN 64
+// max cpu pauses between two explore rounds
+#define MAX_SPIN_BACKOFF 64
+// a worker woken up sooner than this after parking spins longer next time
+#define SHORT_PARK_US 100
+// every PRIORITY_AGING_PERIOD pop serves the lowest non empty priority first,
+// so LOW tasks get at least this share of a busy worker and can't starve
+#define PRIORITY_AGING_PERIOD 16
+// max tasks in a row a worker takes from its next task slot before serving the queues,
+// a ping-pong pair of coroutines would keep the slot busy forever
+#define MAX_NEXT_STREAK 16
+// a busy worker checks the timers of its work group every TIMER_POLL_PERIOD loops
+#define TIMER_POLL_PERIOD 16
 
 using namespace AsyncRuntime;
 
+namespace {
+    thread_local Worker *current_worker = nullptr;
+
+    inline uint64_t steady_now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+}
+
 ExecutorSlot::ExecutorSlot(ObjectID _id,
                            const std::string &name,
-                           const std::vector<AsyncRuntime::CPU> &cpus)
+                           const std::vector<AsyncRuntime::CPU> &cpus,
+                           ExecutorWorkGroup *group,
+                           size_t active_workers)
         : id(_id)
         , name(name)
+        , group(group)
         , workers{cpus.size()}
         , threads{cpus.size()}
         , notifier{cpus.size()}
+        , min_spin(MIN_SPIN)
+        , max_spin(MAX_SPIN)
 {
+    if (group != nullptr) {
+        if (group->GetMaxSpin() > 0) {
+            max_spin = group->GetMaxSpin();
+        }
+        if (group->GetMinSpin() > 0) {
+            min_spin = group->GetMinSpin();
+        }
+    }
+    min_spin = std::min(min_spin, max_spin);
+
+    active_workers = (active_workers > 0) ? std::min(active_workers, cpus.size()) : cpus.size();
+    elastic = group != nullptr && (active_workers < cpus.size() || group->GetWorkerIdleMs() > 0);
+    active_count.store(active_workers, std::memory_order_relaxed);
+    llc_id = cpus.empty() ? 0 : cpus.front().llc_id;
+    for (size_t i = active_workers; i < cpus.size(); ++i) {
+        workers[i].active.store(false, std::memory_order_relaxed);
+    }
+
     spawn(cpus);
 }
 
 ExecutorSlot::~ExecutorSlot() {
+    stop();
+}
+
+void ExecutorSlot::stop() {
     done = true;
 
     notifier.notify(true);
+    for (auto &w : workers) {
+        std::lock_guard<std::mutex> lock(w.scale_mutex);
+        w.scale_cv.notify_one();
+    }
 
     for(auto& t : threads){
-        t.join();
+        if (t.joinable()) {
+            t.join();
+        }
     }
 }
 
+bool ExecutorSlot::notify_idle() {
+    return notifier.notify(false) != nullptr;
+}
+
 inline size_t ExecutorSlot::num_workers() const noexcept {
     return workers.size();
 }
@@ -37,13 +103,18 @@ void ExecutorSlot::spawn(const std::vector<AsyncRuntime::CPU> &cpus) {
     size_t n=0;
     for (size_t id=0; id<cpus.size(); ++id) {
         workers[id].id = id;
-        workers[id].cpu_id = cpus[id].id;
+        workers[id].cpu_id.store(cpus[id].id, std::memory_order_relaxed);
         workers[id].vtm = id;
         workers[id].executor = this;
         workers[id].waiter = &notifier._waiters[id];
+        workers[id].spin_budget = max_spin;
 
         threads[id] = std::thread([&, &w=workers[id]] () {
             w.thread = &threads[w.id];
+            current_worker = &w;
+            if (group != nullptr) {
+                Executor::SetCurrent(group->GetExecutor());
+            }
             {
                 std::scoped_lock lock(mutex);
                 wids[std::this_thread::get_id()] = w.id;
@@ -55,6 +126,19 @@ void ExecutorSlot::spawn(const std::vector<AsyncRuntime::CPU> &cpus) {
             task* t = nullptr;
 
             while(!done) {
+                if (!w.active.load(std::memory_order_acquire)) {
+                    sleep_inactive(w);
+                    continue;
+                }
+
+                if (w.throttled_until != 0 && throttle(w)) {
+                    continue;
+                }
+
+                if (++w.loops % TIMER_POLL_PERIOD == 0) {
+                    expire_timers();
+                }
+
                 exploit_task(w, t);
 
                 if(!t) {
@@ -67,13 +151,20 @@ void ExecutorSlot::spawn(const std::vector<AsyncRuntime::CPU> &cpus) {
                 }
 
                 if(t) {
+                    if (elastic && w.loops % TIMER_POLL_PERIOD == 0) {
+                        check_load(w, t);
+                    }
                     w.execute.store(true, std::memory_order_relaxed);
                     invoke(w, t);
                     delete t;
                     t = nullptr;
                 } else {
                     w.execute.store(false, std::memory_order_relaxed);
-                    notifier.commit_wait(w.waiter);
+                    if (expire_timers()) {
+                        notifier.cancel_wait(w.waiter);
+                        continue;
+                    }
+                    park(w);
                 }
             }
         });
@@ -85,58 +176,405 @@ void ExecutorSlot::spawn(const std::vector<AsyncRuntime::CPU> &cpus) {
     cond.wait(lock, [&](){ return n==cpus.size(); });
 }
 
+size_t ExecutorSlot::fetch_inbox(Worker& w, TaskInbox& from) {
+    size_t n = 0;
+    for (task *t = from.drain(); t != nullptr; ++n) {
+        task *next = TaskInbox::next(t);
+        w.wsq.push(t, static_cast<unsigned>(t->get_priority()));
+        t = next;
+    }
+    return n;
+}
+
+task* ExecutorSlot::pop_task(Worker& w) {
+    if (++w.pops % PRIORITY_AGING_PERIOD == 0) {
+        for (unsigned p = static_cast<unsigned>(TaskPriority::MAX); p-- > 0;) {
+            if (auto t = w.wsq.pop(p); t) {
+                return t;
+            }
+        }
+        return nullptr;
+    }
+    return w.wsq.pop();
+}
+
 void ExecutorSlot::exploit_task(Worker& w, task*& t) {
-    {
-        std::lock_guard<std::mutex> lock(w.wsq_mutex);
-        t = w.wsq.pop();
+    if (w.next_task != nullptr && w.next_streak < MAX_NEXT_STREAK) {
+        t = w.next_task;
+        w.next_task = nullptr;
+        ++w.next_streak;
+        return;
     }
+    w.next_streak = 0;
+
+    fetch_inbox(w, w.inbox);
 
+    t = pop_task(w);
     if (t) {
         return;
     }
 
-    t = wsq.steal();
-    if (t) {
+    if (w.next_task != nullptr) {
+        t = w.next_task;
+        w.next_task = nullptr;
         return;
     }
 
-    for (auto &other_w: workers) {
-        if (w.id != other_w.id && other_w.execute.load()) {
-            t = other_w.wsq.steal();
-            if (t) {
-                return;
+    if (fetch_inbox(w, inbox) > 0) {
+        t = pop_task(w);
+        if (t) {
+            return;
+        }
+    }
+
+    if (steal_task(w) || steal_group_task(w)) {
+        t = pop_task(w);
+    }
+}
+
+bool ExecutorSlot::steal_task(Worker& w) {
+    const size_t n = num_workers();
+    if (n < 2) {
+        return false;
+    }
+
+    // start from a random victim, so the first workers don't become a steal hotspot
+    std::uniform_int_distribution<size_t> dist(0, n - 1);
+    size_t victim_id = dist(w.rdgen);
+    for (size_t i = 0; i < n; ++i, ++victim_id) {
+        if (victim_id >= n) {
+            victim_id = 0;
+        }
+
+        auto &victim = workers[victim_id];
+        if (victim.id == w.id || victim.wsq.empty()) {
+            continue;
+        }
+
+        size_t stolen = victim.wsq.steal_half(w.wsq);
+        if (stolen > 0) {
+            if (m_steals_count) {
+                m_steals_count->Increment();
+                m_stolen_tasks_count->Increment(static_cast<double>(stolen));
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ExecutorSlot::steal_group_task(Worker& w) {
+    if (group == nullptr || !group->IsReady()) {
+        return false;
+    }
+
+    // sibling slots of the work group
+    const auto &siblings = group->GetSlots();
+    if (siblings.size() > 1) {
+        std::uniform_int_distribution<size_t> dist(0, siblings.size() - 1);
+        size_t start = dist(w.rdgen);
+        for (size_t i = 0; i < siblings.size(); ++i) {
+            auto *sibling = siblings[(start + i) % siblings.size()];
+            if (sibling == this) {
+                continue;
+            }
+
+            size_t stolen = sibling->lend(w, 1, true);
+            if (stolen > 0) {
+                if (m_group_steals_count) {
+                    m_group_steals_count->Increment();
+                    m_stolen_tasks_count->Increment(static_cast<double>(stolen));
+                }
+                return true;
+            }
+        }
+    }
+
+    // the same work group of the executors on the other numa nodes
+    size_t threshold = group->GetNumaStealThreshold();
+    if (threshold > 0 && group->HasRemoteGroups()) {
+        for (auto *remote_group : group->GetRemoteGroups()) {
+            for (auto *remote_slot : remote_group->GetSlots()) {
+                size_t stolen = remote_slot->lend(w, threshold, false);
+                if (stolen > 0) {
+                    if (m_numa_steals_count) {
+                        m_numa_steals_count->Increment();
+                        m_stolen_tasks_count->Increment(static_cast<double>(stolen));
+                    }
+                    return true;
+                }
             }
         }
     }
+
+    return false;
+}
+
+size_t ExecutorSlot::lend(Worker& thief, size_t threshold, bool with_inbox) {
+    if (done.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+
+    if (with_inbox && !inbox.empty()) {
+        size_t n = fetch_inbox(thief, inbox);
+        if (n > 0) {
+            return n;
+        }
+    }
+
+    const size_t n = num_workers();
+    std::uniform_int_distribution<size_t> dist(0, n - 1);
+    size_t start = dist(thief.rdgen);
+    for (size_t i = 0; i < n; ++i) {
+        auto &victim = workers[(start + i) % n];
+        if (victim.wsq.size() < threshold) {
+            continue;
+        }
+
+        size_t stolen = victim.wsq.steal_half(thief.wsq);
+        if (stolen > 0) {
+            return stolen;
+        }
+    }
+    return 0;
 }
 
 bool ExecutorSlot::explore_task(Worker& w, task*& t) {
-    for(int i = 0; i < MAX_STEALS; ++i) {
+    size_t backoff = 1;
+    for(size_t i = 0; i < w.spin_budget; ++i) {
+        if (done.load(std::memory_order_relaxed)) {
+            return true;
+        }
 
-        if (!w.wsq.empty()) {
+        if (!w.wsq.empty() || !w.inbox.empty()) {
             return true;
         }
 
-        if (!wsq.empty()) {
+        if (!inbox.empty()) {
             return true;
         }
 
         for (auto &other_w: workers) {
-            if (w.id != other_w.id && other_w.execute.load()) {
-                if (!other_w.wsq.empty()) {
-                    return true;
-                }
+            if (w.id != other_w.id && !other_w.wsq.empty()) {
+                return true;
             }
         }
+
+        for (size_t k = 0; k < backoff; ++k) {
+            relax_cpu();
+        }
+        backoff = std::min<size_t>(backoff * 2, MAX_SPIN_BACKOFF);
     }
 
     std::this_thread::yield();
     return false;
 }
 
+bool ExecutorSlot::expire_timers() {
+    if (group == nullptr) {
+        return false;
+    }
+
+    auto *scheduler = group->GetScheduler();
+    const Timespan deadline = scheduler->GetNextDeadline();
+    if (deadline == INT64_MAX) {
+        return false;
+    }
+
+    const Timespan now = TIMESTAMP_NOW_MICRO();
+    return now >= deadline && scheduler->Advance(now) > 0;
+}
+
+void ExecutorSlot::park(Worker& w) {
+    if (m_parks_count) {
+        m_parks_count->Increment();
+    }
+
+    // don't hold the freed tasks of other workers while sleeping
+    task_pool::flush();
+
+    // one parked worker of the group sleeps until the next timer, the others until they are notified
+    Scheduler *scheduler = group != nullptr ? group->GetScheduler() : nullptr;
+    Timespan deadline = scheduler != nullptr ? scheduler->GetNextDeadline() : INT64_MAX;
+    bool keeper = deadline != INT64_MAX && scheduler->Keep(deadline);
+
+    auto start = std::chrono::steady_clock::now();
+    if (keeper) {
+        const Timespan timeout = std::max<Timespan>(deadline - TIMESTAMP_NOW_MICRO(), 0);
+        notifier.commit_wait_for(w.waiter, std::chrono::microseconds(timeout));
+        scheduler->Unkeep(deadline);
+    } else if (elastic && group->GetWorkerIdleMs() > 0 && active_count.load(std::memory_order_relaxed) > 1) {
+        if (!notifier.commit_wait_for(w.waiter, std::chrono::milliseconds(group->GetWorkerIdleMs()))) {
+            deactivate(w);
+        }
+    } else {
+        notifier.commit_wait(w.waiter);
+    }
+    auto parked = std::chrono::steady_clock::now() - start;
+
+    if (m_unparks_count) {
+        m_unparks_count->Increment();
+    }
+
+    // woken up right after parking: a longer spin would have caught the task without sleeping,
+    // a long sleep means the work comes rarely and spinning only burns the cpu
+    if (parked < std::chrono::microseconds(SHORT_PARK_US)) {
+        w.spin_budget = std::min(std::max<size_t>(w.spin_budget * 2, 1), max_spin);
+    } else {
+        w.spin_budget = std::max(w.spin_budget / 2, min_spin);
+    }
+}
+
+bool ExecutorSlot::throttle(Worker& w) {
+    const uint64_t now = steady_now_ns();
+    w.throttled_until = group->ChargeQuota(0, now);
+    if (w.throttled_until == 0) {
+        return false;
+    }
+
+    // the timers keep their time, their tasks wait in the queues as the posted ones do
+    expire_timers();
+
+    // a throttled worker sleeps off the notifier, the posts into its group don't wake it up for nothing
+    uint64_t timeout = w.throttled_until > now ? w.throttled_until - now : 0;
+    const Timespan deadline = group->GetScheduler()->GetNextDeadline();
+    if (deadline != INT64_MAX) {
+        const Timespan timer = std::max<Timespan>(deadline - TIMESTAMP_NOW_MICRO(), 0);
+        timeout = std::min(timeout, static_cast<uint64_t>(timer) * 1000);
+    }
+    {
+        std::unique_lock<std::mutex> lock(w.scale_mutex);
+        w.scale_cv.wait_for(lock, std::chrono::nanoseconds(timeout), [this] { return done.load(); });
+    }
+    group->AccountThrottled(steady_now_ns() - now);
+    return true;
+}
+
+void ExecutorSlot::check_load(Worker& w, task* t) {
+    // a parked worker is woken up by the posts, a new one is only for a slot without idle workers
+    if (active_count.load(std::memory_order_relaxed) >= workers.size() || notifier.has_waiters()) {
+        return;
+    }
+
+    if (w.wsq.size() >= group->GetScaleQueueSize() ||
+        TIMESTAMP_NOW_MICRO() - t->get_deadline() >= group->GetScaleDelay()) {
+        activate(nullptr);
+    }
+}
+
+bool ExecutorSlot::activate(Worker* w) {
+    {
+        std::lock_guard<std::mutex> lock(scale_mutex);
+        if (w == nullptr) {
+            for (auto &other : workers) {
+                if (!other.active.load(std::memory_order_relaxed)) {
+                    w = &other;
+                    break;
+                }
+            }
+            if (w == nullptr) {
+                return false;
+            }
+        } else if (w->active.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        // the least loaded cpu of the executor at the moment, in the cache domain of the slot if possible
+        Executor *executor = group->GetExecutor();
+        if (executor != nullptr) {
+            const CPU cpu = executor->AcquireCpu(llc_id);
+            w->cpu_id.store(cpu.id, std::memory_order_relaxed);
+            AsyncRuntime::SetAffinity(threads[w->id], cpu);
+        }
+
+        {
+            std::lock_guard<std::mutex> worker_lock(w->scale_mutex);
+            w->active.store(true, std::memory_order_release);
+        }
+        active_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    w->scale_cv.notify_one();
+
+    if (m_activations_count) {
+        m_activations_count->Increment();
+    }
+    return true;
+}
+
+bool ExecutorSlot::deactivate(Worker& w) {
+    {
+        std::lock_guard<std::mutex> lock(scale_mutex);
+        if (active_count.load(std::memory_order_relaxed) <= 1) {
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> worker_lock(w.scale_mutex);
+            w.active.store(false, std::memory_order_relaxed);
+        }
+        active_count.fetch_sub(1, std::memory_order_relaxed);
+
+        Executor *executor = group->GetExecutor();
+        if (executor != nullptr) {
+            executor->ReleaseCpu(w.cpu_id.load(std::memory_order_relaxed));
+        }
+    }
+
+    if (m_deactivations_count) {
+        m_deactivations_count->Increment();
+    }
+
+    // a post could choose the inbox of the worker right before; it checks the flag after its push
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!w.inbox.empty()) {
+        activate(&w);
+    }
+    return true;
+}
+
+void ExecutorSlot::sleep_inactive(Worker& w) {
+    std::unique_lock<std::mutex> lock(w.scale_mutex);
+    w.scale_cv.wait(lock, [this, &w] { return done.load() || w.active.load(std::memory_order_relaxed); });
+}
+
 void ExecutorSlot::invoke(Worker& w, task* t) {
+    if (t->is_cancelled()) {
+        t->cancel();
+        return;
+    }
+
     task::execution_state new_state = t->get_execution_state();
-    new_state.processor = w.cpu_id;
+    new_state.processor = w.cpu_id.load(std::memory_order_relaxed);
+
+    const bool quota = group != nullptr && group->HasQuota();
+#if defined(MEASURE_CPU_TIME)
+    const bool balance = group != nullptr && group->IsBalancing() && new_state.tag != INVALID_OBJECT_ID;
+    if (balance || quota) {
+        using namespace boost::chrono;
+        const auto start = thread_clock::now();
+        t->execute(new_state);
+        const auto end = thread_clock::now();
+        const uint64_t cpu_time = end > start ? duration_cast<nanoseconds>(end - start).count() : 0;
+        if (balance && cpu_time > 0) {
+            uint16_t executor_id, entity;
+            Numbers::Unpack(new_state.tag, executor_id, entity);
+            group->AccountEntity(entity, cpu_time);
+        }
+        if (quota) {
+            w.throttled_until = group->ChargeQuota(cpu_time, steady_now_ns());
+        }
+        return;
+    }
+#else
+    if (quota) {
+        // without a thread clock the wall time of the task stands for its cpu time
+        const uint64_t start = steady_now_ns();
+        t->execute(new_state);
+        const uint64_t end = steady_now_ns();
+        w.throttled_until = group->ChargeQuota(end - start, end);
+        return;
+    }
+#endif
 
     t->execute(new_state);
 //    if (m_executed_tasks_count) {
@@ -172,30 +610,131 @@ std::vector<std::thread::id> ExecutorSlot::get_thread_ids() const {
     return std::move(ids);
 }
 
+bool ExecutorSlot::run_next(task *t) {
+    // only a worker waking up a task affine to itself, it runs the task after the current one without queues and wakeups
+    Worker *w = current_worker;
+    if (w == nullptr || w->executor != this || static_cast<int64_t>(w->cpu_id.load(std::memory_order_relaxed)) != t->get_execution_state().processor) {
+        return false;
+    }
+
+    if (w->next_task != nullptr) {
+        // the latest wakeup runs first, the previous one goes to the deque where it can be stolen
+        w->wsq.push(w->next_task, static_cast<unsigned>(w->next_task->get_priority()));
+    }
+    w->next_task = t;
+
+    if (m_run_next_count) {
+        m_run_next_count->Increment();
+    }
+    return true;
+}
+
+ObjectID ExecutorSlot::local_work_group() noexcept {
+    Worker *w = current_worker;
+    if (w == nullptr || w->executor->group == nullptr) {
+        return INVALID_OBJECT_ID;
+    }
+    return w->executor->group->GetId();
+}
+
+size_t ExecutorSlot::local_queue_size() noexcept {
+    Worker *w = current_worker;
+    return (w != nullptr) ? w->wsq.size() : 0;
+}
+
+bool ExecutorSlot::local_post(task *task) {
+    Worker *w = current_worker;
+    if (w == nullptr) {
+        return false;
+    }
+
+    auto *slot = w->executor;
+    if (slot->group != nullptr) {
+        auto state = task->get_execution_state();
+        state.work_group = slot->group->GetId();
+        state.executor = slot->group->GetExecutor();
+        task->set_execution_state(state);
+    }
+
+    w->wsq.push(task, static_cast<unsigned>(task->get_priority()));
+    slot->notifier.notify(false);
+    return true;
+}
+
+bool ExecutorSlot::local_run(const std::function<bool(task *)> &accept) {
+    Worker *w = current_worker;
+    if (w == nullptr) {
+        return false;
+    }
+
+    // no other tasks on the caller's stack: they would nest without bound, they run once the caller is back
+    task *t = w->wsq.pop();
+    while (t != nullptr && !accept(t)) {
+        w->inbox.push(t);
+        t = w->wsq.pop();
+    }
+    if (t == nullptr) {
+        return false;
+    }
+
+    w->executor->invoke(*w, t);
+    delete t;
+    return true;
+}
+
 void ExecutorSlot::post(task *task) {
 //    if (m_posted_tasks_count) {
 //        m_posted_tasks_count->Increment();
 //    }
     auto &state = task->get_execution_state();
     if (state.processor != INVALID_OBJECT_ID) {
+        if (run_next(task)) {
+            return;
+        }
+
         for (auto &w : workers) {
-            if (w.cpu_id == state.processor) {
-                std::lock_guard<std::mutex> lock(w.wsq_mutex);
-                w.wsq.push(task, 0);
+            if (static_cast<int64_t>(w.cpu_id.load(std::memory_order_relaxed)) == state.processor && w.active.load(std::memory_order_acquire)) {
+                w.inbox.push(task);
                 notifier.notify_waiter(w.waiter);
+                // deactivated meanwhile, the task doesn't wait for the next activation
+                if (elastic) {
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!w.active.load(std::memory_order_relaxed)) {
+                        activate(&w);
+                    }
+                }
                 return;
             }
         }
+    }
 
-        {
-            std::lock_guard<std::mutex> lock(wsq_mutex);
-            wsq.push(task, 0);
-            notifier.notify(false);
-        }
-    } else {
-        std::lock_guard<std::mutex> lock(wsq_mutex);
-        wsq.push(task, 0);
-        notifier.notify(false);
+    bool was_empty = inbox.push(task);
+    notifier.notify(false);
+
+    // tasks are piling up in the slot inbox: wake an idle worker of a sibling slot to steal them
+    if (!was_empty && group != nullptr) {
+        group->NotifyIdle(this);
     }
 }
 
+
+void ExecutorSlot::post_batch(task **tasks, size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    // one chain, one push: drain() gives the tasks back in the batch order
+    task *first = tasks[0];
+    TaskInbox::link(first, nullptr);
+    for (size_t i = 1; i < n; ++i) {
+        TaskInbox::link(tasks[i], first);
+        first = tasks[i];
+    }
+
+    bool was_empty = inbox.push(first, tasks[0]);
+    notifier.notify_n(n);
+
+    if ((!was_empty || n > num_workers()) && group != nullptr) {
+        group->NotifyIdle(this);
+    }
+}
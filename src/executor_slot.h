@@ -4,6 +4,7 @@
 #include <iostream>
 #include <map>
 #include <atomic>
+#include <functional>
 #include "ar/object.hpp"
 #include "ar/task.hpp"
 #include "ar/work_steal_queue.hpp"
@@ -11,6 +12,7 @@
 #include "ar/scheduler.hpp"
 #include "ar/metricer.hpp"
 #include "work_notifier.h"
+#include "task_inbox.h"
 #include "ar/task_queue.hpp"
 
 namespace AsyncRuntime {
@@ -22,7 +24,9 @@ namespace AsyncRuntime {
     public:
         inline size_t get_id() const { return id; }
 
-        inline size_t get_cpu_id() const { return cpu_id; }
+        inline size_t get_cpu_id() const { return cpu_id.load(std::memory_order_relaxed); }
+
+        inline bool is_active() const { return active.load(std::memory_order_relaxed); }
 
         inline std::thread* get_thread() const { return thread; }
 
@@ -31,25 +35,48 @@ namespace AsyncRuntime {
         inline size_t get_queue_capacity() const { return static_cast<size_t>(wsq.capacity()); }
     private:
         size_t id;
-        size_t cpu_id;
+        // changes only while the worker is inactive
+        std::atomic_size_t cpu_id = {0};
         size_t vtm;
         std::atomic_bool execute = {false};
         ExecutorSlot* executor;
         std::thread* thread;
         WorkNotifier::Waiter* waiter;
+        size_t pops = 0;
+        size_t loops = 0;
+        size_t spin_budget = 0;
+        // woken up task to run right after the current one, touched only by the worker thread
+        task* next_task = nullptr;
+        size_t next_streak = 0;
+        // the work group is over its cpu quota until this time, ns of the steady clock
+        uint64_t throttled_until = 0;
+        // an inactive worker of an elastic slot sleeps out of the notifier until it is activated, a throttled one until its quota is back
+        std::atomic_bool active = {true};
+        std::mutex scale_mutex;
+        std::condition_variable scale_cv;
         std::default_random_engine rdgen { std::random_device{}() };
-        TaskQueue<task*, 1> wsq;
-        std::mutex       wsq_mutex;
+        TaskQueue<task*> wsq;
+        TaskInbox        inbox;
     };
 
     class ExecutorSlot {
         friend class ExecutorWorkGroup;
     public:
-        ExecutorSlot(ObjectID id, const std::string &name, const std::vector<AsyncRuntime::CPU> &cpus);
+        ExecutorSlot(ObjectID id,
+                     const std::string &name,
+                     const std::vector<AsyncRuntime::CPU> &cpus,
+                     ExecutorWorkGroup *group = nullptr,
+                     size_t active_workers = 0);
         ~ExecutorSlot();
 
         void post(task *task);
 
+        void post_batch(task **tasks, size_t n);
+
+        void stop();
+
+        bool notify_idle();
+
         [[nodiscard]] ObjectID get_id() const { return id; }
 
         void add_entity();
@@ -59,28 +86,85 @@ namespace AsyncRuntime {
         int get_util();
 
         std::vector<std::thread::id> get_thread_ids() const;
+
+        size_t get_active_workers() const { return active_count.load(std::memory_order_relaxed); }
+
+        const Worker &get_worker(size_t i) const { return workers[i]; }
+
+        size_t get_workers_count() const { return workers.size(); }
+
+        /**
+         * @brief work group of the calling worker, INVALID_OBJECT_ID for other threads
+         */
+        static ObjectID local_work_group() noexcept;
+
+        /**
+         * @brief size of the calling worker's queue, 0 for other threads
+         */
+        static size_t local_queue_size() noexcept;
+
+        /**
+         * @brief pushes the task to the calling worker's queue, siblings steal it from there
+         * @return false if the calling thread isn't a worker
+         */
+        static bool local_post(task *task);
+
+        /**
+         * @brief runs the task on top of the calling worker's queue if accept takes it, the others go to its inbox
+         * @return false if the calling thread isn't a worker or there is no task to take
+         */
+        static bool local_run(const std::function<bool(task *)> &accept);
     private:
         inline size_t num_workers() const noexcept;
 
         void spawn(const std::vector<AsyncRuntime::CPU> &cpus);
         void exploit_task(Worker& w, task*& t);
         bool explore_task(Worker& w, task*& t);
+        void park(Worker& w);
+        bool throttle(Worker& w);
+        void check_load(Worker& w, task* t);
+        bool activate(Worker* w);
+        bool deactivate(Worker& w);
+        void sleep_inactive(Worker& w);
+        bool expire_timers();
+        size_t fetch_inbox(Worker& w, TaskInbox& from);
+        bool run_next(task* t);
+        task* pop_task(Worker& w);
+        bool steal_task(Worker& w);
+        bool steal_group_task(Worker& w);
+        size_t lend(Worker& thief, size_t threshold, bool with_inbox);
 
         void invoke(Worker& w, task* t);
 
         ObjectID                        id;
         std::string                     name;
+        ExecutorWorkGroup               *group;
         std::vector<Worker>             workers;
         std::vector<std::thread>        threads;
-        TaskQueue<task*, 1>                wsq;
+        TaskInbox                       inbox;
         WorkNotifier                    notifier;
-        std::mutex                      wsq_mutex;
         std::unordered_map<std::thread::id, size_t> wids;
         std::atomic<bool> done = {false};
+        size_t                          min_spin;
+        size_t                          max_spin;
+        bool                            elastic = false;
+        // last level cache domain of the slot's cpus, activated workers go there if possible
+        size_t                          llc_id = 0;
+        std::atomic_size_t              active_count = {0};
+        std::mutex                      scale_mutex;
         std::atomic_int    entities_count = {0};
         std::shared_ptr<Mon::Counter>   m_entities_count;
         std::shared_ptr<Mon::Counter>   m_posted_tasks_count;
         std::shared_ptr<Mon::Counter>   m_executed_tasks_count;
+        std::shared_ptr<Mon::Counter>   m_steals_count;
+        std::shared_ptr<Mon::Counter>   m_stolen_tasks_count;
+        std::shared_ptr<Mon::Counter>   m_group_steals_count;
+        std::shared_ptr<Mon::Counter>   m_numa_steals_count;
+        std::shared_ptr<Mon::Counter>   m_parks_count;
+        std::shared_ptr<Mon::Counter>   m_unparks_count;
+        std::shared_ptr<Mon::Counter>   m_run_next_count;
+        std::shared_ptr<Mon::Counter>   m_activations_count;
+        std::shared_ptr<Mon::Counter>   m_deactivations_count;
     };
 }
 
@@ -0,0 +1,80 @@
+#include "ar/future.hpp"
+
+#include <mutex>
+#include <condition_variable>
+
+// number of mutex/condition pairs shared by all blocked waiters
+#define PARKING_LOT_SIZE 64
+
+using namespace AsyncRuntime;
+using namespace AsyncRuntime::detail;
+
+namespace {
+    struct parking_spot {
+        std::mutex                  mutex;
+        std::condition_variable     cv;
+    };
+
+    // never destroyed, futures can be waited during static destruction
+    parking_spot &parking_spot_of(const void *state) {
+        static auto *spots = new parking_spot[PARKING_LOT_SIZE];
+        return spots[(reinterpret_cast<uintptr_t>(state) >> 6) % PARKING_LOT_SIZE];
+    }
+}
+
+void future_state_base::satisfy() {
+    if (satisfied.exchange(true, std::memory_order_relaxed)) {
+        throw std::future_error(std::future_errc::promise_already_satisfied);
+    }
+}
+
+void future_state_base::mark_ready() noexcept {
+    // a waiter can drop the last reference to the state
+    add_ref();
+    uintptr_t prev = word.exchange(kReady, std::memory_order_acq_rel);
+
+    if (prev & kBlocked) {
+        auto &spot = parking_spot_of(this);
+        {
+            std::lock_guard<std::mutex> lock(spot.mutex);
+        }
+        spot.cv.notify_all();
+    }
+
+    auto *waiter = reinterpret_cast<future_waiter *>(prev & kWaitersMask);
+    while (waiter != nullptr) {
+        auto *next = waiter->next_waiter;
+        waiter->notify();
+        waiter = next;
+    }
+    release();
+}
+
+void future_state_base::wait() noexcept {
+    wait_until(std::chrono::steady_clock::time_point::max());
+}
+
+bool future_state_base::wait_until(std::chrono::steady_clock::time_point deadline) noexcept {
+    uintptr_t current = word.load(std::memory_order_acquire);
+    while (!(current & kBlocked)) {
+        if (current & kReady) {
+            return true;
+        }
+        if (word.compare_exchange_weak(current, current | kBlocked,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+            break;
+        }
+    }
+
+    auto &spot = parking_spot_of(this);
+    std::unique_lock<std::mutex> lock(spot.mutex);
+    while (!is_ready()) {
+        if (deadline == std::chrono::steady_clock::time_point::max()) {
+            spot.cv.wait(lock);
+        } else if (spot.cv.wait_until(lock, deadline) == std::cv_status::timeout) {
+            return is_ready();
+        }
+    }
+    return true;
+}
@@ -1,39 +1,468 @@
 #include "ar/resource_pool.hpp"
 #include "ar/runtime.hpp"
-#include <cmath>
+#include "ar/cpu_helper.hpp"
+#include "ar/metricer.hpp"
+#include <algorithm>
 
 using namespace AsyncRuntime;
 
-static int get_chunks_count(size_t size, size_t chunk_size) {
-    return (int)ceil((float)size / (float)chunk_size);
+// chunks a thread cache holds at most of the smallest class, larger classes hold fewer
+#define THREAD_CACHE_SIZE 64
+// the least chunks a thread cache holds of a class
+#define THREAD_CACHE_MIN_SIZE 4
+// size classes between two powers of two, as in jemalloc
+#define SIZE_CLASSES_PER_DOUBLING 4
+// allocations of more chunks are taken from the system one by one
+#define LARGE_OBJECT_CHUNKS 256
+// blocks of a class hold at least this many objects
+#define MIN_CLASS_BLOCK_OBJECTS 4
+
+namespace AsyncRuntime::detail {
+    struct pool_central;
+}
+
+// the pool growing on this thread and its node, the pool calls its allocator under its mutex
+static thread_local int growing_pool_node = -1;
+static thread_local detail::pool_central *growing_pool = nullptr;
+
+static size_t get_chunks_count(size_t size, size_t chunk_size) {
+    return std::max<size_t>(1, (size + chunk_size - 1) / chunk_size);
+}
+
+/**
+ * @brief size class of an allocation of n chunks: 1, 2, 3, 4 chunks, then 4 classes per power of two
+ */
+static size_t get_size_class(size_t n) {
+    if (n <= SIZE_CLASSES_PER_DOUBLING) {
+        return n - 1;
+    }
+    size_t log = 0;
+    for (size_t v = n - 1; v > 1; v >>= 1) {
+        ++log;
+    }
+    const size_t shift = log - 2;
+    return shift * SIZE_CLASSES_PER_DOUBLING + ((n - 1) >> shift);
+}
+
+namespace AsyncRuntime::detail {
+    /**
+     * @brief the shared part of a pool, thread caches keep it until their thread exits
+     */
+    struct pool_central {
+        pool_central(size_t chunk_sz, size_t nnext_size, size_t nmax_size) {
+            // the chunks of the largest allocation of every class
+            class_chunks.resize(get_size_class(LARGE_OBJECT_CHUNKS) + 1);
+            for (size_t n = 1; n <= LARGE_OBJECT_CHUNKS; ++n) {
+                class_chunks[get_size_class(n)] = n;
+            }
+            // larger objects are fewer: the first block of a class takes nnext_size / chunks bytes of chunks,
+            // the pool doubles it as the class grows
+            for (size_t chunks : class_chunks) {
+                const size_t objects = std::max<size_t>(MIN_CLASS_BLOCK_OBJECTS, nnext_size / (chunks * chunks));
+                const size_t max_objects = (nmax_size == 0) ? 0 : std::max<size_t>(MIN_CLASS_BLOCK_OBJECTS, nmax_size / chunks);
+                classes.emplace_back(new boost::pool<numa_user_allocator>(chunks * chunk_sz, objects, max_objects));
+            }
+        }
+
+        std::mutex                          mutex;
+        // the free lists of the size classes
+        std::vector<std::unique_ptr<boost::pool<numa_user_allocator>>> classes;
+        std::vector<size_t>                 class_chunks;
+        // false once the pool is deleted, its chunks in thread caches are dropped
+        bool                                alive = true;
+        std::vector<pool_thread_cache *>    caches;
+        // bytes of the blocks of the classes and of the large objects
+        std::atomic_int64_t                 reserved = {0};
+        // bytes asked for by live allocations out of caches and of exited caches
+        std::atomic_int64_t                 requested = {0};
+        // counters of allocations out of caches and of exited caches
+        std::atomic_size_t                  allocations = {0};
+        std::atomic_size_t                  remote_allocations = {0};
+        std::atomic_size_t                  hits = {0};
+        std::atomic_size_t                  refills = {0};
+        std::atomic_size_t                  flushes = {0};
+    };
+
+    /**
+     * @brief objects of one size class cached by a thread
+     */
+    struct pool_magazine {
+        std::unique_ptr<void *[]>   chunks;
+        size_t                      count = 0;
+        size_t                      capacity = 0;
+    };
+
+    /**
+     * @brief objects of a pool cached by one thread, the counters are written by the thread only
+     */
+    struct pool_thread_cache {
+        explicit pool_thread_cache(std::shared_ptr<pool_central> owner)
+            : owner(std::move(owner))
+            , magazines(this->owner->classes.size()) {
+        }
+
+        template<class T>
+        static void increment(std::atomic<T> &counter, T n = 1) {
+            counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        std::shared_ptr<pool_central>   owner;
+        std::vector<pool_magazine>      magazines;
+        // the thread runs on an other numa node than the pool's
+        bool                            remote = false;
+        size_t                          reported_allocations = 0;
+        size_t                          reported_remote_allocations = 0;
+        std::atomic_int64_t             requested = {0};
+        std::atomic_size_t              allocations = {0};
+        std::atomic_size_t              remote_allocations = {0};
+        std::atomic_size_t              hits = {0};
+        std::atomic_size_t              refills = {0};
+        std::atomic_size_t              flushes = {0};
+        std::atomic_size_t              cached = {0};
+    };
+
+    /**
+     * @brief caches of the pools used by a thread, given back when the thread exits
+     */
+    struct thread_caches {
+        ~thread_caches() {
+            exited = true;
+            for (auto *cache : caches) {
+                release(cache);
+            }
+        }
+
+        static void release(pool_thread_cache *cache) {
+            auto &owner = *cache->owner;
+            {
+                std::lock_guard<std::mutex> const lock(owner.mutex);
+                if (owner.alive) {
+                    for (size_t c = 0; c < cache->magazines.size(); ++c) {
+                        const auto &magazine = cache->magazines[c];
+                        for (size_t i = 0; i < magazine.count; ++i) {
+                            owner.classes[c]->free(magazine.chunks[i]);
+                        }
+                    }
+                }
+                owner.caches.erase(std::remove(owner.caches.begin(), owner.caches.end(), cache), owner.caches.end());
+                owner.requested.fetch_add(cache->requested.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                owner.allocations.fetch_add(cache->allocations.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                owner.remote_allocations.fetch_add(cache->remote_allocations.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                owner.hits.fetch_add(cache->hits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                owner.refills.fetch_add(cache->refills.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                owner.flushes.fetch_add(cache->flushes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            delete cache;
+        }
+
+        std::vector<pool_thread_cache *> caches;
+        // set once the caches of the thread are given back, later calls of its exit go to the shared pool
+        static thread_local bool exited;
+    };
+
+    thread_local bool thread_caches::exited = false;
+}
+
+static thread_local detail::thread_caches local_caches;
+
+char *numa_user_allocator::malloc(size_type bytes) {
+    auto *ptr = static_cast<char *>(NumaAlloc(bytes, growing_pool_node));
+    if (ptr != nullptr && growing_pool != nullptr) {
+        growing_pool->reserved.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+    }
+    return ptr;
 }
 
-resource_pool::resource_pool(size_t chunk_sz, size_t nnext_size, size_t nmax_size)
-    : pool(chunk_sz, nnext_size, nmax_size), chunk_size(chunk_sz) {
+void numa_user_allocator::free(char *block) {
+    NumaFree(block);
+}
+
+resource_pool::resource_pool(size_t chunk_sz, size_t nnext_size, size_t nmax_size, int numa_node)
+    : chunk_size(chunk_sz)
+    , central(std::make_shared<detail::pool_central>(chunk_sz, nnext_size, nmax_size))
+    , numa_node(numa_node) {
 }
 
 resource_pool::~resource_pool() {
-    pool.release_memory();
-    pool.purge_memory();
+    std::lock_guard<std::mutex> const lock(central->mutex);
+    central->alive = false;
+    for (auto &size_class : central->classes) {
+        size_class->purge_memory();
+    }
+}
+
+detail::pool_thread_cache *resource_pool::local_cache() const {
+    if (detail::thread_caches::exited) {
+        return nullptr;
+    }
+    auto &caches = local_caches.caches;
+    for (auto *cache : caches) {
+        if (cache->owner == central) {
+            return cache;
+        }
+    }
+
+    // caches of deleted pools are dropped on the way
+    for (auto it = caches.begin(); it != caches.end();) {
+        bool alive;
+        {
+            std::lock_guard<std::mutex> const lock((*it)->owner->mutex);
+            alive = (*it)->owner->alive;
+        }
+        if (!alive) {
+            detail::thread_caches::release(*it);
+            it = caches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    auto *cache = new detail::pool_thread_cache(central);
+    {
+        std::lock_guard<std::mutex> const lock(central->mutex);
+        central->caches.push_back(cache);
+    }
+    caches.push_back(cache);
+    return cache;
+}
+
+void resource_pool::refill(detail::pool_thread_cache &cache, size_t size_class) {
+    auto &magazine = cache.magazines[size_class];
+    if (!magazine.chunks) {
+        magazine.capacity = std::max<size_t>(THREAD_CACHE_MIN_SIZE, THREAD_CACHE_SIZE / central->class_chunks[size_class]);
+        magazine.chunks.reset(new void *[magazine.capacity]);
+    }
+
+    const int node = numa_node.load(std::memory_order_relaxed);
+    const size_t batch = magazine.capacity / 2;
+    size_t taken = 0;
+    {
+        std::lock_guard<std::mutex> const lock(central->mutex);
+        growing_pool_node = node;
+        growing_pool = central.get();
+        auto &size_class_pool = *central->classes[size_class];
+        while (magazine.count < batch) {
+            void *ptr = size_class_pool.malloc();
+            if (ptr == nullptr) {
+                break;
+            }
+            magazine.chunks[magazine.count++] = ptr;
+            ++taken;
+        }
+        growing_pool_node = -1;
+        growing_pool = nullptr;
+    }
+    detail::pool_thread_cache::increment<size_t>(cache.refills);
+    detail::pool_thread_cache::increment<size_t>(cache.cached, taken);
+
+    if (node >= 0) {
+        const auto *executor = Executor::Current();
+        cache.remote = executor != nullptr && executor->GetNumaNode() != node;
+    }
+    report(cache);
+}
+
+void resource_pool::flush(detail::pool_thread_cache &cache, size_t size_class) {
+    // the oldest objects go back, the recently freed ones are still warm
+    auto &magazine = cache.magazines[size_class];
+    const size_t batch = magazine.capacity / 2;
+    {
+        std::lock_guard<std::mutex> const lock(central->mutex);
+        auto &size_class_pool = *central->classes[size_class];
+        for (size_t i = 0; i < batch; ++i) {
+            size_class_pool.free(magazine.chunks[i]);
+        }
+    }
+    magazine.count -= batch;
+    std::copy(magazine.chunks.get() + batch, magazine.chunks.get() + batch + magazine.count, magazine.chunks.get());
+    detail::pool_thread_cache::increment<size_t>(cache.flushes);
+    cache.cached.store(cache.cached.load(std::memory_order_relaxed) - batch, std::memory_order_relaxed);
+    report(cache);
+}
+
+void resource_pool::report(detail::pool_thread_cache &cache) {
+    // metrics follow the caches a batch late
+    const size_t allocations = cache.allocations.load(std::memory_order_relaxed);
+    const size_t remote_allocations = cache.remote_allocations.load(std::memory_order_relaxed);
+    if (m_allocations_count && allocations > cache.reported_allocations) {
+        m_allocations_count->Increment(static_cast<double>(allocations - cache.reported_allocations));
+    }
+    if (m_remote_allocations_count && remote_allocations > cache.reported_remote_allocations) {
+        m_remote_allocations_count->Increment(static_cast<double>(remote_allocations - cache.reported_remote_allocations));
+    }
+    cache.reported_allocations = allocations;
+    cache.reported_remote_allocations = remote_allocations;
+}
+
+void resource_pool::account_shared(int node, int64_t size) {
+    central->requested.fetch_add(size, std::memory_order_relaxed);
+    if (size < 0 || node < 0) {
+        return;
+    }
+    central->allocations.fetch_add(1, std::memory_order_relaxed);
+    if (m_allocations_count) {
+        m_allocations_count->Increment();
+    }
+    const auto *executor = Executor::Current();
+    if (executor != nullptr && executor->GetNumaNode() != node) {
+        central->remote_allocations.fetch_add(1, std::memory_order_relaxed);
+        if (m_remote_allocations_count) {
+            m_remote_allocations_count->Increment();
+        }
+    }
 }
 
 void *resource_pool::allocate(size_t size) {
-    std::lock_guard<std::mutex> const lock(mutex);
-    auto *ptr = pool.ordered_malloc(get_chunks_count(size, chunk_size));
-    if (ptr == nullptr) {
-        throw std::bad_alloc();
+    const size_t chunks_count = get_chunks_count(size, chunk_size);
+    const int node = numa_node.load(std::memory_order_relaxed);
+
+    if (chunks_count > LARGE_OBJECT_CHUNKS) {
+        void *ptr = NumaAlloc(chunks_count * chunk_size, node);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        central->reserved.fetch_add(static_cast<int64_t>(chunks_count * chunk_size), std::memory_order_relaxed);
+        account_shared(node, static_cast<int64_t>(size));
+        return ptr;
     }
-    return ptr;
+
+    const size_t size_class = get_size_class(chunks_count);
+    auto *cache = local_cache();
+    if (cache == nullptr) {
+        std::lock_guard<std::mutex> const lock(central->mutex);
+        growing_pool_node = node;
+        growing_pool = central.get();
+        void *ptr = central->classes[size_class]->malloc();
+        growing_pool_node = -1;
+        growing_pool = nullptr;
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        account_shared(node, static_cast<int64_t>(size));
+        return ptr;
+    }
+
+    auto &magazine = cache->magazines[size_class];
+    if (magazine.count == 0) {
+        refill(*cache, size_class);
+        if (magazine.count == 0) {
+            throw std::bad_alloc();
+        }
+    } else {
+        detail::pool_thread_cache::increment<size_t>(cache->hits);
+    }
+    detail::pool_thread_cache::increment<int64_t>(cache->requested, static_cast<int64_t>(size));
+    if (node >= 0) {
+        detail::pool_thread_cache::increment<size_t>(cache->allocations);
+        if (cache->remote) {
+            detail::pool_thread_cache::increment<size_t>(cache->remote_allocations);
+        }
+    }
+    cache->cached.store(cache->cached.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    return magazine.chunks[--magazine.count];
 }
 
 void resource_pool::deallocate(void *ptr, size_t size) {
-    std::lock_guard<std::mutex> const lock(mutex);
-    pool.ordered_free(ptr, get_chunks_count(size, chunk_size));
+    const size_t chunks_count = get_chunks_count(size, chunk_size);
+    if (chunks_count > LARGE_OBJECT_CHUNKS) {
+        NumaFree(ptr);
+        central->reserved.fetch_sub(static_cast<int64_t>(chunks_count * chunk_size), std::memory_order_relaxed);
+        central->requested.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+        return;
+    }
+
+    const size_t size_class = get_size_class(chunks_count);
+    auto *cache = local_cache();
+    if (cache == nullptr) {
+        std::lock_guard<std::mutex> const lock(central->mutex);
+        central->classes[size_class]->free(ptr);
+        central->requested.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+        return;
+    }
+
+    auto &magazine = cache->magazines[size_class];
+    if (!magazine.chunks) {
+        magazine.capacity = std::max<size_t>(THREAD_CACHE_MIN_SIZE, THREAD_CACHE_SIZE / central->class_chunks[size_class]);
+        magazine.chunks.reset(new void *[magazine.capacity]);
+    }
+    if (magazine.count == magazine.capacity) {
+        flush(*cache, size_class);
+    } else {
+        detail::pool_thread_cache::increment<size_t>(cache->hits);
+    }
+    magazine.chunks[magazine.count++] = ptr;
+    detail::pool_thread_cache::increment<size_t>(cache->cached);
+    detail::pool_thread_cache::increment<int64_t>(cache->requested, -static_cast<int64_t>(size));
 }
 
 void resource_pool::deallocate(void *ptr) {
-    std::lock_guard<std::mutex> const lock(mutex);
-    pool.free(ptr);
+    deallocate(ptr, chunk_size);
+}
+
+size_t resource_pool::get_allocations_count() const {
+    std::lock_guard<std::mutex> const lock(central->mutex);
+    size_t count = central->allocations.load(std::memory_order_relaxed);
+    for (const auto *cache : central->caches) {
+        count += cache->allocations.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+size_t resource_pool::get_remote_allocations_count() const {
+    std::lock_guard<std::mutex> const lock(central->mutex);
+    size_t count = central->remote_allocations.load(std::memory_order_relaxed);
+    for (const auto *cache : central->caches) {
+        count += cache->remote_allocations.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+resource_pool::cache_stats resource_pool::get_thread_cache_stats() const {
+    const auto *cache = local_cache();
+    cache_stats stats;
+    if (cache == nullptr) {
+        return stats;
+    }
+    stats.hits = cache->hits.load(std::memory_order_relaxed);
+    stats.refills = cache->refills.load(std::memory_order_relaxed);
+    stats.flushes = cache->flushes.load(std::memory_order_relaxed);
+    stats.cached = cache->cached.load(std::memory_order_relaxed);
+    return stats;
+}
+
+resource_pool::cache_stats resource_pool::get_cache_stats() const {
+    std::lock_guard<std::mutex> const lock(central->mutex);
+    cache_stats stats;
+    stats.hits = central->hits.load(std::memory_order_relaxed);
+    stats.refills = central->refills.load(std::memory_order_relaxed);
+    stats.flushes = central->flushes.load(std::memory_order_relaxed);
+    for (const auto *cache : central->caches) {
+        stats.hits += cache->hits.load(std::memory_order_relaxed);
+        stats.refills += cache->refills.load(std::memory_order_relaxed);
+        stats.flushes += cache->flushes.load(std::memory_order_relaxed);
+        stats.cached += cache->cached.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+resource_pool::memory_stats resource_pool::get_memory_stats() const {
+    std::lock_guard<std::mutex> const lock(central->mutex);
+    int64_t requested = central->requested.load(std::memory_order_relaxed);
+    for (const auto *cache : central->caches) {
+        requested += cache->requested.load(std::memory_order_relaxed);
+    }
+    memory_stats stats;
+    stats.reserved = static_cast<size_t>(std::max<int64_t>(0, central->reserved.load(std::memory_order_relaxed)));
+    stats.requested = static_cast<size_t>(std::max<int64_t>(0, requested));
+    stats.fragmentation = (stats.reserved > 0)
+            ? 1.0 - static_cast<double>(std::min(stats.requested, stats.reserved)) / static_cast<double>(stats.reserved)
+            : 0.0;
+    return stats;
+}
+
+void resource_pool::make_metrics(const std::shared_ptr<Mon::IMetricer> &metricer, const std::map<std::string, std::string> &labels) {
+    m_allocations_count = metricer->MakeCounter("ar_numa_allocations_count", labels);
+    m_remote_allocations_count = metricer->MakeCounter("ar_numa_remote_allocations_count", labels);
 }
 
 resource_pools_manager::resource_pools_manager() {
@@ -69,6 +498,33 @@ void resource_pools_manager::create_default_resource(size_t chunk_sz, size_t nne
     pools.push_back(default_pool);
 }
 
+void resource_pools_manager::create_node_resources(const std::vector<int> &numa_nodes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < numa_nodes.size() && i < MAX_NUMA_POOLS; ++i) {
+        auto *pool = node_pools[i].load(std::memory_order_relaxed);
+        if (pool != nullptr) {
+            pool->set_numa_node(numa_nodes[i]);
+            continue;
+        }
+        pool = new resource_pool(128, 1024, 0, numa_nodes[i]);
+        pools.push_back(pool);
+        node_pools[i].store(pool, std::memory_order_release);
+    }
+}
+
+void resource_pools_manager::make_metrics(const std::shared_ptr<Mon::IMetricer> &metricer) {
+    if (!metricer) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < MAX_NUMA_POOLS; ++i) {
+        auto *pool = node_pools[i].load(std::memory_order_relaxed);
+        if (pool != nullptr) {
+            pool->make_metrics(metricer, {{"executor", std::to_string(i)}, {"node", std::to_string(pool->get_numa_node())}});
+        }
+    }
+}
+
 ResourcePoolPtr AsyncRuntime::CreateResource(size_t chunk_sz, size_t nnext_size, size_t nmax_size) {
     return Runtime::g_runtime->CreateResource(chunk_sz, nnext_size, nmax_size);
 }
@@ -3,10 +3,13 @@
 #include "ar/profiler.hpp"
 #include "ar/cpu_helper.hpp"
 #include "ar/resource_pool.hpp"
+#include "ar/stack_cache.hpp"
 #include "numbers.h"
 
 #include "io_executor.h"
 
+#include <set>
+
 using namespace AsyncRuntime;
 
 #define MAX_GROUPS_COUNT 10
@@ -32,6 +35,7 @@ void Runtime::Setup(const RuntimeOptions &_options) {
         return;
 
     CreateDefaultExecutors(_options.virtual_numa_nodes_count);
+    ReserveStacks(_options.warm_stacks);
     
     io_executor = CreateExecutor<IO::IOExecutor>(IO_EXECUTOR_NAME);
 
@@ -68,11 +72,22 @@ void Runtime::Terminate() {
 
     PROFILER_STOP();
 
+    // cpu executors steal from each other, stop all of them before deleting
+    for (auto const &it: executors) {
+        if (it.second->GetType() == kCPU_EXECUTOR) {
+            static_cast<Executor *>(it.second)->Stop();
+        }
+    }
+
     for (auto const &it: executors) {
         delete it.second;
     }
 
     executors.clear();
+    cpu_executors.clear();
+    free_executor.store(nullptr, std::memory_order_relaxed);
+    main_executor = nullptr;
+    io_executor = nullptr;
 
     is_setup = false;
 }
@@ -96,7 +111,6 @@ ObjectID Runtime::GetWorkGroup(const std::string &name) const {
 
 void Runtime::CreateDefaultExecutors(int virtual_numa_nodes_count) {
     auto nodes = (virtual_numa_nodes_count == 0) ? GetNumaNodes() : GetManualNumaNodes(virtual_numa_nodes_count);
-    std::vector<Executor *> cpu_executors;
 
     for (size_t i = 0; i < nodes.size(); ++i) {
         auto executor = new Executor("CPUExecutor_" + std::to_string(i), nodes[i].cpus, work_groups_option);
@@ -111,6 +125,29 @@ void Runtime::CreateDefaultExecutors(int virtual_numa_nodes_count) {
     if (main_executor == nullptr) {
         throw std::runtime_error("main executor not setup");
     }
+
+    std::vector<int> numa_nodes;
+    for (auto *executor : cpu_executors) {
+        executor->SetRemoteExecutors(cpu_executors);
+        numa_nodes.push_back(executor->GetNumaNode());
+    }
+    resources_manager.create_node_resources(numa_nodes);
+
+    UpdateFreeExecutor();
+}
+
+void Runtime::ReserveStacks(size_t count) {
+    if (count == 0) {
+        return;
+    }
+    // stacks are taken for the node of the calling thread, -1 on a single node
+    std::set<int> numa_nodes;
+    for (auto *executor : cpu_executors) {
+        numa_nodes.insert(cpu_executors.size() > 1 ? executor->GetNumaNode() : -1);
+    }
+    for (int node : numa_nodes) {
+        stack_cache::instance().reserve(count, ctx::stack_traits::default_size(), node);
+    }
 }
 
 ResourcePoolPtr Runtime::CreateResource(size_t chunk_sz, size_t nnext_size, size_t nmax_size) {
@@ -122,15 +159,28 @@ void Runtime::DeleteResource(resource_pool *pool) {
 }
 
 resource_pool * Runtime::GetDefaultResource() {
-    return resources_manager.get_default_resource();
+    const auto *executor = GetLocalExecutor();
+    return resources_manager.get_default_resource(executor != nullptr ? executor->GetIndex() : -1);
+}
+
+const Executor *Runtime::GetLocalExecutor() const {
+    // the executor of untagged work posted by the calling thread, as in Post
+    const Executor *executor = Executor::Current();
+    return executor != nullptr ? executor : free_executor.load(std::memory_order_relaxed);
+}
+
+int Runtime::GetLocalNumaNode() const {
+    const auto *executor = GetLocalExecutor();
+    return (executor != nullptr && cpu_executors.size() > 1) ? executor->GetNumaNode() : -1;
 }
 
 EntityTag Runtime::AddEntityTag(void *ptr) {
-    auto executor = FetchFreeExecutor(kCPU_EXECUTOR);
+    auto executor = FetchFreeExecutor();
 
     if (executor != nullptr) {
         int16_t entity_id = executor->AddEntity(ptr);
         int16_t executor_id = executor->GetIndex();
+        UpdateFreeExecutor();
         return Numbers::Pack(executor_id, entity_id);
     } else {
         return INVALID_OBJECT_ID;
@@ -138,39 +188,37 @@ EntityTag Runtime::AddEntityTag(void *ptr) {
 }
 
 void Runtime::DeleteEntityTag(EntityTag tag) {
-    uint16_t executor_id, entity_id;
-    Numbers::Unpack(tag, executor_id, entity_id);
-    for (const auto &executor: executors) {
-        if (executor.second->GetType() == kCPU_EXECUTOR && executor.second->GetIndex() == executor_id) {
-            executor.second->DeleteEntity(entity_id);
-            break;
-        }
+    auto executor = FetchExecutor(tag);
+    if (executor != nullptr) {
+        uint16_t executor_id, entity_id;
+        Numbers::Unpack(tag, executor_id, entity_id);
+        executor->DeleteEntity(entity_id);
+        UpdateFreeExecutor();
     }
 }
 
-IExecutor *Runtime::FetchExecutor(ExecutorType type, const EntityTag &tag) {
+IExecutor *Runtime::FetchExecutor(const EntityTag &tag) const {
     uint16_t id, e;
     Numbers::Unpack(tag, id, e);
-    for (const auto &executor: executors) {
-        if (executor.second->GetType() == type && executor.second->GetIndex() == id) {
-            return executor.second;
-        }
-    }
-    return nullptr;
+    return (id < cpu_executors.size()) ? cpu_executors[id] : nullptr;
 }
 
-IExecutor *Runtime::FetchFreeExecutor(ExecutorType type) {
-    IExecutor *min_executor = nullptr;
+IExecutor *Runtime::FetchFreeExecutor() const {
+    return free_executor.load(std::memory_order_relaxed);
+}
+
+void Runtime::UpdateFreeExecutor() {
+    Executor *min_executor = nullptr;
     int min = INT_MAX;
 
-    for (auto &executor: executors) {
-        if (executor.second->GetType() == type && min > executor.second->GetEntitiesCount()) {
-            min = executor.second->GetEntitiesCount();
-            min_executor = executor.second;
+    for (auto *executor : cpu_executors) {
+        if (min > executor->GetEntitiesCount()) {
+            min = executor->GetEntitiesCount();
+            min_executor = executor;
         }
     }
 
-    return min_executor;
+    free_executor.store(min_executor, std::memory_order_relaxed);
 }
 
 std::shared_ptr<Mon::Counter>
@@ -187,12 +235,24 @@ void Runtime::CreateMetrics() {
         it.second->MakeMetrics(metricer);
     }
     coroutine_counter = MakeMetricsCounter("ar_coroutines_count", {});
+    resources_manager.make_metrics(metricer);
+    stack_cache::instance().make_metrics(metricer);
 }
 
 void Runtime::Post(task *t) {
     const auto &executor_state = t->get_execution_state();
     if (executor_state.executor == nullptr) {
-        auto executor = (executor_state.tag != INVALID_OBJECT_ID) ? FetchExecutor(kCPU_EXECUTOR, executor_state.tag) : FetchFreeExecutor(kCPU_EXECUTOR);
+        IExecutor *executor;
+        if (executor_state.tag != INVALID_OBJECT_ID) {
+            executor = FetchExecutor(executor_state.tag);
+        } else {
+            // keep untagged work posted by a worker on its own numa node
+            executor = Executor::Current();
+            if (executor == nullptr) {
+                executor = FetchFreeExecutor();
+            }
+        }
+
         if (executor != nullptr) {
             executor->Post(t);
         } else {
@@ -201,4 +261,30 @@ void Runtime::Post(task *t) {
     } else {
         executor_state.executor->Post(t);
     }
-}
\ No newline at end of file
+}
+
+void Runtime::PostBatch(task **tasks, size_t n) {
+    // untagged tasks go to one executor in one batch, the others are routed one by one
+    size_t plain = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const auto &executor_state = tasks[i]->get_execution_state();
+        if (executor_state.executor != nullptr || executor_state.tag != INVALID_OBJECT_ID) {
+            Post(tasks[i]);
+        } else {
+            tasks[plain++] = tasks[i];
+        }
+    }
+
+    if (plain == 0) {
+        return;
+    }
+
+    IExecutor *executor = Executor::Current();
+    if (executor == nullptr) {
+        executor = FetchFreeExecutor();
+    }
+    if (executor == nullptr) {
+        executor = main_executor;
+    }
+    executor->PostBatch(tasks, plain);
+}
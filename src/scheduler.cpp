@@ -1,47 +1,348 @@
 #include "ar/scheduler.hpp"
 #include "ar/runtime.hpp"
 
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 using namespace AsyncRuntime;
 
-Scheduler::Scheduler(const std::function<void(task *)> &task_callback)
-    : is_continue{true}
-    , task_callback(task_callback) {
-    scheduler_th.Submit([this] { SchedulerLoop(); });
+
+namespace {
+    // index of the lowest set bit, bits != 0
+    inline unsigned lowest_bit(uint64_t bits) {
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_ctzll(bits));
+#else
+        unsigned n = 0;
+        while ((bits & 1) == 0) {
+            bits >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    inline uint64_t rotate_right(uint64_t bits, unsigned n) {
+        n &= 63;
+        return n == 0 ? bits : (bits >> n) | (bits << (64 - n));
+    }
+}
+
+
+class Scheduler::Timer final : public cancellation_callback {
+public:
+    Timer(Scheduler *scheduler, task *t, uint64_t tick, detail::cancellation_state *cancellation)
+        : scheduler(scheduler)
+        , t(t)
+        , tick(tick)
+        , cancellation(cancellation)
+        // the wheel and the registration in the token
+        , refs(cancellation != nullptr ? 2 : 1) {
+        if (cancellation != nullptr) {
+            cancellation->add_ref();
+        }
+    }
+
+    ~Timer() {
+        if (cancellation != nullptr) {
+            cancellation->release();
+        }
+    }
+
+    static void *operator new(std::size_t size) { return task_pool::allocate(size); }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept { task_pool::deallocate(ptr, size); }
+
+    void on_cancel() noexcept override {
+        scheduler->Cancel(this);
+    }
+
+    void release() noexcept {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    /**
+     * @brief drops the registration in the token, if the token doesn't call the timer
+     */
+    void unregister() noexcept {
+        if (cancellation != nullptr && cancellation->remove_callback(this)) {
+            release();
+        }
+    }
+
+    Scheduler                   *scheduler;
+    task                        *t;
+    // expiry tick
+    uint64_t                    tick;
+    detail::cancellation_state  *cancellation;
+    // the slot list, or the list of expired timers
+    Timer                       *prev = nullptr;
+    Timer                       *next = nullptr;
+    unsigned                    level = 0;
+    uint64_t                    slot = 0;
+    bool                        linked = false;
+    std::atomic_uint            refs;
+};
+
+
+Scheduler::Scheduler(const std::function<void(task *)> &task_callback,
+                     const std::function<void()> &wakeup_callback,
+                     Timespan tick_us)
+    : task_callback(task_callback)
+    , wakeup_callback(wakeup_callback)
+    , tick_us(std::max<Timespan>(tick_us, 1))
+    , current(static_cast<uint64_t>(TIMESTAMP_NOW_MICRO() / this->tick_us)) {
 }
 
 
 Scheduler::~Scheduler() {
-    is_continue.store(false, std::memory_order_relaxed);
-    delayed_task_cv.notify_one();
-    scheduler_th.Join();
-}
-
-void Scheduler::SchedulerLoop() {
-    while (is_continue.load(std::memory_order_relaxed)) {
-        std::unique_lock<std::mutex> lock(delayed_task_mutex);
-        if (!delayed_task.empty()) {
-            task *task = delayed_task.top();
-
-            if (task) {
-                int64_t delay = task->get_delay();
-                if (delay <= 0) {
-                    task_callback(task);
-                    delayed_task.pop();
-                } else {
-                    delayed_task_cv.wait_for(lock, std::chrono::microseconds(delay));
+    std::vector<Timer *> timers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &level : wheel) {
+            for (auto &slot : level) {
+                for (Timer *timer = slot; timer != nullptr; timer = timer->next) {
+                    timer->linked = false;
+                    timers.push_back(timer);
                 }
+                slot = nullptr;
             }
-        } else {
-            delayed_task_cv.wait(lock);
         }
+        std::fill(std::begin(occupied), std::end(occupied), 0);
+        pending = 0;
+    }
+
+    for (auto *timer : timers) {
+        timer->unregister();
+        timer->t->cancel();
+        delete timer->t;
+        timer->release();
     }
 }
 
 
 void Scheduler::Post(task *task) {
-    std::unique_lock<std::mutex> lock(delayed_task_mutex);
-    delayed_task.push(task);
-    delayed_task_cv.notify_one();
-}
\ No newline at end of file
+    // rounded up, a task doesn't expire before its delay
+    auto *timer = new Timer(this, task, static_cast<uint64_t>((task->get_deadline() + tick_us - 1) / tick_us),
+                            task->get_cancellation());
+
+    bool wakeup;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // a cancel of the token waits for the lock, so it finds the timer in the wheel
+        if (timer->cancellation != nullptr && !timer->cancellation->add_callback(timer)) {
+            lock.unlock();
+            task->cancel();
+            delete task;
+            delete timer;
+            return;
+        }
+
+        if (pending == 0) {
+            // nothing is linked relative to the current tick, it catches up with the time
+            current = std::max(current, static_cast<uint64_t>(TIMESTAMP_NOW_MICRO() / tick_us));
+        }
+        timer->tick = std::max(timer->tick, current + 1);
+        Link(timer);
+        ++pending;
+
+        const Timespan previous = next_deadline.load(std::memory_order_relaxed);
+        UpdateDeadline();
+        const Timespan next = next_deadline.load(std::memory_order_relaxed);
+        // only a new earliest deadline needs a thread to wait for it
+        wakeup = next < previous && next < keeper_deadline.load(std::memory_order_acquire);
+    }
+
+    if (wakeup && wakeup_callback) {
+        wakeups_count.fetch_add(1, std::memory_order_relaxed);
+        wakeup_callback();
+    }
+}
+
+
+size_t Scheduler::Advance(Timespan now) {
+    const auto target = static_cast<uint64_t>(now / tick_us);
+    Timer *expired = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (pending > 0) {
+            const uint64_t event = NextEvent();
+            if (event > target) {
+                break;
+            }
+
+            current = event;
+            // upper levels first, their timers can fall down to the current slot of a lower level
+            for (unsigned level = SCHEDULER_LEVELS; level-- > 0;) {
+                const unsigned shift = SCHEDULER_SLOT_BITS * level;
+                if ((current & ((uint64_t(1) << shift) - 1)) != 0) {
+                    continue;
+                }
+                if (occupied[level] & (uint64_t(1) << ((current >> shift) & kSlotMask))) {
+                    Cascade(level, expired);
+                }
+            }
+        }
+
+        current = std::max(current, target);
+        UpdateDeadline();
+    }
+
+    // the list is built backwards
+    Timer *ordered = nullptr;
+    while (expired != nullptr) {
+        Timer *next = expired->next;
+        expired->next = ordered;
+        ordered = expired;
+        expired = next;
+    }
+
+    size_t n = 0;
+    while (ordered != nullptr) {
+        Timer *timer = ordered;
+        ordered = timer->next;
+        task_callback(timer->t);
+        timer->unregister();
+        timer->release();
+        ++n;
+    }
+    return n;
+}
+
+
+bool Scheduler::Keep(Timespan deadline) {
+    Timespan kept = keeper_deadline.load(std::memory_order_acquire);
+    while (deadline < kept) {
+        if (keeper_deadline.compare_exchange_weak(kept, deadline, std::memory_order_acq_rel)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void Scheduler::Unkeep(Timespan deadline) {
+    // an other thread may keep an earlier deadline already
+    keeper_deadline.compare_exchange_strong(deadline, INT64_MAX, std::memory_order_acq_rel);
+    wakeups_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+size_t Scheduler::GetPendingCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
+
+
+void Scheduler::Cancel(Timer *timer) {
+    task *t = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (timer->linked) {
+            t = timer->t;
+            Unlink(timer);
+            --pending;
+        }
+    }
+
+    if (t != nullptr) {
+        t->cancel();
+        delete t;
+        timer->release();
+    }
+    // the registration
+    timer->release();
+}
+
+
+void Scheduler::Link(Timer *timer) {
+    // the timer must come down through the slots before its tick, farther ones wait at the end of the top level
+    constexpr uint64_t max_span = (kSlots - 1) << (SCHEDULER_SLOT_BITS * (SCHEDULER_LEVELS - 1));
+    const uint64_t at = std::min(timer->tick, current + max_span);
+    const uint64_t diff = at ^ current;
+
+    unsigned level = 0;
+    while (level + 1 < SCHEDULER_LEVELS && (diff >> (SCHEDULER_SLOT_BITS * (level + 1))) != 0) {
+        ++level;
+    }
+    const uint64_t slot = (at >> (SCHEDULER_SLOT_BITS * level)) & kSlotMask;
+
+    Timer *&head = wheel[level][slot];
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = nullptr;
+    timer->next = head;
+    if (head != nullptr) {
+        head->prev = timer;
+    }
+    head = timer;
+    timer->linked = true;
+    occupied[level] |= uint64_t(1) << slot;
+}
+
+
+void Scheduler::Unlink(Timer *timer) {
+    Timer *&head = wheel[timer->level][timer->slot];
+    if (timer->prev != nullptr) {
+        timer->prev->next = timer->next;
+    } else {
+        head = timer->next;
+    }
+    if (timer->next != nullptr) {
+        timer->next->prev = timer->prev;
+    }
+    if (head == nullptr) {
+        occupied[timer->level] &= ~(uint64_t(1) << timer->slot);
+    }
+    timer->linked = false;
+}
+
+
+void Scheduler::Cascade(unsigned level, Timer *&expired) {
+    const uint64_t slot = (current >> (SCHEDULER_SLOT_BITS * level)) & kSlotMask;
+    Timer *timer = wheel[level][slot];
+    wheel[level][slot] = nullptr;
+    occupied[level] &= ~(uint64_t(1) << slot);
+
+    // a slot of the first level holds only due timers
+    while (timer != nullptr) {
+        Timer *next = timer->next;
+        if (timer->tick <= current) {
+            timer->linked = false;
+            timer->next = expired;
+            expired = timer;
+            --pending;
+        } else {
+            Link(timer);
+        }
+        timer = next;
+    }
+}
+
+
+uint64_t Scheduler::NextEvent() const {
+    uint64_t event = UINT64_MAX;
+    for (unsigned level = 0; level < SCHEDULER_LEVELS; ++level) {
+        if (occupied[level] == 0) {
+            continue;
+        }
+
+        // the slot of the current tick is always empty, slots come up in a circle after it
+        const unsigned shift = SCHEDULER_SLOT_BITS * level;
+        const uint64_t position = current >> shift;
+        const auto first = static_cast<unsigned>((position + 1) & kSlotMask);
+        const uint64_t distance = lowest_bit(rotate_right(occupied[level], first)) + 1;
+        event = std::min(event, (position + distance) << shift);
+    }
+    return event;
+}
+
+
+void Scheduler::UpdateDeadline() {
+    const uint64_t event = NextEvent();
+    next_deadline.store(event == UINT64_MAX ? INT64_MAX : static_cast<Timespan>(event) * tick_us,
+                        std::memory_order_release);
+}
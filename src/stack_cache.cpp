@@ -0,0 +1,227 @@
+#include "ar/stack_cache.hpp"
+#include "ar/cpu_helper.hpp"
+
+#include <algorithm>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(BOOST_USE_VALGRIND)
+#include <valgrind/valgrind.h>
+#endif
+
+using namespace AsyncRuntime;
+
+// stacks a thread keeps of all sizes, a full cache gives its older half to the shared lists
+#define STACK_THREAD_CACHE_SIZE 16
+// stacks the shared lists keep of all sizes and nodes, stacks freed over it are unmapped
+#define STACK_SHARED_CACHE_SIZE 256
+
+static size_t get_page_size() {
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+
+namespace AsyncRuntime::detail {
+    /**
+     * @brief stacks freed by one thread, given back to the shared lists when the thread exits
+     */
+    struct stack_thread_cache {
+        struct entry {
+            void        *stack;
+            size_t      size;
+            int         numa_node;
+        };
+
+        ~stack_thread_cache() {
+            exited = true;
+            flush(stacks.size());
+        }
+
+        /**
+         * @brief gives the oldest stacks back
+         */
+        void flush(size_t count) {
+            auto &cache = stack_cache::instance();
+            {
+                std::lock_guard<std::mutex> const lock(cache.mutex);
+                for (size_t i = 0; i < count; ++i) {
+                    cache.release(stacks[i].stack, stacks[i].size, stacks[i].numa_node);
+                }
+            }
+            stacks.erase(stacks.begin(), stacks.begin() + static_cast<std::ptrdiff_t>(count));
+        }
+
+        std::vector<entry> stacks;
+        // set once the stacks of the thread are given back, later frees of its exit go to the shared lists
+        static thread_local bool exited;
+    };
+
+    thread_local bool stack_thread_cache::exited = false;
+}
+
+static thread_local detail::stack_thread_cache local_stacks;
+
+stack_cache &stack_cache::instance() {
+    static auto *cache = new stack_cache();
+    return *cache;
+}
+
+size_t stack_cache::get_stack_size(size_t size) {
+    const size_t page_size = get_page_size();
+    size = std::max(size, ctx::stack_traits::minimum_size());
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+ctx::stack_context stack_cache::allocate(size_t size, int numa_node) {
+    const size_t stack_size = get_stack_size(size);
+    void *stack = nullptr;
+
+    if (!detail::stack_thread_cache::exited) {
+        // the most recently freed stack is the warmest
+        auto &stacks = local_stacks.stacks;
+        for (auto it = stacks.rbegin(); it != stacks.rend(); ++it) {
+            if (it->size == stack_size && it->numa_node == numa_node) {
+                stack = it->stack;
+                stacks.erase(std::next(it).base());
+                break;
+            }
+        }
+    }
+
+    if (stack == nullptr) {
+        std::lock_guard<std::mutex> const lock(mutex);
+        auto it = free_stacks.find({stack_size, numa_node});
+        if (it != free_stacks.end() && !it->second.empty()) {
+            stack = it->second.back();
+            it->second.pop_back();
+            --shared_count;
+        }
+        report();
+    }
+
+    if (stack != nullptr) {
+        hits.fetch_add(1, std::memory_order_relaxed);
+        cached.fetch_sub(1, std::memory_order_relaxed);
+    } else {
+        stack = map(stack_size, numa_node);
+        misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ctx::stack_context sctx;
+    sctx.size = stack_size;
+    sctx.sp = static_cast< char * >( stack) + sctx.size;
+#if defined(BOOST_USE_VALGRIND)
+    sctx.valgrind_stack_id = VALGRIND_STACK_REGISTER( sctx.sp, stack);
+#endif
+    return sctx;
+}
+
+void stack_cache::deallocate(ctx::stack_context & sctx, int numa_node) {
+#if defined(BOOST_USE_VALGRIND)
+    VALGRIND_STACK_DEREGISTER( sctx.valgrind_stack_id);
+#endif
+    void *stack = static_cast< char * >( sctx.sp) - sctx.size;
+    cached.fetch_add(1, std::memory_order_relaxed);
+
+    if (detail::stack_thread_cache::exited) {
+        std::lock_guard<std::mutex> const lock(mutex);
+        release(stack, sctx.size, numa_node);
+        return;
+    }
+
+    auto &stacks = local_stacks.stacks;
+    if (stacks.size() >= STACK_THREAD_CACHE_SIZE) {
+        local_stacks.flush(STACK_THREAD_CACHE_SIZE / 2);
+    }
+    stacks.push_back({stack, sctx.size, numa_node});
+}
+
+void stack_cache::reserve(size_t count, size_t size, int numa_node) {
+    const size_t stack_size = get_stack_size(size);
+    const size_t page_size = get_page_size();
+    std::vector<void *> stacks;
+    for (size_t i = 0; i < count; ++i) {
+        auto *stack = static_cast<char *>(map(stack_size, numa_node));
+        // the first touch takes the pages, on the bound node
+        for (size_t offset = 0; offset < stack_size; offset += page_size) {
+            *static_cast<volatile char *>(stack + offset) = 0;
+        }
+        stacks.push_back(stack);
+    }
+
+    std::lock_guard<std::mutex> const lock(mutex);
+    auto &free = free_stacks[{stack_size, numa_node}];
+    free.insert(free.end(), stacks.begin(), stacks.end());
+    shared_count += count;
+    cached.fetch_add(count, std::memory_order_relaxed);
+}
+
+void stack_cache::release(void *stack, size_t size, int numa_node) {
+    if (shared_count >= STACK_SHARED_CACHE_SIZE) {
+        cached.fetch_sub(1, std::memory_order_relaxed);
+        unmap(stack, size);
+        return;
+    }
+    free_stacks[{size, numa_node}].push_back(stack);
+    ++shared_count;
+}
+
+void *stack_cache::map(size_t size, int numa_node) {
+    const size_t page_size = get_page_size();
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_STACK)
+    flags |= MAP_STACK;
+#endif
+    void *vp = ::mmap(nullptr, size + page_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (vp == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    // stacks grow down, an overflow hits the guard page
+    if (::mprotect(vp, page_size, PROT_NONE) != 0) {
+        ::munmap(vp, size + page_size);
+        throw std::bad_alloc();
+    }
+
+    void *stack = static_cast<char *>(vp) + page_size;
+    NumaBind(stack, size, numa_node);
+    resident.fetch_add(size, std::memory_order_relaxed);
+    return stack;
+}
+
+void stack_cache::unmap(void *stack, size_t size) {
+    const size_t page_size = get_page_size();
+    ::munmap(static_cast<char *>(stack) - page_size, size + page_size);
+    resident.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void stack_cache::report() {
+    // metrics follow the thread caches until their next trip to the shared lists
+    const size_t hits_count = hits.load(std::memory_order_relaxed);
+    const size_t misses_count = misses.load(std::memory_order_relaxed);
+    if (m_hits_count && hits_count > reported_hits) {
+        m_hits_count->Increment(static_cast<double>(hits_count - reported_hits));
+    }
+    if (m_misses_count && misses_count > reported_misses) {
+        m_misses_count->Increment(static_cast<double>(misses_count - reported_misses));
+    }
+    reported_hits = hits_count;
+    reported_misses = misses_count;
+}
+
+stack_cache::stats stack_cache::get_stats() const {
+    stats s;
+    s.hits = hits.load(std::memory_order_relaxed);
+    s.misses = misses.load(std::memory_order_relaxed);
+    s.hit_rate = (s.hits + s.misses > 0) ? static_cast<double>(s.hits) / static_cast<double>(s.hits + s.misses) : 0.0;
+    s.resident = resident.load(std::memory_order_relaxed);
+    s.cached = cached.load(std::memory_order_relaxed);
+    return s;
+}
+
+void stack_cache::make_metrics(const std::shared_ptr<Mon::IMetricer> &metricer) {
+    std::lock_guard<std::mutex> const lock(mutex);
+    m_hits_count = metricer->MakeCounter("ar_stack_cache_hits_count", {});
+    m_misses_count = metricer->MakeCounter("ar_stack_cache_misses_count", {});
+}
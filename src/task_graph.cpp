@@ -0,0 +1,225 @@
+#include "ar/task_graph.hpp"
+#include "ar/runtime.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace AsyncRuntime;
+using detail::graph_node;
+
+
+class TaskGraph::NodeTask : public task {
+public:
+    NodeTask(TaskGraph *graph, graph_node *node) : graph(graph), node(node) { }
+    ~NodeTask() override = default;
+
+    void execute(const execution_state &state) override {
+        task::state = state;
+        graph->Invoke(node);
+    }
+private:
+    TaskGraph   *graph;
+    graph_node  *node;
+};
+
+
+future_t<void> TaskGraph::Run(size_t times) {
+    if (times == 0) {
+        task_promise<void> promise;
+        promise.set_value();
+        return promise.get_future();
+    }
+
+    return RunUntil([remaining = times]() mutable { return --remaining == 0; });
+}
+
+
+future_t<void> TaskGraph::RunUntil(std::function<bool()> predicate) {
+    if (nodes.empty()) {
+        while (!predicate()) { }
+        task_promise<void> promise;
+        promise.set_value();
+        return promise.get_future();
+    }
+
+    ObjectID group = work_group;
+    if (group == INVALID_OBJECT_ID) {
+        group = Executor::CurrentWorkGroup();
+    }
+    if (group == INVALID_OBJECT_ID) {
+        // the main work group
+        group = 0;
+    }
+
+    Topology *topology;
+    future_t<void> future;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!compiled) {
+            if (!topologies.empty()) {
+                throw std::runtime_error("TaskGraph changed while it runs");
+            }
+            Compile();
+        }
+
+        topologies.push_back({std::move(predicate), group, {}});
+        future = topologies.back().promise.get_future();
+        topology = topologies.size() == 1 ? &topologies.back() : nullptr;
+    }
+
+    if (topology != nullptr) {
+        graph_node *next = nullptr;
+        StartRun(*topology, next);
+        if (next != nullptr) {
+            Post(next);
+        }
+    }
+    return future;
+}
+
+
+void TaskGraph::Compile() {
+    sources.clear();
+    for (auto &node : nodes) {
+        node->strong_dependents = std::count_if(node->dependents.begin(), node->dependents.end(),
+                                                [](const graph_node *dependent) { return !dependent->condition; });
+        if (node->dependents.empty()) {
+            sources.push_back(node.get());
+        }
+    }
+
+    if (sources.empty()) {
+        throw std::runtime_error("TaskGraph has no node without dependents");
+    }
+    compiled = true;
+}
+
+
+void TaskGraph::StartRun(const Topology &topology, graph_node *&next) {
+    run_group = topology.work_group;
+    error = nullptr;
+    cancelled.store(false, std::memory_order_relaxed);
+    // nodes skipped by conditions keep counters of the previous run
+    for (auto &node : nodes) {
+        node->join_counter.store(node->strong_dependents, std::memory_order_relaxed);
+    }
+
+    pending.store(sources.size(), std::memory_order_release);
+    for (auto *source : sources) {
+        Place(source, next);
+    }
+}
+
+
+void TaskGraph::Schedule(graph_node *node, graph_node *&next) {
+    pending.fetch_add(1, std::memory_order_relaxed);
+    Place(node, next);
+}
+
+
+void TaskGraph::Place(graph_node *node, graph_node *&next) {
+    if (next == nullptr) {
+        next = node;
+    } else {
+        Post(node);
+    }
+}
+
+
+void TaskGraph::Post(graph_node *node) {
+    auto *t = new NodeTask(this, node);
+    if (Executor::CurrentWorkGroup() == run_group && Executor::PostLocal(t)) {
+        return;
+    }
+
+    t->set_execution_state_wg(run_group);
+    IExecutor *executor = Executor::Current();
+    if (executor == nullptr) {
+        executor = Runtime::g_runtime->GetMainExecutor();
+    }
+    executor->Post(t);
+}
+
+
+void TaskGraph::Invoke(graph_node *node) {
+    while (node != nullptr) {
+        graph_node *next = nullptr;
+        if (!cancelled.load(std::memory_order_relaxed)) {
+            // a loop can make the node ready again in the same run
+            node->join_counter.store(node->strong_dependents, std::memory_order_relaxed);
+            try {
+                if (node->condition) {
+                    int branch = node->condition();
+                    if (branch >= 0 && static_cast<size_t>(branch) < node->successors.size()) {
+                        Schedule(node->successors[branch], next);
+                    }
+                } else {
+                    if (node->work) {
+                        node->work();
+                    }
+                    for (auto *successor : node->successors) {
+                        if (successor->join_counter.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                            Schedule(successor, next);
+                        }
+                    }
+                }
+            } catch (...) {
+                Fail(std::current_exception());
+            }
+        }
+
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // the graph can be destroyed by the owner of the run once it's completed
+            Complete(next);
+        }
+        node = next;
+    }
+}
+
+
+void TaskGraph::Fail(std::exception_ptr e) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error) {
+        error = std::move(e);
+    }
+    cancelled.store(true, std::memory_order_relaxed);
+}
+
+
+void TaskGraph::Complete(graph_node *&next) {
+    Topology *topology;
+    std::exception_ptr e;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        topology = &topologies.front();
+        e = error;
+    }
+
+    if (!e) {
+        try {
+            if (!topology->predicate()) {
+                StartRun(*topology, next);
+                return;
+            }
+        } catch (...) {
+            e = std::current_exception();
+        }
+    }
+
+    auto promise = std::move(topology->promise);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        topologies.pop_front();
+        topology = topologies.empty() ? nullptr : &topologies.front();
+    }
+
+    if (topology != nullptr) {
+        StartRun(*topology, next);
+    }
+
+    if (e) {
+        promise.set_exception(e);
+    } else {
+        promise.set_value();
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef AR_TASK_INBOX_H
+#define AR_TASK_INBOX_H
+
+#include "ar/task.hpp"
+#include "ar/os.hpp"
+
+#include <atomic>
+
+namespace AsyncRuntime {
+
+    /**
+     * @class TaskInbox
+     * @brief Lock-free multiple-producer single-consumer inbox of tasks.
+     *
+     * Any thread can push tasks into the inbox, the owner takes all of them
+     * at once with drain() and moves them into its own TaskQueue, so the
+     * work-stealing queue keeps its owner-only push/pop invariant and
+     * producers never take a mutex.
+     * Tasks are linked intrusively, push and drain do not allocate.
+     */
+    class TaskInbox {
+    public:
+        TaskInbox() = default;
+        ~TaskInbox() = default;
+
+        TaskInbox(const TaskInbox &) = delete;
+        TaskInbox &operator=(const TaskInbox &) = delete;
+
+        /**
+         * @brief pushes a task into the inbox
+         * @param t task
+         * @return true if the inbox was empty before the push
+         */
+        bool push(task *t) noexcept {
+            return push(t, t);
+        }
+
+        /**
+         * @brief pushes a chain of tasks linked with link() into the inbox
+         *
+         * The chain goes from first (the most recent task) to last (the oldest one),
+         * so drain() returns the oldest task of the chain first.
+         * @param first head of the chain
+         * @param last tail of the chain
+         * @return true if the inbox was empty before the push
+         */
+        bool push(task *first, task *last) noexcept {
+            task *h = head.data.load(std::memory_order_relaxed);
+            do {
+                last->inbox_next = h;
+            } while (!head.data.compare_exchange_weak(h, first,
+                                                      std::memory_order_release,
+                                                      std::memory_order_relaxed));
+            return h == nullptr;
+        }
+
+        /**
+         * @brief takes all tasks from the inbox
+         * @return list of tasks in FIFO order, iterate it with next()
+         */
+        task *drain() noexcept {
+            if (empty()) {
+                return nullptr;
+            }
+
+            task *t = head.data.exchange(nullptr, std::memory_order_acquire);
+            task *fifo = nullptr;
+            while (t != nullptr) {
+                task *n = t->inbox_next;
+                t->inbox_next = fifo;
+                fifo = t;
+                t = n;
+            }
+            return fifo;
+        }
+
+        /**
+         * @brief queries if the inbox is empty at the time of this call
+         */
+        bool empty() const noexcept {
+            return head.data.load(std::memory_order_relaxed) == nullptr;
+        }
+
+        /**
+         * @brief next task of the drained list
+         */
+        static task *next(task *t) noexcept {
+            return t->inbox_next;
+        }
+
+        /**
+         * @brief links t before next to build a chain for push(first, last)
+         */
+        static void link(task *t, task *next) noexcept {
+            t->inbox_next = next;
+        }
+    private:
+        CachelineAligned<std::atomic<task *>> head = {nullptr};
+    };
+}
+
+#endif //AR_TASK_INBOX_H
@@ -0,0 +1,307 @@
+#include "ar/task_pool.hpp"
+#include "ar/cpu_helper.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstdlib>
+#include <algorithm>
+
+// blocks freed by a foreign thread are returned to their slab in batches of this size
+#define REMOTE_FREE_BATCH 32
+
+using namespace AsyncRuntime;
+
+namespace {
+    constexpr size_t classes_count = task_pool::max_block_size / task_pool::block_align;
+
+    struct thread_cache;
+
+    struct free_block {
+        free_block *next;
+    };
+
+    struct alignas(task_pool::block_align) slab {
+        std::atomic<thread_cache *>     owner = {nullptr};
+        size_t                          block_size = 0;
+        char                            *bump = nullptr;
+        char                            *end = nullptr;
+        free_block                      *local_free = nullptr;
+        slab                            *next = nullptr;
+        // written by foreign threads, keep it away from the owner's fields
+        alignas(task_pool::block_align) std::atomic<free_block *> remote_free = {nullptr};
+    };
+
+    inline slab *slab_of(void *ptr) {
+        return reinterpret_cast<slab *>(reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t)(task_pool::slab_size - 1));
+    }
+
+    inline size_t size_class(size_t size) {
+        return (std::max<size_t>(size, 1) + task_pool::block_align - 1) / task_pool::block_align - 1;
+    }
+
+    void push_remote(slab *s, free_block *first, free_block *last) {
+        free_block *head = s->remote_free.load(std::memory_order_relaxed);
+        do {
+            last->next = head;
+        } while (!s->remote_free.compare_exchange_weak(head, first,
+                                                       std::memory_order_release,
+                                                       std::memory_order_relaxed));
+    }
+
+    struct slab_registry {
+        std::mutex                      mutex;
+        slab                            *orphans[classes_count] = {};
+        std::atomic_size_t              slabs_count = {0};
+        std::atomic_size_t              orphaned_slabs_count = {0};
+        std::atomic_size_t              system_allocations = {0};
+        std::atomic_size_t              remote_frees = {0};
+
+        slab *adopt(size_t cls, thread_cache *owner) {
+            std::lock_guard<std::mutex> lock(mutex);
+            slab *s = orphans[cls];
+            if (s != nullptr) {
+                orphans[cls] = s->next;
+                s->next = nullptr;
+                s->owner.store(owner, std::memory_order_relaxed);
+                orphaned_slabs_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+            return s;
+        }
+
+        void orphan(size_t cls, slab *s) {
+            std::lock_guard<std::mutex> lock(mutex);
+            s->owner.store(nullptr, std::memory_order_relaxed);
+            s->next = orphans[cls];
+            orphans[cls] = s;
+            orphaned_slabs_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    // never destroyed, tasks can be freed during static destruction
+    slab_registry &registry() {
+        static auto *r = new slab_registry;
+        return *r;
+    }
+
+    struct thread_cache {
+        struct remote_batch {
+            slab                        *s = nullptr;
+            free_block                  *first = nullptr;
+            free_block                  *last = nullptr;
+            size_t                      count = 0;
+        };
+
+        slab                            *slabs[classes_count] = {};
+        remote_batch                    batches[classes_count];
+
+        void *allocate(size_t cls) {
+            slab *s = slabs[cls];
+            if (s != nullptr) {
+                if (void *ptr = pop(s); ptr != nullptr) {
+                    return ptr;
+                }
+            }
+            return allocate_slow(cls);
+        }
+
+        void deallocate(slab *s, void *ptr, size_t cls) {
+            auto *block = static_cast<free_block *>(ptr);
+            if (s->owner.load(std::memory_order_relaxed) == this) {
+                block->next = s->local_free;
+                s->local_free = block;
+                return;
+            }
+
+            auto &batch = batches[cls];
+            if (batch.s != s) {
+                flush(batch);
+                batch.s = s;
+                batch.last = block;
+            }
+            block->next = batch.first;
+            batch.first = block;
+            if (++batch.count >= REMOTE_FREE_BATCH) {
+                flush(batch);
+            }
+        }
+
+        void flush() {
+            for (auto &batch : batches) {
+                flush(batch);
+            }
+        }
+
+        void orphan() {
+            flush();
+            for (size_t cls = 0; cls < classes_count; ++cls) {
+                for (slab *s = slabs[cls]; s != nullptr;) {
+                    slab *next = s->next;
+                    registry().orphan(cls, s);
+                    s = next;
+                }
+                slabs[cls] = nullptr;
+            }
+        }
+    private:
+        static void *pop(slab *s) {
+            if (free_block *block = s->local_free; block != nullptr) {
+                s->local_free = block->next;
+                return block;
+            }
+
+            if (s->bump + s->block_size <= s->end) {
+                void *ptr = s->bump;
+                s->bump += s->block_size;
+                return ptr;
+            }
+            return nullptr;
+        }
+
+        static void flush(remote_batch &batch) {
+            if (batch.count > 0) {
+                push_remote(batch.s, batch.first, batch.last);
+                registry().remote_frees.fetch_add(batch.count, std::memory_order_relaxed);
+            }
+            batch = {};
+        }
+
+        void *allocate_slow(size_t cls) {
+            // reclaim the blocks returned by other threads, the first slab with free blocks becomes the current one
+            slab *prev = nullptr;
+            for (slab *s = slabs[cls]; s != nullptr; prev = s, s = s->next) {
+                if (s->remote_free.load(std::memory_order_relaxed) != nullptr) {
+                    free_block *returned = s->remote_free.exchange(nullptr, std::memory_order_acquire);
+                    while (returned != nullptr) {
+                        free_block *next = returned->next;
+                        returned->next = s->local_free;
+                        s->local_free = returned;
+                        returned = next;
+                    }
+                }
+
+                if (s->local_free == nullptr && s->bump + s->block_size > s->end) {
+                    continue;
+                }
+
+                if (prev != nullptr) {
+                    prev->next = s->next;
+                    s->next = slabs[cls];
+                    slabs[cls] = s;
+                }
+                return pop(s);
+            }
+
+            slab *s = registry().adopt(cls, this);
+            if (s == nullptr) {
+                s = make_slab(cls);
+            }
+            s->next = slabs[cls];
+            slabs[cls] = s;
+
+            if (void *ptr = pop(s); ptr != nullptr) {
+                return ptr;
+            }
+            // an adopted slab can be fully allocated
+            return allocate_slow(cls);
+        }
+
+        slab *make_slab(size_t cls) {
+            void *mem = std::aligned_alloc(task_pool::slab_size, task_pool::slab_size);
+            if (mem == nullptr) {
+                throw std::bad_alloc();
+            }
+            // workers are pinned, the slab is on the node of the worker which allocates its tasks
+            NumaBind(mem, task_pool::slab_size, GetCurrentNumaNode());
+
+            auto *s = new (mem) slab;
+            s->owner.store(this, std::memory_order_relaxed);
+            s->block_size = (cls + 1) * task_pool::block_align;
+            s->bump = static_cast<char *>(mem) + sizeof(slab);
+            s->end = static_cast<char *>(mem) + task_pool::slab_size;
+
+            registry().slabs_count.fetch_add(1, std::memory_order_relaxed);
+            registry().system_allocations.fetch_add(1, std::memory_order_relaxed);
+            return s;
+        }
+    };
+
+    thread_local thread_cache *local_cache = nullptr;
+    thread_local bool local_cache_destroyed = false;
+
+    struct thread_cache_holder {
+        thread_cache cache;
+
+        thread_cache_holder() {
+            local_cache = &cache;
+        }
+
+        ~thread_cache_holder() {
+            cache.orphan();
+            local_cache = nullptr;
+            local_cache_destroyed = true;
+        }
+    };
+
+    // serves the threads whose cache is already destroyed
+    std::mutex shared_cache_mutex;
+    thread_cache shared_cache;
+
+    inline thread_cache *get_cache() {
+        if (local_cache == nullptr && !local_cache_destroyed) {
+            thread_local thread_cache_holder holder;
+        }
+        return local_cache;
+    }
+}
+
+void *task_pool::allocate(size_t size) {
+    if (size > max_block_size) {
+        registry().system_allocations.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(size);
+    }
+
+    const size_t cls = size_class(size);
+    if (auto *cache = get_cache(); cache != nullptr) {
+        return cache->allocate(cls);
+    }
+
+    std::lock_guard<std::mutex> lock(shared_cache_mutex);
+    return shared_cache.allocate(cls);
+}
+
+void task_pool::deallocate(void *ptr, size_t size) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    if (size > max_block_size) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    slab *s = slab_of(ptr);
+    if (auto *cache = get_cache(); cache != nullptr) {
+        cache->deallocate(s, ptr, size_class(size));
+    } else {
+        auto *block = static_cast<free_block *>(ptr);
+        push_remote(s, block, block);
+        registry().remote_frees.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void task_pool::flush() noexcept {
+    if (local_cache != nullptr) {
+        local_cache->flush();
+    }
+}
+
+task_pool_stats task_pool::get_stats() noexcept {
+    auto &r = registry();
+    task_pool_stats stats;
+    stats.slabs_count = r.slabs_count.load(std::memory_order_relaxed);
+    stats.orphaned_slabs_count = r.orphaned_slabs_count.load(std::memory_order_relaxed);
+    stats.system_allocations = r.system_allocations.load(std::memory_order_relaxed);
+    stats.remote_frees = r.remote_frees.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -1,61 +1,440 @@
 #include "ar/ticker.hpp"
 #include "ar/runtime.hpp"
 
+#include <cmath>
+#include <map>
+#include <vector>
+
 using namespace AsyncRuntime;
 
-class ticker_task : public task {
-    typedef promise_t<bool> promise_type;
-public:
-    ticker_task(Timespan &ts) : tick_ts(ts) {};
-    ~ticker_task() override = default;
 
-    void execute(const execution_state & state) override {
-        try {
+namespace AsyncRuntime {
+    namespace detail {
+
+        /**
+         * @class ticker_clock
+         * @brief Grid of ticks phase + k * period shared by tickers, fired by one delayed task at a time.
+         *
+         * The clock is armed only while a ticker waits on it. The waiting tickers are linked into the clock
+         * themselves, a tick doesn't allocate anything but the resume tasks of the coroutines.
+         */
+        class ticker_clock : public std::enable_shared_from_this<ticker_clock> {
+        public:
+            ticker_clock(ObjectID work_group, Timespan period, Timespan phase)
+                : work_group(work_group)
+                , period(period)
+                , phase(phase) { }
+
+            void attach(Ticker *ticker);
+
+            /**
+             * @brief takes the tick if the ticker is behind the clock
+             */
+            bool take(Ticker *ticker);
+
+            /**
+             * @brief waits for the next tick, the waiter is resolved at once if the tick is due or the ticker is stopped
+             * @param state execution state of the task resolving the promise
+             */
+            void wait(Ticker *ticker, CoroutineHandler *handler, bool *result, std::unique_ptr<promise_t<bool>> promise,
+                      const task::execution_state &state = {});
+
+            /**
+             * @brief resolves a waiting ticker with false and detaches it, the last ticker drops the clock
+             */
+            static void stop(Ticker *ticker);
+
+            void fire(int64_t tick);
+
+            void disarm(int64_t tick);
+
+            void fill(const Ticker *ticker, TickerStats &stats);
+
+            const ObjectID  work_group;
+            const Timespan  period;
+        private:
+            int64_t index(Timespan now) const { return (now - phase) / period; }
+
+            Timespan due(int64_t tick) const { return phase + tick * period; }
+
+            bool advance(Ticker *ticker, Timespan now);
+
+            task *arm(int64_t tick, Timespan now);
+
+            void link(Ticker *ticker);
+
+            void unlink(Ticker *ticker);
+
+            static void resolve(CoroutineHandler *handler, std::unique_ptr<promise_t<bool>> &promise, bool value);
+
+            /**
+             * @brief the resume task of the coroutine, or a task resolving the promise in the state of its waiter
+             */
+            static task *resolve_task(CoroutineHandler *handler, std::unique_ptr<promise_t<bool>> &promise, bool value,
+                                      const task::execution_state &state);
+
+            const Timespan      phase;
+            CancellationToken   token;
+            std::mutex          mutex;
+            Ticker              *head = nullptr;
+            size_t              tickers = 0;
+            bool                armed = false;
+            int64_t             armed_tick = 0;
+            size_t              fires = 0;
+            Timespan            lateness_sum = 0;
+            Timespan            lateness_max = 0;
+        };
+    }
+}
+
+using detail::ticker_clock;
+
+
+namespace {
+    struct ticker_registry {
+        std::mutex mutex;
+        std::map<std::pair<ObjectID, Timespan>, std::shared_ptr<ticker_clock>> clocks;
+    };
+
+    // never destroyed, tickers of static objects outlive the other statics
+    ticker_registry &registry() {
+        static auto *registry = new ticker_registry;
+        return *registry;
+    }
+
+    class ticker_tick_task : public task {
+    public:
+        ticker_tick_task(std::unique_ptr<promise_t<bool>> promise, bool value) : promise(std::move(promise)), value(value) { }
+
+        ~ticker_tick_task() override {
+            // dropped by the runtime, the waiter sees the ticker stopped
+            if (promise) {
+                promise->set_value(false);
+            }
+        }
+
+        void execute(const execution_state &state) override {
             task::state = state;
-            tick_ts = TIMESTAMP_NOW_MICRO();
-            promise.set_value(true);
-        } catch (std::exception & ex) {
-            std::cerr << ex.what() << std::endl;
-            promise.set_value(false);
+            promise->set_value(value);
+            promise.reset();
+        }
+    private:
+        std::unique_ptr<promise_t<bool>> promise;
+        bool value;
+    };
+
+    class ticker_clock_task : public task {
+    public:
+        ticker_clock_task(std::shared_ptr<ticker_clock> clock, int64_t tick) : clock(std::move(clock)), tick(tick) { }
+
+        ~ticker_clock_task() override {
+            // dropped by a cancel or by the runtime, the clock is armed again by the next waiter
+            if (!fired) {
+                clock->disarm(tick);
+            }
+        }
+
+        void execute(const execution_state &state) override {
+            task::state = state;
+            fired = true;
+            clock->fire(tick);
+        }
+    private:
+        std::shared_ptr<ticker_clock> clock;
+        int64_t tick;
+        bool fired = false;
+    };
+}
+
+
+void ticker_clock::attach(Ticker *ticker) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ticker->attached = true;
+    ticker->seen = index(TIMESTAMP_NOW_MICRO());
+    ++tickers;
+}
+
+
+bool ticker_clock::take(Ticker *ticker) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ticker->is_continue.load(std::memory_order_relaxed) && advance(ticker, TIMESTAMP_NOW_MICRO());
+}
+
+
+bool ticker_clock::advance(Ticker *ticker, Timespan now) {
+    const int64_t tick = index(now);
+    if (tick <= ticker->seen) {
+        return false;
+    }
+    ticker->missed_ticks += static_cast<size_t>(tick - ticker->seen - 1);
+    ticker->seen = tick;
+    ++ticker->ticks;
+    ++ticker->late_ticks;
+    return true;
+}
+
+
+void ticker_clock::wait(Ticker *ticker, CoroutineHandler *handler, bool *result,
+                        std::unique_ptr<promise_t<bool>> promise, const task::execution_state &state) {
+    task *t = nullptr;
+    bool waiting = false;
+    bool value = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const Timespan now = TIMESTAMP_NOW_MICRO();
+        if (ticker->is_continue.load(std::memory_order_relaxed) && advance(ticker, now)) {
+            value = true;
+        } else if (ticker->is_continue.load(std::memory_order_relaxed)) {
+            ticker->handler = handler;
+            ticker->result = result;
+            ticker->promise = std::move(promise);
+            ticker->state = state;
+            link(ticker);
+            if (!armed) {
+                t = arm(ticker->seen + 1, now);
+            }
+            waiting = true;
+        }
+        if (!waiting && handler != nullptr) {
+            *result = value;
+        }
+    }
+
+    if (t != nullptr) {
+        Runtime::g_runtime->Post(t);
+    }
+    if (!waiting) {
+        resolve(handler, promise, value);
+    }
+}
+
+
+void ticker_clock::stop(Ticker *ticker) {
+    CoroutineHandler *handler = nullptr;
+    std::unique_ptr<promise_t<bool>> promise;
+    std::shared_ptr<ticker_clock> dropped;
+    {
+        auto &r = registry();
+        std::lock_guard<std::mutex> registry_lock(r.mutex);
+        if (!ticker->clock) {
+            return;
+        }
+
+        auto &clock = *ticker->clock;
+        std::lock_guard<std::mutex> lock(clock.mutex);
+        if (ticker->linked) {
+            clock.unlink(ticker);
+            handler = ticker->handler;
+            if (handler != nullptr) {
+                *ticker->result = false;
+            }
+            promise = std::move(ticker->promise);
+            ticker->handler = nullptr;
+        }
+        if (ticker->attached) {
+            ticker->attached = false;
+            if (--clock.tickers == 0) {
+                // a new ticker of the period gets a new clock
+                auto it = r.clocks.find({clock.work_group, clock.period});
+                if (it != r.clocks.end() && it->second == ticker->clock) {
+                    r.clocks.erase(it);
+                }
+                dropped = ticker->clock;
+            }
+        }
+    }
+
+    resolve(handler, promise, false);
+    if (dropped) {
+        dropped->token.Cancel();
+    }
+}
+
+
+void ticker_clock::resolve(CoroutineHandler *handler, std::unique_ptr<promise_t<bool>> &promise, bool value) {
+    if (handler != nullptr) {
+        Runtime::g_runtime->Post(handler->resume_task());
+    } else if (promise) {
+        promise->set_value(value);
+    }
+}
+
+
+task *ticker_clock::resolve_task(CoroutineHandler *handler, std::unique_ptr<promise_t<bool>> &promise, bool value,
+                                 const task::execution_state &state) {
+    if (handler != nullptr) {
+        return handler->resume_task();
+    } else if (promise) {
+        auto *t = new ticker_tick_task(std::move(promise), value);
+        t->set_execution_state(state);
+        return t;
+    }
+    return nullptr;
+}
+
+
+void ticker_clock::fire(int64_t tick) {
+    thread_local std::vector<task *> tasks;
+
+    task *t = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!armed || armed_tick != tick) {
+            return;
+        }
+        armed = false;
+
+        const Timespan now = TIMESTAMP_NOW_MICRO();
+        const int64_t current = std::max(tick, index(now));
+        const Timespan lateness = std::max<Timespan>(now - due(tick), 0);
+        ++fires;
+        lateness_sum += lateness;
+        lateness_max = std::max(lateness_max, lateness);
+
+        for (Ticker *ticker = head; ticker != nullptr;) {
+            Ticker *next = ticker->next;
+            // a ticker which has taken the tick before the clock waits for the next one
+            if (ticker->seen < current) {
+                unlink(ticker);
+                ticker->missed_ticks += static_cast<size_t>(current - ticker->seen - 1);
+                ticker->seen = current;
+                ++ticker->ticks;
+                if (ticker->handler != nullptr) {
+                    *ticker->result = true;
+                }
+                tasks.push_back(resolve_task(ticker->handler, ticker->promise, true, ticker->state));
+                ticker->handler = nullptr;
+            }
+            ticker = next;
         }
+
+        if (head != nullptr) {
+            t = arm(current + 1, now);
+        }
+    }
+
+    if (!tasks.empty()) {
+        Runtime::g_runtime->PostBatch(tasks.data(), tasks.size());
     }
+    tasks.clear();
 
-    future_t<bool> get_future() { return promise.get_future(); }
-private:
-    Timespan &tick_ts;
-    promise_type promise;
-};
+    if (t != nullptr) {
+        Runtime::g_runtime->Post(t);
+    }
+}
+
+
+void ticker_clock::disarm(int64_t tick) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (armed && armed_tick == tick) {
+        armed = false;
+    }
+}
+
+
+void ticker_clock::fill(const Ticker *ticker, TickerStats &stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.ticks = ticker->ticks;
+    stats.late_ticks = ticker->late_ticks;
+    stats.missed_ticks = ticker->missed_ticks;
+    stats.period_us = period;
+    stats.drift_us = period - ticker->delay;
+    stats.fires = fires;
+    stats.mean_lateness_us = fires > 0 ? lateness_sum / static_cast<Timespan>(fires) : 0;
+    stats.max_lateness_us = lateness_max;
+    stats.shared_with = tickers;
+}
+
+
+task *ticker_clock::arm(int64_t tick, Timespan now) {
+    armed = true;
+    armed_tick = tick;
+
+    auto *t = new ticker_clock_task(shared_from_this(), tick);
+    t->set_delay<Timestamp::Micro>(std::max<Timespan>(due(tick) - now, 0));
+    task::execution_state state;
+    state.work_group = work_group;
+    t->set_execution_state(state);
+    t->set_cancellation(token);
+    return t;
+}
+
+
+void ticker_clock::link(Ticker *ticker) {
+    ticker->prev = nullptr;
+    ticker->next = head;
+    if (head != nullptr) {
+        head->prev = ticker;
+    }
+    head = ticker;
+    ticker->linked = true;
+}
+
+
+void ticker_clock::unlink(Ticker *ticker) {
+    if (ticker->prev != nullptr) {
+        ticker->prev->next = ticker->next;
+    } else {
+        head = ticker->next;
+    }
+    if (ticker->next != nullptr) {
+        ticker->next->prev = ticker->prev;
+    }
+    ticker->prev = ticker->next = nullptr;
+    ticker->linked = false;
+}
+
+
+Ticker::~Ticker() {
+    Stop();
+}
 
 
 void Ticker::Stop() {
     is_continue.store(false, std::memory_order_relaxed);
-    //if(tick_result)
-    //    tick_result->SetValue(false);
+    ticker_clock::stop(this);
 }
 
 
-future_t<bool> Ticker::AsyncTick(const task::execution_state& execution_state) {
-    bool cont = is_continue.load(std::memory_order_relaxed);
-    if(!cont) {
-        last_tick_ts = TIMESTAMP_NOW_MICRO();
-        return make_resolved_future(false);
+ticker_clock *Ticker::GetClock() {
+    // only the ticking thread sets the clock
+    if (clock) {
+        return clock.get();
     }
 
-    Timespan curr_tick_delay = TIMESTAMP_NOW_MICRO() - last_tick_ts;
+    const Timespan period = std::max<Timespan>(delay, 1);
+    const auto range = static_cast<Timespan>(std::llround(static_cast<double>(period) * slack));
+    auto &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
 
-    if(curr_tick_delay < delay) {
-        Runtime::g_runtime->CheckRuntime();
-        curr_tick_delay = delay - curr_tick_delay;
-        auto task = new ticker_task(last_tick_ts);
-        auto future = task->get_future();
-        task->set_delay< Timestamp::Micro >(curr_tick_delay);
-        task->set_execution_state(execution_state);
-        Runtime::g_runtime->Post(task);
-        return future;
-    } else {
-        last_tick_ts = TIMESTAMP_NOW_MICRO();
-        return make_resolved_future(true);
+    std::shared_ptr<ticker_clock> nearest;
+    for (auto it = r.clocks.lower_bound({work_group, period - range});
+         it != r.clocks.end() && it->first.first == work_group && it->first.second <= period + range; ++it) {
+        if (!nearest || std::llabs(it->first.second - period) < std::llabs(nearest->period - period)) {
+            nearest = it->second;
+        }
+    }
+    if (!nearest) {
+        nearest = std::make_shared<ticker_clock>(work_group, period, TIMESTAMP_NOW_MICRO());
+        r.clocks[{work_group, period}] = nearest;
     }
+
+    nearest->attach(this);
+    clock = std::move(nearest);
+    return clock.get();
+}
+
+
+future_t<bool> Ticker::AsyncTick(const task::execution_state& execution_state) {
+    if (!is_continue.load(std::memory_order_relaxed)) {
+        return make_resolved_future(false);
+    }
+
+    Runtime::g_runtime->CheckRuntime();
+    auto promise = std::make_unique<promise_t<bool>>();
+    auto future = promise->get_future();
+    GetClock()->wait(this, nullptr, nullptr, std::move(promise), execution_state);
+    return future;
 }
 
 
@@ -70,4 +449,36 @@ future_t<bool> Ticker::AsyncTick() {
 }
 
 
+bool Ticker::AwaitTick(CoroutineHandler* handler) {
+    if (!is_continue.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    Runtime::g_runtime->CheckRuntime();
+    if (GetClock()->take(this)) {
+        return true;
+    }
+
+    // the clock sets the result before it resumes the coroutine
+    bool ticked = false;
+    handler->suspend_with([this, &ticked, handler](CoroutineHandler *) {
+        clock->wait(this, handler, &ticked, nullptr);
+    });
+    return ticked;
+}
+
+
+TickerStats Ticker::GetStats() const {
+    TickerStats stats;
+    stats.period_us = delay;
 
+    std::shared_ptr<ticker_clock> current;
+    {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        current = clock;
+    }
+    if (current) {
+        current->fill(this, stats);
+    }
+    return stats;
+}
@@ -14,6 +14,7 @@
 #include <algorithm>
 #include <numeric>
 #include <cassert>
+#include <chrono>
 
 namespace AsyncRuntime {
     class ExecutorSlot;
@@ -34,10 +35,12 @@ namespace AsyncRuntime {
 #ifdef __cpp_lib_atomic_wait
             std::atomic<unsigned> state {0};
 #else
-            std::mutex mu;
-            std::condition_variable cv;
             unsigned state;
 #endif
+            // a timed waiter sleeps on the condition variable, atomic waits have no timeout
+            std::mutex mu;
+            std::condition_variable cv;
+            bool timed_signaled = false;
         };
 
         explicit WorkNotifier(size_t N) : _waiters{N} {
@@ -62,64 +65,41 @@ namespace AsyncRuntime {
         // commit_wait commits waiting.
         // only the waiter itself can call
         void commit_wait(Waiter* w) {
-#ifdef __cpp_lib_atomic_wait
-            w->state.store(Waiter::kNotSignaled, std::memory_order_relaxed);
-#else
-            w->state = Waiter::kNotSignaled;
-#endif
-            // Modification epoch of this waiter.
-            uint64_t epoch =
-                    (w->epoch & kEpochMask) +
-                    (((w->epoch & kWaiterMask) >> kWaiterShift) << kEpochShift);
-            uint64_t state = _state.load(std::memory_order_seq_cst);
-            for (;;) {
-                if (int64_t((state & kEpochMask) - epoch) < 0) {
-                    // The preceeding waiter has not decided on its fate. Wait until it
-                    // calls either cancel_wait or commit_wait, or is notified.
-                    std::this_thread::yield();
-                    state = _state.load(std::memory_order_seq_cst);
-                    continue;
-                }
-                // We've already been notified.
-                if (int64_t((state & kEpochMask) - epoch) > 0) return;
-                // Remove this thread from prewait counter and add it to the waiter list.
-                assert((state & kWaiterMask) != 0);
-                uint64_t newstate = state - kWaiterInc + kEpochInc;
-                //newstate = (newstate & ~kStackMask) | (w - &_waiters[0]);
-                newstate = static_cast<uint64_t>((newstate & ~kStackMask) | static_cast<uint64_t>(w - &_waiters[0]));
-                if ((state & kStackMask) == kStackMask)
-                    w->next.store(nullptr, std::memory_order_relaxed);
-                else
-                    w->next.store(&_waiters[state & kStackMask], std::memory_order_relaxed);
-                if (_state.compare_exchange_weak(state, newstate,
-                                                 std::memory_order_release))
-                    break;
+            if (_push(w)) {
+                _park(w);
+            }
+        }
+
+        // commit_wait_for commits waiting for the timeout at most.
+        // Returns false if the timeout has expired without notification.
+        // Timed waiters aren't pushed to the stack, they can't leave it from the middle:
+        // they wait in a list of their own, notified only when the stack is empty.
+        bool commit_wait_for(Waiter* w, std::chrono::microseconds timeout) {
+            {
+                std::lock_guard<std::mutex> lock(w->mu);
+                w->timed_signaled = false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_timed_mutex);
+                _timed.push_back(w);
+                _timed_count.fetch_add(1, std::memory_order_seq_cst);
+            }
+            // listed before leaving the prewait state, a notifier seeing no waiters on the stack finds it
+            const bool notified = !_leave_prewait(w);
+            if (!notified && _park_timed(w, std::chrono::steady_clock::now() + timeout)) {
+                return true;
+            }
+            if (_remove_timed(w)) {
+                return notified;
             }
-            _park(w);
+            // taken off the list by a notifier right now, its signal comes
+            _park_timed(w);
+            return true;
         }
 
         // cancel_wait cancels effects of the previous prepare_wait call.
         void cancel_wait(Waiter* w) {
-            uint64_t epoch =
-                    (w->epoch & kEpochMask) +
-                    (((w->epoch & kWaiterMask) >> kWaiterShift) << kEpochShift);
-            uint64_t state = _state.load(std::memory_order_relaxed);
-            for (;;) {
-                if (int64_t((state & kEpochMask) - epoch) < 0) {
-                    // The preceeding waiter has not decided on its fate. Wait until it
-                    // calls either cancel_wait or commit_wait, or is notified.
-                    std::this_thread::yield();
-                    state = _state.load(std::memory_order_relaxed);
-                    continue;
-                }
-                // We've already been notified.
-                if (int64_t((state & kEpochMask) - epoch) > 0) return;
-                // Remove this thread from prewait counter.
-                assert((state & kWaiterMask) != 0);
-                if (_state.compare_exchange_weak(state, state - kWaiterInc + kEpochInc,
-                                                 std::memory_order_relaxed))
-                    return;
-            }
+            _leave_prewait(w);
         }
 
         // notify wakes one or all waiting threads.
@@ -128,9 +108,9 @@ namespace AsyncRuntime {
             std::atomic_thread_fence(std::memory_order_seq_cst);
             uint64_t state = _state.load(std::memory_order_acquire);
             for (;;) {
-                // Easy case: no waiters.
+                // Easy case: no waiters but the timed ones.
                 if ((state & kStackMask) == kStackMask && (state & kWaiterMask) == 0) {
-                    return nullptr;
+                    return _notify_timed(all);
                 }
                 uint64_t waiters = (state & kWaiterMask) >> kWaiterShift;
                 uint64_t newstate;
@@ -157,6 +137,9 @@ namespace AsyncRuntime {
                 }
                 if (_state.compare_exchange_weak(state, newstate,
                                                  std::memory_order_acquire)) {
+                    if (all) {
+                        _notify_timed(true);
+                    }
                     if (!all && waiters) return nullptr;  // unblocked pre-wait thread
                     if ((state & kStackMask) == kStackMask) return nullptr;
                     Waiter* w = &_waiters[state & kStackMask];
@@ -169,19 +152,31 @@ namespace AsyncRuntime {
             }
         }
 
-        // notify n workers
+        // notify n workers, stops early when no worker is waiting
         void notify_n(size_t n) {
             if(n >= _waiters.size()) {
                 notify(true);
             }
             else {
-                for(size_t k=0; k<n; ++k) {
+                for(size_t k=0; k<n && has_waiters(); ++k) {
                     notify(false);
                 }
             }
         }
 
+        bool has_waiters() const {
+            uint64_t state = _state.load(std::memory_order_relaxed);
+            return (state & kStackMask) != kStackMask || (state & kWaiterMask) != 0 ||
+                   _timed_count.load(std::memory_order_relaxed) != 0;
+        }
+
         void notify_waiter(Waiter *w) {
+            // a timed waiter is woken up alone
+            if (_remove_timed(w)) {
+                _unpark_timed(w);
+                return;
+            }
+
             bool n = false;
             for(size_t k=0; k<_waiters.size(); ++k) {
                 if (w == notify(true)) {
@@ -199,7 +194,34 @@ namespace AsyncRuntime {
             return _waiters.size();
         }
 
+        Waiter* get_waiter(size_t i) {
+            return &_waiters[i];
+        }
+
     private:
+        // _leave_prewait removes the waiter from the prewait counter, false if it's already notified.
+        bool _leave_prewait(Waiter* w) {
+            uint64_t epoch =
+                    (w->epoch & kEpochMask) +
+                    (((w->epoch & kWaiterMask) >> kWaiterShift) << kEpochShift);
+            uint64_t state = _state.load(std::memory_order_relaxed);
+            for (;;) {
+                if (int64_t((state & kEpochMask) - epoch) < 0) {
+                    // The preceeding waiter has not decided on its fate. Wait until it
+                    // calls either cancel_wait or commit_wait, or is notified.
+                    std::this_thread::yield();
+                    state = _state.load(std::memory_order_relaxed);
+                    continue;
+                }
+                // We've already been notified.
+                if (int64_t((state & kEpochMask) - epoch) > 0) return false;
+                // Remove this thread from prewait counter.
+                assert((state & kWaiterMask) != 0);
+                if (_state.compare_exchange_weak(state, state - kWaiterInc + kEpochInc,
+                                                 std::memory_order_acq_rel))
+                    return true;
+            }
+        }
 
         // State_ layout:
         // - low kStackBits is a stack of waiters committed wait.
@@ -218,6 +240,48 @@ namespace AsyncRuntime {
         static const uint64_t kEpochInc = 1ull << kEpochShift;
         std::atomic<uint64_t> _state;
         std::vector<Waiter> _waiters;
+        // waiters of commit_wait_for, out of the stack
+        std::mutex _timed_mutex;
+        std::vector<Waiter*> _timed;
+        std::atomic<size_t> _timed_count {0};
+
+        // _push adds the waiter to the stack, false if it's already notified.
+        bool _push(Waiter* w) {
+#ifdef __cpp_lib_atomic_wait
+            w->state.store(Waiter::kNotSignaled, std::memory_order_relaxed);
+#else
+            w->state = Waiter::kNotSignaled;
+#endif
+            // Modification epoch of this waiter.
+            uint64_t epoch =
+                    (w->epoch & kEpochMask) +
+                    (((w->epoch & kWaiterMask) >> kWaiterShift) << kEpochShift);
+            uint64_t state = _state.load(std::memory_order_seq_cst);
+            for (;;) {
+                if (int64_t((state & kEpochMask) - epoch) < 0) {
+                    // The preceeding waiter has not decided on its fate. Wait until it
+                    // calls either cancel_wait or commit_wait, or is notified.
+                    std::this_thread::yield();
+                    state = _state.load(std::memory_order_seq_cst);
+                    continue;
+                }
+                // We've already been notified.
+                if (int64_t((state & kEpochMask) - epoch) > 0) return false;
+                // Remove this thread from prewait counter and add it to the waiter list.
+                assert((state & kWaiterMask) != 0);
+                uint64_t newstate = state - kWaiterInc + kEpochInc;
+                //newstate = (newstate & ~kStackMask) | (w - &_waiters[0]);
+                newstate = static_cast<uint64_t>((newstate & ~kStackMask) | static_cast<uint64_t>(w - &_waiters[0]));
+                if ((state & kStackMask) == kStackMask)
+                    w->next.store(nullptr, std::memory_order_relaxed);
+                else
+                    w->next.store(&_waiters[state & kStackMask], std::memory_order_relaxed);
+                if (_state.compare_exchange_weak(state, newstate,
+                                                 std::memory_order_release))
+                    break;
+            }
+            return true;
+        }
 
         void _park(Waiter* w) {
 #ifdef __cpp_lib_atomic_wait
@@ -236,6 +300,69 @@ namespace AsyncRuntime {
 #endif
         }
 
+        // _park_timed returns false on the timeout, the waiter isn't signaled then.
+        bool _park_timed(Waiter* w, std::chrono::steady_clock::time_point deadline) {
+            std::unique_lock<std::mutex> lock(w->mu);
+            return w->cv.wait_until(lock, deadline, [w]() { return w->timed_signaled; });
+        }
+
+        void _park_timed(Waiter* w) {
+            std::unique_lock<std::mutex> lock(w->mu);
+            w->cv.wait(lock, [w]() { return w->timed_signaled; });
+        }
+
+        // _remove_timed takes the waiter off the timed list, false if a notifier has taken it.
+        bool _remove_timed(Waiter* w) {
+            if (_timed_count.load(std::memory_order_seq_cst) == 0) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(_timed_mutex);
+            auto it = std::find(_timed.begin(), _timed.end(), w);
+            if (it == _timed.end()) {
+                return false;
+            }
+            _timed.erase(it);
+            _timed_count.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // _notify_timed wakes the latest or all timed waiters.
+        Waiter* _notify_timed(bool all) {
+            if (_timed_count.load(std::memory_order_seq_cst) == 0) {
+                return nullptr;
+            }
+            Waiter* first = nullptr;
+            std::vector<Waiter*> woken;
+            {
+                std::lock_guard<std::mutex> lock(_timed_mutex);
+                if (_timed.empty()) {
+                    return nullptr;
+                }
+                if (all) {
+                    woken.swap(_timed);
+                } else {
+                    woken.push_back(_timed.back());
+                    _timed.pop_back();
+                }
+                _timed_count.fetch_sub(woken.size(), std::memory_order_relaxed);
+            }
+            for (auto *w : woken) {
+                _unpark_timed(w);
+                if (first == nullptr) {
+                    first = w;
+                }
+            }
+            return first;
+        }
+
+        void _unpark_timed(Waiter* w) {
+            {
+                std::lock_guard<std::mutex> lock(w->mu);
+                w->timed_signaled = true;
+            }
+            w->cv.notify_one();
+        }
+
         void _unpark(Waiter* waiters) {
             Waiter* next = nullptr;
             for (Waiter* w = waiters; w; w = next) {
@@ -0,0 +1,202 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/ar.hpp"
+#include "ar/scheduler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+using namespace AsyncRuntime;
+
+
+TEST_CASE( "Cancellation token callbacks", "[cancellation]" ) {
+    struct counter final : public cancellation_callback {
+        void on_cancel() noexcept override { ++calls; }
+        int calls = 0;
+    };
+
+    CancellationToken token;
+    CancellationToken copy = token;
+    counter first, second;
+    auto *state = token.GetState();
+
+    REQUIRE(state->add_callback(&first));
+    REQUIRE(state->add_callback(&second));
+    REQUIRE(state->remove_callback(&second));
+    REQUIRE_FALSE(state->remove_callback(&second));
+
+    copy.Cancel();
+    copy.Cancel();
+    REQUIRE(token.IsCancelled());
+    REQUIRE(first.calls == 1);
+    REQUIRE(second.calls == 0);
+    REQUIRE_FALSE(state->remove_callback(&first));
+    REQUIRE_FALSE(state->add_callback(&second));
+    REQUIRE_THROWS_AS(token.ThrowIfCancelled(), OperationCancelled);
+}
+
+
+TEST_CASE( "Scheduler removes cancelled timers", "[cancellation]" ) {
+    std::atomic_int fired = {0};
+    Scheduler scheduler([&fired](task *t) {
+        ++fired;
+        delete t;
+    });
+
+    std::vector<CancellationToken> tokens(100);
+    std::vector<future_t<void>> futures;
+    for (auto &token : tokens) {
+        auto *t = make_dummy_task();
+        t->set_delay<Timestamp::Milli>(60000);
+        t->set_cancellation(token);
+        futures.push_back(t->get_future());
+        scheduler.Post(t);
+    }
+    REQUIRE(scheduler.GetPendingCount() == 100);
+
+    for (size_t i = 0; i < tokens.size(); i += 2) {
+        tokens[i].Cancel();
+    }
+    REQUIRE(scheduler.GetPendingCount() == 50);
+    for (size_t i = 0; i < futures.size(); i += 2) {
+        REQUIRE(futures[i].is_ready());
+        REQUIRE_THROWS_AS(futures[i].get(), OperationCancelled);
+        REQUIRE_FALSE(futures[i + 1].is_ready());
+    }
+
+    // already cancelled token: the timer isn't added
+    auto *t = make_dummy_task();
+    t->set_delay<Timestamp::Milli>(60000);
+    t->set_cancellation(tokens[0]);
+    auto cancelled = t->get_future();
+    scheduler.Post(t);
+    REQUIRE(scheduler.GetPendingCount() == 50);
+    REQUIRE_THROWS_AS(cancelled.get(), OperationCancelled);
+    REQUIRE(fired == 0);
+}
+
+
+TEST_CASE( "Cancel delayed tasks", "[cancellation]" ) {
+    SetupRuntime();
+
+    SECTION( "delayed task doesn't run" ) {
+        CancellationToken token;
+        std::atomic_bool called = {false};
+        auto future = AsyncDelayed(token, [&called]() { called = true; return 1; }, 60000);
+        auto start = std::chrono::steady_clock::now();
+        token.Cancel();
+        REQUIRE_THROWS_AS(Await(std::move(future)), OperationCancelled);
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+        REQUIRE_FALSE(called);
+    }
+
+    SECTION( "sleep" ) {
+        CancellationToken token;
+        auto future = AsyncSleep(std::chrono::seconds(60), token);
+        REQUIRE_FALSE(future.is_ready());
+        token.Cancel();
+        REQUIRE_THROWS_AS(Await(std::move(future)), OperationCancelled);
+    }
+
+    SECTION( "task with a cancelled token" ) {
+        CancellationToken token;
+        token.Cancel();
+        std::atomic_bool called = {false};
+        auto future = Async(token, [&called]() { called = true; });
+        REQUIRE_THROWS_AS(Await(std::move(future)), OperationCancelled);
+        REQUIRE_FALSE(called);
+    }
+
+    SECTION( "task with a live token" ) {
+        CancellationToken token;
+        REQUIRE(Await(Async(token, []() { return 7; })) == 7);
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "Cancel awaits", "[cancellation]" ) {
+    SetupRuntime();
+
+    SECTION( "await is aborted" ) {
+        CancellationToken token;
+        task_promise<int> never;
+        auto coro = make_coroutine<int>([&token, &never](CoroutineHandler *handler, yield<int> &yield) {
+            try {
+                Await(never.get_future(), handler, token);
+            } catch (const OperationCancelled &) {
+                return 1;
+            }
+            return 0;
+        });
+
+        auto result = Async(coro);
+        AsyncDelayed([&token]() { token.Cancel(); }, 10);
+        REQUIRE(Await(std::move(result)) == 1);
+        // the waiter is still linked to the future, it's released by the promise
+        never.set_value(0);
+    }
+
+    SECTION( "await completes" ) {
+        CancellationToken token;
+        auto coro = make_coroutine<int>([&token](CoroutineHandler *handler, yield<int> &yield) {
+            return Await(AsyncDelayed([]() { return 5; }, 5), handler, token);
+        });
+        REQUIRE(Await(Async(coro)) == 5);
+        token.Cancel();
+    }
+
+    SECTION( "await with a cancelled token" ) {
+        CancellationToken token;
+        token.Cancel();
+        auto coro = make_coroutine<int>([&token](CoroutineHandler *handler, yield<int> &yield) {
+            try {
+                Await(Async([]() { return 5; }), handler, token);
+            } catch (const OperationCancelled &) {
+                return 1;
+            }
+            return 0;
+        });
+        REQUIRE(Await(Async(coro)) == 1);
+    }
+
+    SECTION( "awaits completed at once leave the token clean" ) {
+        CancellationToken token;
+        std::vector<future_t<int>> results;
+        for (int i = 0; i < 1000; ++i) {
+            auto coro = make_coroutine<int>([&token, i](CoroutineHandler *handler, yield<int> &yield) {
+                int sum = 0;
+                for (int j = 0; j < 10; ++j) {
+                    sum += Await(Async([i]() { return i; }), handler, token);
+                }
+                return sum;
+            });
+            results.push_back(Async(coro));
+        }
+        for (int i = 0; i < 1000; ++i) {
+            REQUIRE(Await(std::move(results[i])) == 10 * i);
+        }
+        REQUIRE_FALSE(token.GetState()->has_callbacks());
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "Stop ticker", "[cancellation]" ) {
+    SetupRuntime();
+
+    Ticker ticker(std::chrono::seconds(60));
+    auto tick = ticker.AsyncTick();
+    REQUIRE_FALSE(tick.is_ready());
+    ticker.Stop();
+    REQUIRE_FALSE(Await(std::move(tick)));
+    REQUIRE_FALSE(Await(ticker.AsyncTick()));
+
+    Terminate();
+}
@@ -0,0 +1,98 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "cpu_quota.h"
+#include "ar/ar.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+using namespace AsyncRuntime;
+
+static const uint64_t ms = 1000 * 1000;
+
+
+TEST_CASE( "Cpu quota throttles a group over its budget", "[cpu_quota]" ) {
+    // 2 ms of every 10 ms
+    CpuQuota quota(10 * ms, 2 * ms, 0);
+
+    quota.account(1 * ms);
+    REQUIRE_FALSE(quota.refill(5 * ms));
+    REQUIRE(quota.throttled_until() == 0);
+
+    quota.account(1 * ms + ms / 2);
+    REQUIRE(quota.throttled_until() == 10 * ms);
+    REQUIRE(quota.throttled_until() == 10 * ms);
+    REQUIRE(quota.take_throttled_periods() == 1);
+
+    // the debt of 0.5 ms is paid from the next budget
+    REQUIRE(quota.refill(10 * ms));
+    REQUIRE_FALSE(quota.refill(11 * ms));
+    REQUIRE(quota.throttled_until() == 0);
+    quota.account(1 * ms + ms / 2);
+    REQUIRE(quota.throttled_until() == 20 * ms);
+    REQUIRE(quota.take_throttled_periods() == 1);
+    REQUIRE(quota.take_consumed() == 4 * ms);
+    REQUIRE(quota.take_consumed() == 0);
+}
+
+
+TEST_CASE( "Cpu quota doesn't save up idle periods", "[cpu_quota]" ) {
+    CpuQuota quota(10 * ms, 2 * ms, 0);
+
+    // idle for 10 periods: one budget only
+    REQUIRE(quota.refill(105 * ms));
+    quota.account(2 * ms);
+    REQUIRE(quota.throttled_until() == 110 * ms);
+
+    // a long task is paid back by several periods
+    REQUIRE(quota.refill(110 * ms));
+    quota.account(10 * ms);
+    REQUIRE(quota.throttled_until() == 120 * ms);
+    REQUIRE(quota.refill(125 * ms));
+    REQUIRE(quota.throttled_until() == 130 * ms);
+    REQUIRE(quota.refill(160 * ms));
+    REQUIRE(quota.throttled_until() == 0);
+    REQUIRE(quota.take_throttled_periods() == 3);
+}
+
+
+TEST_CASE( "Workers wait while the group is over its quota", "[cpu_quota]" ) {
+    WorkGroupOption analytics = {"analytics", 4.0, 1.0};
+    analytics.cpu_quota_period_ms = 20;
+    SetupRuntime({{analytics}});
+    const auto group = GetWorkGroup("analytics");
+    const auto cpus = std::max(1u, std::thread::hardware_concurrency());
+
+    // 40 ms of work per cpu at a quarter of the cpus takes 160 ms, the first budget and overruns make it shorter
+    const int tasks_count = 20 * static_cast<int>(cpus);
+    std::vector<future_t<int>> results;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < tasks_count; ++i) {
+        auto coro = make_coroutine<int>([](CoroutineHandler *handler, yield<int> &yield) {
+            const auto begin = std::chrono::steady_clock::now();
+            while (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(2)) {
+            }
+            return 1;
+        });
+        coro->set_execution_state_wg(group);
+        results.push_back(Async(coro));
+    }
+
+    int done = 0;
+    for (auto &result : results) {
+        done += Await(std::move(result));
+    }
+    REQUIRE(done == tasks_count);
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(100));
+
+    // the main group has no quota
+    const auto main_start = std::chrono::steady_clock::now();
+    REQUIRE(Await(Async([]() { return 1; })) == 1);
+    REQUIRE(std::chrono::steady_clock::now() - main_start < std::chrono::milliseconds(100));
+
+    Terminate();
+}
@@ -0,0 +1,162 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/cpu_helper.hpp"
+#include "cpu_placement.h"
+
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <unistd.h>
+
+using namespace AsyncRuntime;
+namespace fs = std::filesystem;
+
+
+/**
+ * sysfs tree of a package of 4 cores with 2 hyperthreads, siblings numbered next to each other
+ * (cpu 0 and 1 are one core), and two L3 domains of 2 cores: cpus 0-3 and 4-7
+ */
+class MockSysfs {
+public:
+    MockSysfs() : root(fs::temp_directory_path() / ("ar_sysfs_" + std::to_string(::getpid()))) {
+        fs::remove_all(root);
+        write(root / "online", "0-7");
+        for (int cpu = 0; cpu < 8; ++cpu) {
+            const auto dir = root / ("cpu" + std::to_string(cpu));
+            const int core = cpu / 2 * 2, l3 = cpu / 4 * 4;
+            write(dir / "topology" / "thread_siblings_list", std::to_string(core) + "-" + std::to_string(core + 1));
+            write(dir / "topology" / "core_siblings_list", "0-7");
+            write_cache(dir / "cache" / "index0", "1", "Data", std::to_string(core) + "-" + std::to_string(core + 1));
+            write_cache(dir / "cache" / "index1", "1", "Instruction", std::to_string(core) + "-" + std::to_string(core + 1));
+            write_cache(dir / "cache" / "index2", "2", "Unified", std::to_string(core) + "-" + std::to_string(core + 1));
+            write_cache(dir / "cache" / "index3", "3", "Unified", std::to_string(l3) + "-" + std::to_string(l3 + 3));
+            fs::create_directories(dir / "node0");
+        }
+    }
+
+    ~MockSysfs() {
+        fs::remove_all(root);
+    }
+
+    static void write(const fs::path &path, const std::string &value) {
+        fs::create_directories(path.parent_path());
+        std::ofstream(path) << value << "\n";
+    }
+
+    static void write_cache(const fs::path &dir, const std::string &level, const std::string &type, const std::string &shared) {
+        write(dir / "level", level);
+        write(dir / "type", type);
+        write(dir / "shared_cpu_list", shared);
+    }
+
+    fs::path root;
+};
+
+
+TEST_CASE( "Cpu lists are parsed", "[cpu_topology]" ) {
+    REQUIRE(ParseCpuList("0") == std::vector<size_t>{0});
+    REQUIRE(ParseCpuList("0-3,8,10-11\n") == std::vector<size_t>{0, 1, 2, 3, 8, 10, 11});
+    REQUIRE(ParseCpuList("4,2-3,2") == std::vector<size_t>{2, 3, 4});
+    REQUIRE(ParseCpuList("").empty());
+}
+
+
+TEST_CASE( "Topology is read from sysfs", "[cpu_topology]" ) {
+    MockSysfs sysfs;
+
+    auto cpus = ReadCPUs(sysfs.root.string());
+    REQUIRE(cpus.size() == 8);
+    REQUIRE(cpus[3].id == 3);
+    REQUIRE(cpus[3].core_id == 2);
+    REQUIRE(cpus[3].llc_id == 0);
+    REQUIRE(cpus[5].core_id == 4);
+    REQUIRE(cpus[5].llc_id == 4);
+    REQUIRE(cpus[5].numa_node_id == 0);
+
+    // the cpuset of the process
+    cpus = ReadCPUs(sysfs.root.string(), {1, 2, 5, 6, 9});
+    REQUIRE(cpus.size() == 4);
+    REQUIRE(cpus[0].id == 1);
+    REQUIRE(cpus[0].core_id == 0);
+    REQUIRE(cpus[3].id == 6);
+
+    REQUIRE(ReadCPUs((sysfs.root / "missing").string()).empty());
+}
+
+
+TEST_CASE( "Slots stay in a cache domain on separate cores", "[cpu_topology]" ) {
+    MockSysfs sysfs;
+    const auto cpus = ReadCPUs(sysfs.root.string());
+    std::map<size_t, size_t> cpus_wg;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cpus_wg[i] = 0;
+    }
+
+    // two slots of two workers: one per domain, no shared cores
+    auto first = PlaceSlot(cpus, cpus_wg, 2);
+    auto second = PlaceSlot(cpus, cpus_wg, 2);
+    REQUIRE(first == std::vector<size_t>{0, 2});
+    REQUIRE(second == std::vector<size_t>{4, 6});
+
+    // the next slots fill the siblings, still one domain each
+    auto third = PlaceSlot(cpus, cpus_wg, 2);
+    auto fourth = PlaceSlot(cpus, cpus_wg, 2);
+    REQUIRE(third == std::vector<size_t>{1, 3});
+    REQUIRE(fourth == std::vector<size_t>{5, 7});
+    for (const auto &it : cpus_wg) {
+        REQUIRE(it.second == 1);
+    }
+}
+
+
+TEST_CASE( "Slot larger than a domain spills over", "[cpu_topology]" ) {
+    MockSysfs sysfs;
+    const auto cpus = ReadCPUs(sysfs.root.string());
+    std::map<size_t, size_t> cpus_wg;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cpus_wg[i] = 0;
+    }
+
+    auto slot = PlaceSlot(cpus, cpus_wg, 6);
+    std::set<size_t> domain = {0, 1, 2, 3};
+    for (size_t c = 0; c < 4; ++c) {
+        REQUIRE(domain.count(slot[c]) == 1);
+    }
+    REQUIRE(slot[4] == 4);
+    REQUIRE(slot[5] == 6);
+}
+
+
+TEST_CASE( "Activated worker prefers its domain and a free core", "[cpu_topology]" ) {
+    MockSysfs sysfs;
+    const auto cpus = ReadCPUs(sysfs.root.string());
+    // busy: cpu 0, 4 and 6
+    std::vector<size_t> usage = {1, 0, 0, 0, 1, 0, 1, 0};
+    auto workers = [&usage](size_t i) { return usage[i]; };
+
+    // cpu 1 is free but its sibling is busy
+    REQUIRE(PickCpu(cpus, workers, 0) == 2);
+    // the other domain has no free core, a sibling of the domain then
+    REQUIRE(PickCpu(cpus, workers, 4) == 5);
+    REQUIRE(PickCpu(cpus, workers) == 2);
+
+    // a free cpu of an other domain before a busy one of the domain
+    usage = {1, 1, 1, 1, 0, 0, 0, 0};
+    REQUIRE(PickCpu(cpus, workers, 0) == 4);
+}
+
+
+TEST_CASE( "Current numa node is a node of the cpus", "[cpu_topology]" ) {
+    const int node = GetCurrentNumaNode();
+    REQUIRE(node >= -1);
+    if (node >= 0) {
+        std::set<size_t> nodes;
+        for (const auto &cpu : GetCPUs()) {
+            nodes.insert(cpu.numa_node_id);
+        }
+        REQUIRE(nodes.count(static_cast<size_t>(node)) == 1);
+    }
+}
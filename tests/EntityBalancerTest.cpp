@@ -0,0 +1,84 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "entity_balancer.h"
+
+using namespace AsyncRuntime;
+using namespace std;
+
+
+TEST_CASE( "Entity balancer keeps balanced slots", "[entity_balancer]" ) {
+    EntityBalancer balancer(0.25, 4, 4);
+    vector<EntityBalancer::EntityLoad> loads = {
+            {0, 0, 100}, {1, 0, 100},
+            {2, 1, 100}, {3, 1, 110},
+    };
+
+    REQUIRE(balancer.balance(loads, 2).empty());
+    REQUIRE(balancer.balance(loads, 2).empty());
+}
+
+
+TEST_CASE( "Entity balancer moves heavy entities apart", "[entity_balancer]" ) {
+    EntityBalancer balancer(0.25, 4, 4);
+    // two heavy entities on slot 0, light ones on slot 1
+    vector<EntityBalancer::EntityLoad> loads = {
+            {0, 0, 1000}, {1, 0, 1000},
+            {2, 1, 100}, {3, 1, 100},
+    };
+
+    auto migrations = balancer.balance(loads, 2);
+    REQUIRE(migrations.size() == 1);
+    REQUIRE(migrations[0].from == 0);
+    REQUIRE(migrations[0].to == 1);
+    REQUIRE(migrations[0].entity <= 1);
+
+    auto &slot_loads = balancer.get_slot_loads();
+    REQUIRE(slot_loads[0] < slot_loads[1] + 1000);
+}
+
+
+TEST_CASE( "Entity balancer hysteresis", "[entity_balancer]" ) {
+    EntityBalancer balancer(0.25, 4, 4);
+    // a single entity heavier than the spread is never moved, it would just swap the imbalance
+    vector<EntityBalancer::EntityLoad> loads = {
+            {0, 0, 1000},
+            {1, 1, 100},
+    };
+    REQUIRE(balancer.balance(loads, 2).empty());
+
+    // a moved entity stays in its slot during the cooldown
+    vector<EntityBalancer::EntityLoad> skewed = {
+            {0, 0, 500}, {1, 0, 500}, {2, 0, 500},
+            {3, 1, 10},
+    };
+    auto migrations = balancer.balance(skewed, 2);
+    REQUIRE(migrations.size() == 1);
+
+    uint16_t moved = migrations[0].entity;
+    for (auto &l : skewed) {
+        if (l.entity == moved) {
+            l.slot = migrations[0].to;
+        }
+    }
+    // move the entity back by the load change, it is still cooling down
+    for (auto &l : skewed) {
+        l.cpu_time = (l.entity == moved) ? 5000 : 10;
+    }
+    for (int i = 0; i < 3; ++i) {
+        for (auto &m : balancer.balance(skewed, 2)) {
+            REQUIRE(m.entity != moved);
+        }
+    }
+}
+
+
+TEST_CASE( "Entity balancer forgets deleted entities", "[entity_balancer]" ) {
+    EntityBalancer balancer(0.25, 4, 4);
+    REQUIRE(balancer.balance({{0, 0, 1000}, {1, 0, 1000}, {2, 1, 0}}, 2).size() == 1);
+    REQUIRE(balancer.balance({}, 2).empty());
+    REQUIRE(balancer.get_slot_loads()[0] == 0);
+    REQUIRE(balancer.get_slot_loads()[1] == 0);
+}
@@ -0,0 +1,258 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/ar.hpp"
+#include "executor_slot.h"
+#include "numbers.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace AsyncRuntime;
+
+
+template<class Predicate>
+static bool wait_for(Predicate predicate, std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+
+/**
+ * work group of two slots of one worker each, both on the first cpu
+ */
+static ExecutorWorkGroup *make_two_slots_group() {
+    const auto cpus = GetCPUs();
+    const std::vector<CPU> slot_cpus = {cpus[0], cpus[0]};
+    WorkGroupOption option = {"entities", 1.0, 1.0, 1};
+    std::map<size_t, size_t> cpus_wg = {{0, 0}, {1, 0}};
+    return new ExecutorWorkGroup(0, option, slot_cpus, cpus_wg);
+}
+
+
+static task *tagged(uint16_t entity, task *t) {
+    t->set_execution_state_tag(Numbers::Pack(0, entity));
+    return t;
+}
+
+
+TEST_CASE( "Elastic slot grows under load and shrinks when idle", "[executor_slot]" ) {
+    const auto cpus = GetCPUs();
+    // one slot of one worker
+    WorkGroupOption option = {"elastic", static_cast<double>(cpus.size()), 1.0, 1};
+    option.max_slot_concurrency = 4;
+    option.scale_queue_size = 8;
+    option.worker_idle_ms = 50;
+
+    std::map<size_t, size_t> cpus_wg;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cpus_wg[i] = 0;
+    }
+    ExecutorWorkGroup group(0, option, cpus, cpus_wg);
+    REQUIRE(group.GetSlots().size() == 1);
+    auto *slot = group.GetSlots()[0];
+    REQUIRE(slot->get_workers_count() == 4);
+    REQUIRE(slot->get_active_workers() == 1);
+
+    // blocking tasks: only more workers drain the queue faster
+    std::atomic_int done = {0};
+    const int tasks_count = 200;
+    for (int i = 0; i < tasks_count; ++i) {
+        group.Post(make_task([&done]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            done.fetch_add(1);
+        }));
+    }
+
+    size_t peak = 1;
+    REQUIRE(wait_for([&]() {
+        peak = std::max(peak, slot->get_active_workers());
+        return done.load() == tasks_count;
+    }, std::chrono::seconds(30)));
+    REQUIRE(peak > 1);
+    REQUIRE(peak <= 4);
+
+    // idle workers are deactivated down to one
+    REQUIRE(wait_for([&]() { return slot->get_active_workers() == 1; }, std::chrono::seconds(10)));
+    size_t active = 0;
+    for (size_t i = 0; i < slot->get_workers_count(); ++i) {
+        active += slot->get_worker(i).is_active() ? 1 : 0;
+    }
+    REQUIRE(active == 1);
+
+    // the last worker still runs tasks
+    std::atomic_bool ran = {false};
+    group.Post(make_task([&ran]() { ran = true; }));
+    REQUIRE(wait_for([&]() { return ran.load(); }, std::chrono::seconds(10)));
+
+    group.Stop();
+}
+
+
+TEST_CASE( "Fixed slot keeps its workers", "[executor_slot]" ) {
+    const auto cpus = GetCPUs();
+    WorkGroupOption option = {"fixed", static_cast<double>(cpus.size()), 1.0, 2};
+
+    std::map<size_t, size_t> cpus_wg;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        cpus_wg[i] = 0;
+    }
+    ExecutorWorkGroup group(0, option, cpus, cpus_wg);
+    auto *slot = group.GetSlots()[0];
+    REQUIRE(slot->get_workers_count() == 2);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(slot->get_active_workers() == 2);
+
+    group.Stop();
+}
+
+
+TEST_CASE( "Timed waiter leaves the notifier alone", "[executor_slot]" ) {
+    WorkNotifier notifier(3);
+    std::atomic_bool timed_out = {false};
+    std::atomic_int woken = {0};
+
+    // the timed waiter parks first, under the others
+    std::thread timed([&]() {
+        auto *w = notifier.get_waiter(0);
+        notifier.prepare_wait(w);
+        timed_out = !notifier.commit_wait_for(w, std::chrono::milliseconds(100));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    std::vector<std::thread> parked;
+    for (size_t i = 1; i < 3; ++i) {
+        parked.emplace_back([&, i]() {
+            auto *w = notifier.get_waiter(i);
+            notifier.prepare_wait(w);
+            notifier.commit_wait(w);
+            ++woken;
+        });
+    }
+    REQUIRE(wait_for([&]() { return timed_out.load(); }, std::chrono::milliseconds(1000)));
+    timed.join();
+
+    // its timeout doesn't wake the parked workers up
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(woken == 0);
+
+    // a notification goes to a parked worker, not to a timed one
+    std::atomic_bool notified = {false};
+    std::thread keeper([&]() {
+        auto *w = notifier.get_waiter(0);
+        notifier.prepare_wait(w);
+        notified = notifier.commit_wait_for(w, std::chrono::milliseconds(200));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    notifier.notify(false);
+    REQUIRE(wait_for([&]() { return woken == 1; }, std::chrono::milliseconds(1000)));
+    keeper.join();
+    REQUIRE_FALSE(notified);
+
+    // the last parked worker first, then the timed waiter
+    std::thread last([&]() {
+        auto *w = notifier.get_waiter(0);
+        notifier.prepare_wait(w);
+        notified = notifier.commit_wait_for(w, std::chrono::milliseconds(1000));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    notifier.notify(false);
+    REQUIRE(wait_for([&]() { return woken == 2; }, std::chrono::milliseconds(1000)));
+    notifier.notify(false);
+    last.join();
+    REQUIRE(notified);
+
+    for (auto &t : parked) {
+        t.join();
+    }
+}
+
+
+TEST_CASE( "Idle sibling slot helps a slot busy with an entity", "[executor_slot]" ) {
+    std::unique_ptr<ExecutorWorkGroup> group(make_two_slots_group());
+    REQUIRE(group->GetSlots().size() == 2);
+    // the entity takes the first slot, the untagged tasks go there too
+    group->AddEntity(1);
+
+    std::atomic_bool started = {false}, release = {false};
+    group->Post(tagged(1, make_task([&]() {
+        started = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    })));
+    REQUIRE(wait_for([&]() { return started.load(); }, std::chrono::seconds(10)));
+
+    // the worker of the entity is busy, the idle sibling takes over its inbox, the entity's tasks too
+    std::atomic_int tagged_done = {0}, plain_done = {0};
+    const int tasks_count = 50;
+    for (int i = 0; i < tasks_count; ++i) {
+        group->Post(tagged(1, make_task([&tagged_done]() { tagged_done.fetch_add(1); })));
+        group->Post(make_task([&plain_done]() { plain_done.fetch_add(1); }));
+    }
+    CHECK(wait_for([&]() {
+        return plain_done.load() == tasks_count && tagged_done.load() == tasks_count;
+    }, std::chrono::seconds(10)));
+
+    release = true;
+    group->Stop();
+}
+
+
+TEST_CASE( "Tasks of an entity land on one slot", "[executor_slot]" ) {
+    std::unique_ptr<ExecutorWorkGroup> group(make_two_slots_group());
+    const auto &slots = group->GetSlots();
+    REQUIRE(slots.size() == 2);
+    // an entity on each slot
+    group->AddEntity(1);
+    group->AddEntity(2);
+    REQUIRE(group->GetEntitySlot(1) != group->GetEntitySlot(2));
+    REQUIRE(slots[0]->get_util() == 1);
+    REQUIRE(slots[1]->get_util() == 1);
+
+    std::atomic_int done = {0};
+    const int tasks_count = 100;
+    auto post_concurrently = [&]() {
+        std::vector<std::thread> posters;
+        for (int p = 0; p < 4; ++p) {
+            posters.emplace_back([&]() {
+                for (int i = 0; i < tasks_count / 4; ++i) {
+                    group->Post(tagged(1, make_task([&done]() { done.fetch_add(1); })));
+                }
+            });
+        }
+        for (auto &t : posters) {
+            t.join();
+        }
+    };
+
+    const int slot = group->GetEntitySlot(1);
+    post_concurrently();
+    REQUIRE(group->GetEntitySlot(1) == slot);
+    REQUIRE(wait_for([&]() { return done.load() == tasks_count; }, std::chrono::seconds(10)));
+
+    // deleted, the entity is assigned again by its next task, the racing posters agree on one slot
+    group->DeleteEntity(1);
+    REQUIRE(group->GetEntitySlot(1) == -1);
+    REQUIRE(slots[0]->get_util() + slots[1]->get_util() == 1);
+    post_concurrently();
+    REQUIRE(group->GetEntitySlot(1) >= 0);
+    REQUIRE(slots[0]->get_util() + slots[1]->get_util() == 2);
+    REQUIRE(slots[0]->get_util() == 1);
+    REQUIRE(wait_for([&]() { return done.load() == 2 * tasks_count; }, std::chrono::seconds(10)));
+
+    group->Stop();
+}
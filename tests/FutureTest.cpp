@@ -0,0 +1,181 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/future.hpp"
+#include "ar/boost_future.hpp"
+
+#include <string>
+#include <thread>
+#include <memory>
+#include <vector>
+
+using namespace AsyncRuntime;
+using namespace std;
+
+
+TEST_CASE( "Future get value", "[future]" ) {
+    task_promise<int> p;
+    auto f = p.get_future();
+    REQUIRE(f.valid());
+    REQUIRE_FALSE(f.is_ready());
+
+    p.set_value(42);
+    REQUIRE(f.is_ready());
+    REQUIRE(f.has_value());
+    REQUIRE(f.get() == 42);
+    REQUIRE_FALSE(f.valid());
+}
+
+
+TEST_CASE( "Future move only value", "[future]" ) {
+    task_promise<unique_ptr<int>> p;
+    auto f = p.get_future();
+    p.set_value(make_unique<int>(7));
+    REQUIRE(*f.get() == 7);
+}
+
+
+TEST_CASE( "Future copies an lvalue value", "[future]" ) {
+    task_promise<string> p;
+    auto f = p.get_future();
+    string value = "value";
+    p.set_value(value);
+    REQUIRE(value == "value");
+    REQUIRE(f.get() == "value");
+}
+
+
+TEST_CASE( "Future exceptions", "[future]" ) {
+    SECTION( "exception is rethrown" ) {
+        task_promise<int> p;
+        auto f = p.get_future();
+        p.set_exception(runtime_error("fail"));
+        REQUIRE(f.has_exception());
+        REQUIRE_THROWS_AS(f.get(), runtime_error);
+    }
+
+    SECTION( "broken promise" ) {
+        task_future<void> f;
+        {
+            task_promise<void> p;
+            f = p.get_future();
+        }
+        REQUIRE(f.is_ready());
+        REQUIRE_THROWS_AS(f.get(), future_error);
+    }
+
+    SECTION( "promise reassigned" ) {
+        task_promise<int> p;
+        auto f = p.get_future();
+        p = {};
+        REQUIRE(f.has_exception());
+    }
+
+    SECTION( "already satisfied and retrieved" ) {
+        task_promise<int> p;
+        auto f = p.get_future();
+        p.set_value(1);
+        REQUIRE_THROWS_AS(p.set_value(2), future_error);
+        REQUIRE_THROWS_AS(p.get_future(), future_error);
+        REQUIRE(f.get() == 1);
+    }
+}
+
+
+TEST_CASE( "Future wait from other thread", "[future]" ) {
+    for (int i = 0; i < 100; ++i) {
+        task_promise<int> p;
+        auto f = p.get_future();
+        thread t([&p, i]() { p.set_value(i); });
+        f.wait();
+        REQUIRE(f.get() == i);
+        t.join();
+    }
+
+    task_promise<int> p;
+    auto f = p.get_future();
+    REQUIRE(f.wait_for(chrono::milliseconds(10)) == future_status::timeout);
+    p.set_value(1);
+    REQUIRE(f.wait_for(chrono::milliseconds(10)) == future_status::ready);
+}
+
+
+TEST_CASE( "Future continuations", "[future]" ) {
+    SECTION( "continuation runs on set" ) {
+        task_promise<int> p;
+        auto f = p.get_future().then([](task_future<int> && f) { return f.get() * 2; })
+                               .then([](task_future<int> f) { return to_string(f.get()); });
+        REQUIRE_FALSE(f.is_ready());
+        p.set_value(21);
+        REQUIRE(f.get() == "42");
+    }
+
+    SECTION( "continuation of a ready future runs inline" ) {
+        task_promise<void> p;
+        p.set_value();
+        bool called = false;
+        p.get_future().then([&called](task_future<void> f) { f.get(); called = true; });
+        REQUIRE(called);
+    }
+
+    SECTION( "exception in continuation" ) {
+        task_promise<int> p;
+        auto f = p.get_future().then([](task_future<int> f) -> int { throw runtime_error("fail"); });
+        p.set_value(1);
+        REQUIRE_THROWS_AS(f.get(), runtime_error);
+    }
+
+    SECTION( "move only callable" ) {
+        task_promise<int> p;
+        auto ptr = make_unique<int>(1);
+        auto f = p.get_future().then([ptr = std::move(ptr)](task_future<int> f) { return f.get() + *ptr; });
+        p.set_value(1);
+        REQUIRE(f.get() == 2);
+    }
+}
+
+
+TEST_CASE( "Shared future", "[future]" ) {
+    task_promise<int> p;
+    task_shared_future<int> f = p.get_future();
+    auto copy = f;
+
+    int sum = 0;
+    vector<task_future<void>> done;
+    for (int i = 0; i < 10; ++i) {
+        done.push_back(f.then([&sum](task_shared_future<int> f) { sum += f.get(); }));
+    }
+
+    vector<int> results(4, 0);
+    vector<thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([copy, &results, i]() { results[i] = copy.get(); });
+    }
+
+    p.set_value(5);
+    for (auto &t : threads) {
+        t.join();
+    }
+    REQUIRE(results == vector<int>(4, 5));
+    for (auto &d : done) {
+        d.get();
+    }
+    REQUIRE(sum == 50);
+    REQUIRE(f.get() == 5);
+    REQUIRE(copy.get() == 5);
+}
+
+
+TEST_CASE( "Boost future adapters", "[future]" ) {
+    boost::promise<int> bp;
+    auto f = from_boost_future(bp.get_future());
+    bp.set_value(3);
+    REQUIRE(f.get() == 3);
+
+    task_promise<int> p;
+    auto bf = to_boost_future(p.get_future());
+    p.set_exception(runtime_error("fail"));
+    REQUIRE_THROWS(bf.get());
+}
@@ -0,0 +1,171 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/ar.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace AsyncRuntime;
+
+
+TEST_CASE( "Parallel for", "[parallel]" ) {
+    SetupRuntime();
+
+    std::vector<int> values(100000, 1);
+    parallel_for(values.begin(), values.end(), [](int &v) { v *= 2; });
+    REQUIRE(std::all_of(values.begin(), values.end(), [](int v) { return v == 2; }));
+
+    std::vector<std::atomic_int> hits(10000);
+    parallel_for(0, 10000, [&hits](int i) { hits[i]++; }, { INVALID_OBJECT_ID, 7 });
+    REQUIRE(std::all_of(hits.begin(), hits.end(), [](const std::atomic_int &h) { return h.load() == 1; }));
+
+    std::vector<int> empty;
+    parallel_for(empty.begin(), empty.end(), [](int &v) { v = 1; });
+    parallel_for(5, 5, [](int) { FAIL(); });
+
+    Terminate();
+}
+
+
+TEST_CASE( "Parallel transform, reduce, scan", "[parallel]" ) {
+    SetupRuntime();
+
+    std::vector<long> values(100003);
+    std::iota(values.begin(), values.end(), 1);
+
+    std::vector<long> squares(values.size());
+    auto end = parallel_transform(values.begin(), values.end(), squares.begin(), [](long v) { return v * v; });
+    REQUIRE(end == squares.end());
+    for (size_t i = 0; i < values.size(); ++i) {
+        REQUIRE(squares[i] == values[i] * values[i]);
+    }
+
+    REQUIRE(parallel_reduce(values.begin(), values.end(), 10L) == std::accumulate(values.begin(), values.end(), 10L));
+
+    // not commutative, the order of partials matters
+    std::vector<std::string> words(1000);
+    for (size_t i = 0; i < words.size(); ++i) {
+        words[i] = std::to_string(i % 10);
+    }
+    REQUIRE(parallel_reduce(words.begin(), words.end(), std::string(">"), std::plus<>(), { INVALID_OBJECT_ID, 3 }) ==
+            std::accumulate(words.begin(), words.end(), std::string(">")));
+
+    std::vector<long> expected(values.size());
+    std::inclusive_scan(values.begin(), values.end(), expected.begin(), std::plus<>(), 5L);
+    std::vector<long> scanned(values.size());
+    parallel_scan(values.begin(), values.end(), scanned.begin(), 5L);
+    REQUIRE(scanned == expected);
+
+    // in place
+    parallel_scan(values.begin(), values.end(), values.begin(), 5L);
+    REQUIRE(values == expected);
+
+    Terminate();
+}
+
+
+TEST_CASE( "Parallel sort", "[parallel]" ) {
+    SetupRuntime();
+
+    std::mt19937 rng(42);
+    for (size_t n : {0, 1, 100, 4096, 100000, 250001}) {
+        std::vector<int> values(n);
+        for (auto &v : values) {
+            v = static_cast<int>(rng() % 1000);
+        }
+        auto expected = values;
+        std::sort(expected.begin(), expected.end(), std::greater<>());
+
+        parallel_sort(values.begin(), values.end(), std::greater<>());
+        REQUIRE(values == expected);
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "Parallel exceptions", "[parallel]" ) {
+    SetupRuntime();
+
+    std::vector<int> values(100000);
+    std::iota(values.begin(), values.end(), 0);
+    REQUIRE_THROWS_AS(parallel_for(values.begin(), values.end(), [](int v) {
+        if (v == 77777) {
+            throw std::runtime_error("fail");
+        }
+    }, { INVALID_OBJECT_ID, 16 }), std::runtime_error);
+
+    // the runtime is usable after a failed call
+    std::atomic_long sum = {0};
+    parallel_for(values.begin(), values.end(), [&sum](int v) { sum += v; });
+    REQUIRE(sum == std::accumulate(values.begin(), values.end(), 0L));
+
+    Terminate();
+}
+
+
+TEST_CASE( "Parallel call from tasks and coroutines", "[parallel]" ) {
+    SetupRuntime();
+
+    auto from_task = Async([]() {
+        std::vector<int> values(50000, 1);
+        return parallel_reduce(values.begin(), values.end(), 0);
+    });
+    REQUIRE(Await(std::move(from_task)) == 50000);
+
+    auto from_coroutine = make_coroutine<int>([](CoroutineHandler *handler, yield<int> &yield) {
+        std::vector<int> values(50000, 2);
+        parallel_for(values.begin(), values.end(), [](int &v) { v += 1; }, { INVALID_OBJECT_ID, 0, handler });
+        return parallel_reduce(values.begin(), values.end(), 0, std::plus<>(), { INVALID_OBJECT_ID, 0, handler });
+    });
+    REQUIRE(Await(Async(from_coroutine)) == 150000);
+
+    // nested calls
+    std::vector<std::vector<int>> matrix(64, std::vector<int>(1000, 1));
+    std::atomic_int total = {0};
+    parallel_for(matrix.begin(), matrix.end(), [&total](std::vector<int> &row) {
+        total += parallel_reduce(row.begin(), row.end(), 0);
+    });
+    REQUIRE(total == 64000);
+
+    Terminate();
+}
+
+
+TEST_CASE( "Parallel wait helps only with its own chunks", "[parallel]" ) {
+    SetupRuntime();
+
+    // a task queued on the worker before the call must not run nested in its wait
+    static thread_local bool waiting = false;
+    std::atomic_bool nested = {false};
+    std::atomic_int other_runs = {0};
+    auto call = Async([&nested, &other_runs]() {
+        auto posted = Executor::PostLocal(make_task([&nested, &other_runs]() {
+            nested = nested || waiting;
+            other_runs++;
+        }));
+
+        std::vector<int> values(50000, 1);
+        waiting = true;
+        parallel_for(values.begin(), values.end(), [](int &v) { v += 1; });
+        waiting = false;
+        return posted ? std::accumulate(values.begin(), values.end(), 0) : 0;
+    });
+    REQUIRE(Await(std::move(call)) == 100000);
+    for (int i = 0; i < 1000 && other_runs == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    REQUIRE(other_runs == 1);
+    REQUIRE_FALSE(nested);
+
+    Terminate();
+}
@@ -5,24 +5,169 @@
 #include "catch.hpp"
 #include "ar/runtime.hpp"
 
+#include <atomic>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
 using namespace AsyncRuntime;
 using namespace std;
 
 TEST_CASE( "Create/delete resource", "[resource_pool]" ) {
     SetupRuntime();
 
-    auto resource_id = AsyncRuntime::CreateResource();
+    auto resource = AsyncRuntime::CreateResource();
     {
-        auto coro = make_coroutine(resource_id, [=](coroutine_handler* handler, YieldVoid &yield) {
-            auto resource = AsyncRuntime::GetResource(resource_id);
-            REQUIRE(handler->get_resource() == resource);
+        auto *pool = resource.get();
+        auto coro = make_coroutine(pool, [=](coroutine_handler* handler, YieldVoid &yield) {
+            REQUIRE(handler->get_resource() == pool);
         });
 
 
         Await(Async(coro));
     }
-    AsyncRuntime::DeleteResource(resource_id);
-    REQUIRE(AsyncRuntime::GetResource(resource_id) == nullptr);
+    resource.reset();
+    REQUIRE(resource == nullptr);
 
     Terminate();
 }
+
+
+TEST_CASE( "Thread cache serves chunks in batches", "[resource_pool]" ) {
+    resource_pool pool(64);
+
+    std::vector<void *> chunks;
+    for (int i = 0; i < 40; ++i) {
+        chunks.push_back(pool.allocate(48));
+    }
+    REQUIRE(std::set<void *>(chunks.begin(), chunks.end()).size() == chunks.size());
+
+    // a refill per 32 chunks, the others come from the cache
+    auto stats = pool.get_thread_cache_stats();
+    REQUIRE(stats.refills == 2);
+    REQUIRE(stats.hits == 38);
+    REQUIRE(stats.cached == 24);
+
+    for (auto *ptr : chunks) {
+        pool.deallocate(ptr, 48);
+    }
+    stats = pool.get_thread_cache_stats();
+    REQUIRE(stats.flushes == 0);
+    REQUIRE(stats.cached == 64);
+
+    // a full cache gives its oldest chunks back
+    chunks.clear();
+    for (int i = 0; i < 100; ++i) {
+        chunks.push_back(pool.allocate(48));
+    }
+    for (auto *ptr : chunks) {
+        pool.deallocate(ptr, 48);
+    }
+    stats = pool.get_thread_cache_stats();
+    REQUIRE(stats.refills == 4);
+    REQUIRE(stats.flushes == 2);
+    REQUIRE(stats.cached == 64);
+
+    // larger allocations have their own class: 4 chunks, cached by 16
+    void *block = pool.allocate(200);
+    pool.deallocate(block, 200);
+    auto block_stats = pool.get_thread_cache_stats();
+    REQUIRE(block_stats.refills == stats.refills + 1);
+    REQUIRE(block_stats.cached == stats.cached + 8);
+}
+
+
+TEST_CASE( "Chunks freed by an other thread", "[resource_pool]" ) {
+    resource_pool pool(64);
+    const size_t count = 1000;
+
+    std::vector<void *> chunks;
+    for (size_t i = 0; i < count; ++i) {
+        chunks.push_back(pool.allocate(64));
+    }
+
+    std::thread consumer([&pool, &chunks]() {
+        for (auto *ptr : chunks) {
+            pool.deallocate(ptr, 64);
+        }
+        // the cache of the thread keeps some, the rest went back in batches
+        auto stats = pool.get_thread_cache_stats();
+        REQUIRE(stats.flushes > 0);
+        REQUIRE(stats.cached <= 64);
+    });
+    consumer.join();
+
+    // the exited thread has given its chunks back, they are allocated again after those left in this thread's cache
+    auto stats = pool.get_cache_stats();
+    REQUIRE(stats.flushes > 0);
+    std::set<void *> freed(chunks.begin(), chunks.end());
+    size_t reused = 0;
+    for (size_t i = 0; i < count; ++i) {
+        reused += freed.count(pool.allocate(64));
+    }
+    REQUIRE(reused >= count - 32);
+}
+
+
+TEST_CASE( "Pool deleted before the threads of its caches", "[resource_pool]" ) {
+    auto *pool = new resource_pool(64);
+    std::atomic_bool allocated = {false}, deleted = {false};
+
+    std::thread user([pool, &allocated, &deleted]() {
+        pool->deallocate(pool->allocate(16), 16);
+        allocated = true;
+        while (!deleted) {
+            std::this_thread::yield();
+        }
+        // the cache of the deleted pool is dropped with the thread
+    });
+    while (!allocated) {
+        std::this_thread::yield();
+    }
+    delete pool;
+    deleted = true;
+    user.join();
+
+    resource_pool other(64);
+    other.deallocate(other.allocate(16), 16);
+    REQUIRE(other.get_thread_cache_stats().refills == 1);
+}
+
+
+TEST_CASE( "Allocations of size classes and large objects", "[resource_pool]" ) {
+    resource_pool pool(64);
+    REQUIRE(pool.get_memory_stats().reserved == 0);
+
+    // sizes are rounded up to their class: 576 bytes are 9 chunks, in a block of 10
+    std::vector<std::pair<void *, size_t>> objects;
+    for (size_t size : {16, 64, 100, 256, 300, 576, 1000, 4000, 16384}) {
+        auto *ptr = pool.allocate(size);
+        std::memset(ptr, 0xab, size);
+        objects.emplace_back(ptr, size);
+    }
+    std::set<void *> distinct;
+    for (const auto &it : objects) {
+        distinct.insert(it.first);
+    }
+    REQUIRE(distinct.size() == objects.size());
+
+    auto stats = pool.get_memory_stats();
+    REQUIRE(stats.requested == 16 + 64 + 100 + 256 + 300 + 576 + 1000 + 4000 + 16384);
+    REQUIRE(stats.reserved >= stats.requested);
+    REQUIRE(stats.fragmentation > 0.0);
+    REQUIRE(stats.fragmentation < 1.0);
+
+    // more than 256 chunks are taken from the system and given back on free
+    void *large = pool.allocate(64 * 300);
+    REQUIRE(pool.get_memory_stats().reserved == stats.reserved + 64 * 300);
+    pool.deallocate(large, 64 * 300);
+    REQUIRE(pool.get_memory_stats().reserved == stats.reserved);
+
+    for (const auto &it : objects) {
+        pool.deallocate(it.first, it.second);
+    }
+    stats = pool.get_memory_stats();
+    REQUIRE(stats.requested == 0);
+    REQUIRE(stats.fragmentation == 1.0);
+}
@@ -0,0 +1,292 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/ar.hpp"
+
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace AsyncRuntime;
+
+
+TEST_CASE( "Async batch of callables", "[runtime]" ) {
+    SetupRuntime();
+
+    std::vector<std::function<int()>> callables;
+    for (int i = 0; i < 10000; ++i) {
+        callables.emplace_back([i]() { return i; });
+    }
+
+    auto futures = AsyncBatch(callables.begin(), callables.end());
+    REQUIRE(futures.size() == callables.size());
+    for (int i = 0; i < 10000; ++i) {
+        REQUIRE(Await(std::move(futures[i])) == i);
+    }
+
+    std::vector<std::function<int()>> empty;
+    REQUIRE(AsyncBatch(empty.begin(), empty.end()).empty());
+
+    Terminate();
+}
+
+
+TEST_CASE( "Async batch of coroutines", "[runtime]" ) {
+    SetupRuntime();
+
+    std::vector<std::shared_ptr<coroutine<int>>> coroutines;
+    for (int i = 0; i < 100; ++i) {
+        coroutines.push_back(make_coroutine<int>([i](CoroutineHandler* handler, yield<int> &yield) {
+            return Await(Async([i]() { return i * 2; }), handler);
+        }));
+    }
+
+    auto futures = AsyncBatch(coroutines.begin(), coroutines.end());
+    for (int i = 0; i < 100; ++i) {
+        REQUIRE(Await(std::move(futures[i])) == i * 2);
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "When all", "[runtime]" ) {
+    SetupRuntime();
+
+    SECTION( "heterogeneous futures" ) {
+        task_promise<int> p;
+        auto i = p.get_future();
+        auto s = Async([]() { return std::string("str"); });
+        shared_future_t<void> v = Async([]() { });
+        auto all = WhenAll(i, s, v);
+        REQUIRE_FALSE(all.is_ready());
+        p.set_value(1);
+        Await(std::move(all));
+        REQUIRE(i.get() == 1);
+        REQUIRE(s.get() == "str");
+        REQUIRE(v.is_ready());
+    }
+
+    SECTION( "range awaited from a coroutine" ) {
+        auto coro = make_coroutine<int>([](CoroutineHandler *handler, yield<int> &yield) {
+            std::vector<future_t<int>> futures;
+            for (int i = 0; i < 50; ++i) {
+                futures.push_back(Async([i]() { return i; }));
+            }
+            Await(WhenAll(futures.begin(), futures.end()), handler);
+            int sum = 0;
+            for (auto &f : futures) {
+                REQUIRE(f.is_ready());
+                sum += f.get();
+            }
+            return sum;
+        });
+        REQUIRE(Await(Async(coro)) == 1225);
+    }
+
+    SECTION( "exceptions stay in the futures" ) {
+        auto ok = Async([]() { return 1; });
+        auto fail = Async([]() -> int { throw std::runtime_error("fail"); });
+        Await(WhenAll(ok, fail));
+        REQUIRE(ok.get() == 1);
+        REQUIRE_THROWS(fail.get());
+    }
+
+    SECTION( "empty range" ) {
+        std::vector<future_t<int>> futures;
+        REQUIRE(WhenAll(futures.begin(), futures.end()).is_ready());
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "When any", "[runtime]" ) {
+    SetupRuntime();
+
+    SECTION( "index of the first ready" ) {
+        task_promise<int> first, second, third;
+        auto f1 = first.get_future();
+        auto f2 = second.get_future();
+        auto f3 = third.get_future();
+        auto any = WhenAny(f1, f2, f3);
+        REQUIRE_FALSE(any.is_ready());
+        second.set_value(2);
+        REQUIRE(Await(std::move(any)) == 1);
+        // the other futures can be satisfied after the joined one is gone
+        first.set_value(1);
+        third.set_value(3);
+        REQUIRE(f1.get() + f3.get() == 4);
+    }
+
+    SECTION( "ready future" ) {
+        task_promise<void> pending;
+        auto f1 = pending.get_future();
+        auto f2 = Async([]() { return 2; });
+        f2.wait();
+        REQUIRE(Await(WhenAny(f1, f2)) == 1);
+    }
+
+    SECTION( "range awaited from a coroutine" ) {
+        std::vector<task_promise<int>> promises(20);
+        std::vector<future_t<int>> futures;
+        for (auto &p : promises) {
+            futures.push_back(p.get_future());
+        }
+        auto coro = make_coroutine<size_t>([&futures](CoroutineHandler *handler, yield<size_t> &yield) {
+            return Await(WhenAny(futures.begin(), futures.end()), handler);
+        });
+        auto result = Async(coro);
+        promises[7].set_value(7);
+        REQUIRE(Await(std::move(result)) == 7);
+    }
+
+    SECTION( "empty range" ) {
+        std::vector<future_t<int>> futures;
+        REQUIRE(Await(WhenAny(futures.begin(), futures.end())) == static_cast<size_t>(-1));
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "Default pools of numa nodes", "[runtime]" ) {
+    SetupRuntime({{}, 2});
+    auto *outside = GetDefaultResource();
+
+    // workers take the pool of their executor's node
+    auto pool_of = []() {
+        auto *executor = Executor::Current();
+        auto *pool = GetDefaultResource();
+        Allocator<int> allocator;
+        return std::make_tuple(pool, pool->get_numa_node() == executor->GetNumaNode(), allocator.get_resource() == pool);
+    };
+    auto [pool, same_node, allocator_pool] = Await(Async(pool_of));
+    REQUIRE(pool == outside);
+    REQUIRE(same_node);
+    REQUIRE(allocator_pool);
+
+    // allocations from an other node are counted as remote
+    const int node = Await(Async([]() { return Executor::Current()->GetNumaNode(); }));
+    resource_pool remote(128, 1024, 0, node + 1);
+    Await(Async([&remote]() {
+        remote.deallocate(remote.allocate(64), 64);
+    }));
+    remote.deallocate(remote.allocate(64), 64);
+    REQUIRE(remote.get_allocations_count() == 2);
+    REQUIRE(remote.get_remote_allocations_count() == 1);
+
+    resource_pool any(128, 1024, 0);
+    any.deallocate(any.allocate(64), 64);
+    REQUIRE(any.get_allocations_count() == 0);
+
+    Terminate();
+}
+
+
+TEST_CASE( "Post of a worker stays on its executor", "[runtime]" ) {
+    SetupRuntime({{}, 2});
+    // the executor of the entity isn't the one with the least entities, which takes the posts of other threads
+    const auto tag = AddEntityTag(nullptr);
+
+    for (int i = 0; i < 100; ++i) {
+        Executor *inner = nullptr;
+        std::vector<future_t<void>> nested;
+        auto coro = make_coroutine<Executor *>([&inner, &nested](CoroutineHandler *handler, yield<Executor *> &yield) {
+            nested.push_back(Async([&inner]() { inner = Executor::Current(); }));
+            return Executor::Current();
+        });
+        coro->set_execution_state_tag(tag);
+
+        auto *outer = Await(Async(coro));
+        Await(std::move(nested.front()));
+        REQUIRE(outer != nullptr);
+        REQUIRE(inner == outer);
+    }
+
+    DeleteEntityTag(tag);
+    Terminate();
+}
+
+TEST_CASE( "Priorities of the worker queue", "[runtime]" ) {
+    // a worker per executor: tasks posted by a worker run in the order of its queue
+    SetupRuntime({{{"single", static_cast<double>(GetCPUs().size()), 1.0, 1}}});
+
+    SECTION( "higher priority runs first" ) {
+        std::vector<TaskPriority> order;
+        std::vector<future_t<void>> futures;
+        Await(Async([&order, &futures]() {
+            for (auto priority : {TaskPriority::LOW, TaskPriority::NORMAL, TaskPriority::HIGH}) {
+                futures.push_back(Async(priority, [&order, priority]() { order.push_back(priority); }));
+            }
+        }));
+        for (auto &f : futures) {
+            Await(std::move(f));
+        }
+        REQUIRE(order == std::vector<TaskPriority>{TaskPriority::HIGH, TaskPriority::NORMAL, TaskPriority::LOW});
+    }
+
+    SECTION( "low priority runs under a flood of high ones" ) {
+        const int high_count = 100;
+        int position = 0, low_position = -1;
+        std::vector<future_t<void>> futures;
+        Await(Async([&]() {
+            futures.push_back(Async(TaskPriority::LOW, [&]() { low_position = position++; }));
+            for (int i = 0; i < high_count; ++i) {
+                futures.push_back(Async(TaskPriority::HIGH, [&position]() { ++position; }));
+            }
+        }));
+        for (auto &f : futures) {
+            Await(std::move(f));
+        }
+        REQUIRE(position == high_count + 1);
+        // one pop of PRIORITY_AGING_PERIOD (16) takes the lowest priority first
+        REQUIRE(low_position >= 0);
+        REQUIRE(low_position < 16);
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "Resumed coroutine runs next on the waking worker", "[runtime]" ) {
+    SetupRuntime({{{"single", static_cast<double>(GetCPUs().size()), 1.0, 1}}});
+
+    const int queued_count = 8;
+    std::atomic_int position = {0};
+    int resumed_at = -1;
+    bool local = true;
+    std::thread::id waker, resumer;
+    auto coro = make_coroutine<void>([&](CoroutineHandler *handler, yield<void> &yield) {
+        task_promise<int> promise;
+        auto future = promise.get_future();
+        Async([&]() {
+            // high priority tasks in the queue of the worker are ahead of a resume through the queues
+            for (int i = 0; i < queued_count; ++i) {
+                auto *t = make_task([&position]() { ++position; });
+                t->set_execution_state_priority(TaskPriority::HIGH);
+                local = Executor::PostLocal(t) && local;
+            }
+            waker = std::this_thread::get_id();
+            promise.set_value(1);
+        });
+        Await(std::move(future), handler);
+        resumer = std::this_thread::get_id();
+        resumed_at = position++;
+    });
+    Await(Async(coro));
+    while (position.load() < queued_count + 1) {
+        std::this_thread::yield();
+    }
+    REQUIRE(local);
+    REQUIRE(resumed_at == 0);
+    REQUIRE(resumer == waker);
+
+    Terminate();
+}
@@ -0,0 +1,147 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/ar.hpp"
+#include "ar/scheduler.hpp"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace AsyncRuntime;
+
+
+TEST_CASE( "Timing wheel expires due tasks", "[scheduler]" ) {
+    std::vector<task *> fired;
+    Scheduler scheduler([&fired](task *t) { fired.push_back(t); });
+
+    std::map<task *, Timespan> delays;
+    for (Timespan delay : {50, 1, 7000, 3600 * 1000, 3, 70}) {
+        auto *t = make_dummy_task();
+        t->set_delay<Timestamp::Milli>(delay);
+        delays[t] = delay;
+        scheduler.Post(t);
+    }
+    REQUIRE(scheduler.GetPendingCount() == 6);
+    REQUIRE(scheduler.GetNextDeadline() != INT64_MAX);
+
+    const Timespan now = TIMESTAMP_NOW_MICRO();
+    REQUIRE(scheduler.Advance(now + 20 * 1000) == 2);
+    REQUIRE(scheduler.Advance(now + 20 * 1000) == 0);
+    REQUIRE(scheduler.Advance(now + 10 * 1000 * 1000) == 3);
+    REQUIRE(scheduler.GetPendingCount() == 1);
+    REQUIRE(scheduler.Advance(now + Timespan(2) * 3600 * 1000 * 1000) == 1);
+    REQUIRE(scheduler.GetPendingCount() == 0);
+    REQUIRE(scheduler.GetNextDeadline() == INT64_MAX);
+
+    std::vector<Timespan> order;
+    for (auto *t : fired) {
+        order.push_back(delays[t]);
+        delete t;
+    }
+    REQUIRE(order == std::vector<Timespan>{1, 3, 50, 70, 7000, 3600 * 1000});
+}
+
+
+TEST_CASE( "Timing wheel cascades far timers", "[scheduler]" ) {
+    struct timer { Timespan earliest; Timespan latest; };
+    std::map<task *, timer> timers;
+    std::vector<task *> fired;
+    Scheduler scheduler([&fired](task *t) { fired.push_back(t); });
+    const Timespan tick = scheduler.GetTick();
+
+    std::mt19937 rng(7);
+    // 1 ms .. 30 days
+    std::uniform_int_distribution<Timespan> delays(1000, Timespan(30) * 24 * 3600 * 1000 * 1000);
+    for (int i = 0; i < 2000; ++i) {
+        const Timespan delay = delays(rng);
+        auto *t = make_dummy_task();
+        const Timespan before = TIMESTAMP_NOW_MICRO();
+        t->set_delay<Timestamp::Micro>(delay);
+        scheduler.Post(t);
+        timers[t] = {before + delay, TIMESTAMP_NOW_MICRO() + delay};
+    }
+
+    Timespan now = TIMESTAMP_NOW_MICRO();
+    std::uniform_int_distribution<Timespan> steps(1, Timespan(12) * 3600 * 1000 * 1000);
+    size_t expired = 0;
+    while (expired < timers.size()) {
+        now += steps(rng);
+        fired.clear();
+        expired += scheduler.Advance(now);
+        for (auto *t : fired) {
+            // never early
+            REQUIRE(timers[t].earliest <= now);
+            timers[t].earliest = INT64_MAX;
+        }
+        for (auto &it : timers) {
+            // never late
+            if (it.second.earliest != INT64_MAX) {
+                REQUIRE(it.second.latest + tick > now);
+            }
+        }
+    }
+    REQUIRE(scheduler.GetPendingCount() == 0);
+
+    for (auto &it : timers) {
+        delete it.first;
+    }
+}
+
+
+TEST_CASE( "Timing wheel keeps timers beyond its range", "[scheduler]" ) {
+    std::vector<task *> fired;
+    // a microsecond tick, the wheel covers 63 * 64^5 ticks (18.8 hours)
+    Scheduler scheduler([&fired](task *t) { fired.push_back(t); }, nullptr, 1);
+
+    auto *t = make_dummy_task();
+    t->set_delay<Timestamp::Milli>(Timespan(30) * 3600 * 1000);
+    scheduler.Post(t);
+
+    const Timespan now = TIMESTAMP_NOW_MICRO();
+    const Timespan hour = Timespan(3600) * 1000 * 1000;
+    REQUIRE(scheduler.Advance(now + 20 * hour) == 0);
+    REQUIRE(scheduler.Advance(now + 29 * hour) == 0);
+    REQUIRE(scheduler.GetPendingCount() == 1);
+    REQUIRE(scheduler.Advance(now + 31 * hour) == 1);
+    REQUIRE(fired.size() == 1);
+    delete t;
+}
+
+
+TEST_CASE( "Workers expire delayed tasks", "[scheduler]" ) {
+    SetupRuntime();
+
+    SECTION( "many delays" ) {
+        std::vector<std::pair<Timespan, future_t<Timespan>>> results;
+        for (Timespan delay = 1; delay <= 50; ++delay) {
+            const Timespan posted = TIMESTAMP_NOW_MICRO();
+            results.emplace_back(delay * 1000, AsyncDelayed([posted]() { return TIMESTAMP_NOW_MICRO() - posted; }, delay));
+        }
+        for (auto &result : results) {
+            REQUIRE(Await(std::move(result.second)) >= result.first);
+        }
+    }
+
+    SECTION( "idle runtime" ) {
+        // nothing else runs, a parked worker wakes up for the timer
+        auto start = std::chrono::steady_clock::now();
+        Await(AsyncSleep(std::chrono::milliseconds(30)));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        REQUIRE(elapsed >= std::chrono::milliseconds(30));
+        REQUIRE(elapsed < std::chrono::seconds(5));
+    }
+
+    SECTION( "earlier timer posted after a later one" ) {
+        auto late = AsyncSleep(std::chrono::seconds(2));
+        auto start = std::chrono::steady_clock::now();
+        Await(AsyncSleep(std::chrono::milliseconds(10)));
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+        Await(std::move(late));
+    }
+
+    Terminate();
+}
@@ -0,0 +1,152 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/ar.hpp"
+
+#include <csignal>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace AsyncRuntime;
+
+static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+
+TEST_CASE( "Stacks are recycled by the thread", "[stack_cache]" ) {
+    auto &cache = stack_cache::instance();
+    const size_t size = 40 * page_size;
+
+    auto sctx = cache.allocate(size);
+    REQUIRE(sctx.size == size);
+    void *sp = sctx.sp;
+    auto before = cache.get_stats();
+    cache.deallocate(sctx);
+    REQUIRE(cache.get_stats().cached == before.cached + 1);
+
+    sctx = cache.allocate(size);
+    auto after = cache.get_stats();
+    REQUIRE(sctx.sp == sp);
+    REQUIRE(after.hits == before.hits + 1);
+    REQUIRE(after.misses == before.misses);
+    REQUIRE(after.resident == before.resident);
+
+    // an other size or node has stacks of its own
+    auto other = cache.allocate(size + 1);
+    REQUIRE(other.size == size + page_size);
+    REQUIRE(cache.get_stats().misses == after.misses + 1);
+    REQUIRE(cache.get_stats().resident == after.resident + size + page_size);
+
+    cache.deallocate(other);
+    cache.deallocate(sctx);
+}
+
+
+TEST_CASE( "Stack overflow hits the guard page", "[stack_cache]" ) {
+    auto &cache = stack_cache::instance();
+    auto sctx = cache.allocate(16 * page_size);
+    auto *bottom = static_cast<char *>(sctx.sp) - sctx.size;
+    bottom[0] = 1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        *static_cast<volatile char *>(bottom - 1) = 1;
+        _exit(0);
+    }
+    int status = 0;
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGSEGV);
+
+    cache.deallocate(sctx);
+}
+
+
+TEST_CASE( "Reserved stacks are pre-faulted", "[stack_cache]" ) {
+    auto &cache = stack_cache::instance();
+    const size_t size = 24 * page_size;
+    auto before = cache.get_stats();
+    cache.reserve(4, size);
+    REQUIRE(cache.get_stats().cached == before.cached + 4);
+    REQUIRE(cache.get_stats().resident == before.resident + 4 * size);
+
+    std::vector<boost::context::stack_context> stacks;
+    for (int i = 0; i < 4; ++i) {
+        stacks.push_back(cache.allocate(size));
+        std::vector<unsigned char> pages(size / page_size);
+        REQUIRE(mincore(static_cast<char *>(stacks.back().sp) - size, size, pages.data()) == 0);
+        for (auto page : pages) {
+            REQUIRE((page & 1) == 1);
+        }
+    }
+    REQUIRE(cache.get_stats().hits == before.hits + 4);
+    REQUIRE(cache.get_stats().misses == before.misses);
+
+    for (auto &sctx : stacks) {
+        cache.deallocate(sctx);
+    }
+}
+
+
+TEST_CASE( "Stacks of an exited thread are shared", "[stack_cache]" ) {
+    auto &cache = stack_cache::instance();
+    const size_t size = 56 * page_size;
+    void *sp = nullptr;
+
+    std::thread user([&cache, &sp, size]() {
+        auto sctx = cache.allocate(size);
+        sp = sctx.sp;
+        cache.deallocate(sctx);
+    });
+    user.join();
+
+    auto before = cache.get_stats();
+    auto sctx = cache.allocate(size);
+    REQUIRE(sctx.sp == sp);
+    REQUIRE(cache.get_stats().hits == before.hits + 1);
+    cache.deallocate(sctx);
+}
+
+
+TEST_CASE( "Coroutine with a stack of its own size", "[stack_cache]" ) {
+    auto &cache = stack_cache::instance();
+    const size_t size = 512 * 1024;
+    auto before = cache.get_stats();
+
+    auto coro = make_coroutine<int>(stack_options{size}, [](coroutine_handler *handler, yield<int> &yield, int n) {
+        // more than the default stack holds
+        std::vector<char> frame(n);
+        volatile char local[256 * 1024];
+        local[0] = 1;
+        local[sizeof(local) - 1] = 2;
+        return local[0] + local[sizeof(local) - 1] + static_cast<int>(frame.size());
+    }, 3);
+    REQUIRE(cache.get_stats().resident >= before.resident + size);
+
+    coro->init_promise();
+    auto f = coro->get_future();
+    coro->resume();
+    REQUIRE(f.get() == 6);
+    REQUIRE(coro->is_completed());
+}
+
+
+TEST_CASE( "Runtime reserves warm stacks", "[stack_cache]" ) {
+    auto &cache = stack_cache::instance();
+    auto before = cache.get_stats();
+    SetupRuntime({{}, 0, 8});
+    REQUIRE(cache.get_stats().cached >= before.cached + 8);
+
+    auto coro = make_coroutine<int>([](coroutine_handler *handler, yield<int> &yield) {
+        return 1;
+    });
+    REQUIRE(cache.get_stats().hits == before.hits + 1);
+    REQUIRE(Await(Async(coro)) == 1);
+
+    Terminate();
+}
@@ -0,0 +1,166 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/ar.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace AsyncRuntime;
+
+
+TEST_CASE( "Task graph dependencies", "[task_graph]" ) {
+    SetupRuntime();
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto log = [&mutex, &order](const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(name);
+    };
+
+    TaskGraph graph;
+    auto a = graph.Emplace([&log]() { log("a"); }).Name("a");
+    auto b = graph.Emplace([&log]() { log("b"); });
+    auto c = graph.Emplace([&log]() { log("c"); });
+    auto d = graph.Emplace([&log]() { log("d"); });
+    a.Precede(b, c);
+    d.Succeed(b, c);
+
+    REQUIRE(graph.NodesCount() == 4);
+    REQUIRE(a.GetName() == "a");
+    REQUIRE(a.SuccessorsCount() == 2);
+    REQUIRE(d.DependentsCount() == 2);
+
+    Await(graph.Run());
+    REQUIRE(order.size() == 4);
+    REQUIRE(order.front() == "a");
+    REQUIRE(order.back() == "d");
+
+    order.clear();
+    Await(graph.Run(100));
+    REQUIRE(order.size() == 400);
+
+    Terminate();
+}
+
+
+TEST_CASE( "Task graph wide fan out", "[task_graph]" ) {
+    SetupRuntime();
+
+    std::atomic_int count = {0};
+    std::atomic_int joined = {0};
+    TaskGraph graph;
+    auto join = graph.Emplace([&count, &joined]() { joined = count.load(); });
+    for (int i = 0; i < 1000; ++i) {
+        graph.Emplace([&count]() { count++; }).Precede(join);
+    }
+
+    Await(graph.Run(10));
+    REQUIRE(count == 10000);
+    REQUIRE(joined == 10000);
+
+    Terminate();
+}
+
+
+TEST_CASE( "Task graph conditions and loops", "[task_graph]" ) {
+    SetupRuntime();
+
+    SECTION( "branch" ) {
+        int taken = -1;
+        TaskGraph graph;
+        auto condition = graph.Emplace([]() { return 1; });
+        auto left = graph.Emplace([&taken]() { taken = 0; });
+        auto right = graph.Emplace([&taken]() { taken = 1; });
+        condition.Precede(left, right);
+        REQUIRE(condition.IsCondition());
+
+        Await(graph.Run());
+        REQUIRE(taken == 1);
+    }
+
+    SECTION( "loop" ) {
+        int counter = 0;
+        int done = 0;
+        TaskGraph graph;
+        auto init = graph.Emplace([&counter]() { counter = 0; });
+        auto body = graph.Emplace([&counter]() { counter++; });
+        auto check = graph.Emplace([&counter]() { return counter < 10 ? 0 : 1; });
+        auto exit = graph.Emplace([&done]() { done++; });
+        init.Precede(body);
+        body.Precede(check);
+        check.Precede(body, exit);
+
+        Await(graph.Run(3));
+        REQUIRE(counter == 10);
+        REQUIRE(done == 3);
+    }
+
+    SECTION( "run until" ) {
+        int runs = 0;
+        TaskGraph graph;
+        graph.Emplace([&runs]() { runs++; });
+        Await(graph.RunUntil([&runs]() { return runs == 5; }));
+        REQUIRE(runs == 5);
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "Task graph errors", "[task_graph]" ) {
+    SetupRuntime();
+
+    std::atomic_int after = {0};
+    TaskGraph graph;
+    auto fail = graph.Emplace([]() { throw std::runtime_error("fail"); });
+    graph.Emplace([&after]() { after++; }).Succeed(fail);
+    REQUIRE_THROWS_AS(Await(graph.Run(5)), std::runtime_error);
+    REQUIRE(after == 0);
+
+    TaskGraph cycle;
+    auto x = cycle.Emplace([]() { });
+    auto y = cycle.Emplace([]() { });
+    x.Precede(y);
+    y.Precede(x);
+    REQUIRE_THROWS_AS(cycle.Run(), std::runtime_error);
+
+    TaskGraph empty;
+    REQUIRE(empty.Run().is_ready());
+
+    Terminate();
+}
+
+
+TEST_CASE( "Task graph queued runs and coroutines", "[task_graph]" ) {
+    SetupRuntime();
+
+    std::atomic_int count = {0};
+    TaskGraph graph;
+    auto first = graph.Emplace([&count]() { count++; });
+    auto second = graph.Emplace([&count]() { count++; });
+    first.Precede(second);
+
+    std::vector<future_t<void>> runs;
+    for (int i = 0; i < 20; ++i) {
+        runs.push_back(graph.Run(5));
+    }
+    for (auto &run : runs) {
+        Await(std::move(run));
+    }
+    REQUIRE(count == 200);
+
+    auto coro = make_coroutine<int>([&graph, &count](CoroutineHandler *handler, yield<int> &yield) {
+        Await(graph.Run(), handler);
+        return count.load();
+    });
+    REQUIRE(Await(Async(coro)) == 202);
+
+    Terminate();
+}
@@ -0,0 +1,138 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/task.hpp"
+
+#include <set>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
+
+using namespace AsyncRuntime;
+using namespace std;
+
+
+TEST_CASE( "Task pool reuses freed blocks", "[task_pool]" ) {
+    vector<void*> blocks;
+    for (int i = 0; i < 100; ++i) {
+        blocks.push_back(task_pool::allocate(100));
+    }
+
+    set<void*> freed(blocks.begin(), blocks.end());
+    REQUIRE(freed.size() == blocks.size());
+    for (auto *ptr : blocks) {
+        REQUIRE(reinterpret_cast<uintptr_t>(ptr) % task_pool::block_align == 0);
+        task_pool::deallocate(ptr, 100);
+    }
+
+    auto stats = task_pool::get_stats();
+    for (int i = 0; i < 100; ++i) {
+        void *ptr = task_pool::allocate(128);
+        REQUIRE(freed.count(ptr) == 1);
+        blocks[i] = ptr;
+    }
+    REQUIRE(task_pool::get_stats().system_allocations == stats.system_allocations);
+
+    for (auto *ptr : blocks) {
+        task_pool::deallocate(ptr, 128);
+    }
+}
+
+
+TEST_CASE( "Task pool large blocks", "[task_pool]" ) {
+    auto stats = task_pool::get_stats();
+    void *ptr = task_pool::allocate(task_pool::max_block_size + 1);
+    REQUIRE(task_pool::get_stats().system_allocations == stats.system_allocations + 1);
+    task_pool::deallocate(ptr, task_pool::max_block_size + 1);
+}
+
+
+TEST_CASE( "Task pool cross thread frees", "[task_pool]" ) {
+    const int count = 200000;
+    mutex m;
+    condition_variable cv;
+    deque<task*> queue;
+    bool done = false;
+
+    thread consumer([&]() {
+        for (;;) {
+            unique_lock<mutex> lock(m);
+            cv.wait(lock, [&]() { return !queue.empty() || done; });
+            if (queue.empty()) {
+                break;
+            }
+            auto *t = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            delete t;
+        }
+        task_pool::flush();
+    });
+
+    size_t slabs_after_warmup = 0;
+    for (int i = 0; i < count; ++i) {
+        auto *t = make_task([i]() { return i; });
+        {
+            lock_guard<mutex> lock(m);
+            queue.push_back(t);
+        }
+        cv.notify_one();
+
+        if (i == count / 2) {
+            slabs_after_warmup = task_pool::get_stats().slabs_count;
+        }
+
+        // bound the number of tasks in flight
+        while (i % 1024 == 0) {
+            lock_guard<mutex> lock(m);
+            if (queue.empty()) {
+                break;
+            }
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(m);
+        done = true;
+    }
+    cv.notify_one();
+    consumer.join();
+
+    auto stats = task_pool::get_stats();
+    REQUIRE(stats.remote_frees >= count);
+    // freed blocks come back to the allocating thread, the pool doesn't grow;
+    // a task and its future state are in different size classes, each can take one more slab
+    REQUIRE(stats.slabs_count <= slabs_after_warmup + 2);
+}
+
+
+TEST_CASE( "Task pool adopts slabs of exited threads", "[task_pool]" ) {
+    vector<task*> tasks;
+    thread([&]() {
+        for (int i = 0; i < 1000; ++i) {
+            tasks.push_back(make_dummy_task());
+        }
+    }).join();
+
+    REQUIRE(task_pool::get_stats().orphaned_slabs_count > 0);
+
+    for (auto *t : tasks) {
+        delete t;
+    }
+    task_pool::flush();
+
+    auto stats = task_pool::get_stats();
+    thread([&]() {
+        for (int i = 0; i < 1000; ++i) {
+            tasks[i] = make_dummy_task();
+        }
+        for (auto *t : tasks) {
+            delete t;
+        }
+    }).join();
+
+    REQUIRE(task_pool::get_stats().slabs_count == stats.slabs_count);
+}
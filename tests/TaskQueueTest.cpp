@@ -0,0 +1,97 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/task_queue.hpp"
+
+using namespace AsyncRuntime;
+using namespace std;
+
+
+TEST_CASE( "Task queue priority order", "[task_queue]" ) {
+    TaskQueue<int*> queue;
+    int low = 2, normal = 1, high = 0;
+
+    queue.push(&low, static_cast<unsigned>(TaskPriority::LOW));
+    queue.push(&normal, static_cast<unsigned>(TaskPriority::NORMAL));
+    queue.push(&high, static_cast<unsigned>(TaskPriority::HIGH));
+
+    REQUIRE(queue.size() == 3);
+    REQUIRE(queue.pop() == &high);
+    REQUIRE(queue.pop() == &normal);
+    REQUIRE(queue.pop() == &low);
+    REQUIRE(queue.pop() == nullptr);
+    REQUIRE(queue.empty());
+}
+
+
+TEST_CASE( "Task queue steal half", "[task_queue]" ) {
+    TaskQueue<int*> victim, thief;
+    std::vector<int> items(10);
+
+    for (auto &item : items) {
+        victim.push(&item, static_cast<unsigned>(TaskPriority::NORMAL));
+    }
+    victim.push(&items[0], static_cast<unsigned>(TaskPriority::HIGH));
+
+    REQUIRE(victim.steal_half(thief) == 6);
+    REQUIRE(victim.size() == 5);
+    REQUIRE(thief.size(static_cast<unsigned>(TaskPriority::HIGH)) == 1);
+    REQUIRE(thief.size(static_cast<unsigned>(TaskPriority::NORMAL)) == 5);
+
+    // the oldest items are stolen
+    REQUIRE(thief.steal(static_cast<unsigned>(TaskPriority::NORMAL)) == &items[0]);
+
+    TaskQueue<int*> empty_queue;
+    REQUIRE(empty_queue.steal_half(thief) == 0);
+}
+
+
+TEST_CASE( "Task queue concurrent steal half", "[task_queue]" ) {
+    const int count = 100000;
+    const int thieves_count = 3;
+    std::vector<int> items(count);
+    std::vector<std::atomic_int> taken(count);
+    TaskQueue<int*> owner_queue;
+    std::atomic_bool done = {false};
+
+    auto take = [&](int *item) {
+        taken[item - items.data()].fetch_add(1, std::memory_order_relaxed);
+    };
+
+    std::vector<std::thread> thieves;
+    for (int i = 0; i < thieves_count; ++i) {
+        thieves.emplace_back([&]() {
+            TaskQueue<int*> local;
+            while (!done.load() || !owner_queue.empty()) {
+                owner_queue.steal_half(local);
+                while (auto item = local.pop()) {
+                    take(item);
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < count; ++i) {
+        owner_queue.push(&items[i], static_cast<unsigned>(i % 3));
+        if (i % 4 == 0) {
+            if (auto item = owner_queue.pop()) {
+                take(item);
+            }
+        }
+    }
+
+    while (auto item = owner_queue.pop()) {
+        take(item);
+    }
+    done = true;
+
+    for (auto &th : thieves) {
+        th.join();
+    }
+
+    for (auto &t : taken) {
+        REQUIRE(t.load() == 1);
+    }
+}
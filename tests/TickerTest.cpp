@@ -0,0 +1,142 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+
+#include "catch.hpp"
+#include "ar/ar.hpp"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace AsyncRuntime;
+using namespace std::chrono_literals;
+
+
+TEST_CASE( "Tickers of close periods share a clock", "[ticker]" ) {
+    SetupRuntime();
+
+    Ticker first(20ms);
+    Ticker close(20500us);
+    Ticker other(40ms);
+    REQUIRE(first.GetStats().shared_with == 0);
+
+    // the tickers are attached by their first tick
+    REQUIRE(Await(first.AsyncTick()));
+    REQUIRE(Await(close.AsyncTick()));
+    REQUIRE(Await(other.AsyncTick()));
+
+    auto stats = close.GetStats();
+    REQUIRE(stats.shared_with == 2);
+    REQUIRE(stats.period_us == 20000);
+    REQUIRE(stats.drift_us == -500);
+    REQUIRE(first.GetStats().drift_us == 0);
+    REQUIRE(other.GetStats().shared_with == 1);
+    REQUIRE(other.GetStats().period_us == 40000);
+
+    first.Stop();
+    REQUIRE(close.GetStats().shared_with == 1);
+
+    Terminate();
+}
+
+
+TEST_CASE( "Shared clock resumes coroutines", "[ticker]" ) {
+    SetupRuntime();
+
+    const int tickers_count = 100, ticks_count = 5;
+    std::vector<std::unique_ptr<Ticker>> tickers;
+    std::vector<future_t<int>> results;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < tickers_count; ++i) {
+        tickers.push_back(std::make_unique<Ticker>(10ms));
+        auto *ticker = tickers.back().get();
+        auto coro = make_coroutine<int>([ticker, ticks_count](CoroutineHandler *handler, yield<int> &yield) {
+            int ticks = 0;
+            while (ticks < ticks_count && ticker->AwaitTick(handler)) {
+                ++ticks;
+            }
+            return ticks;
+        });
+        results.push_back(Async(coro));
+    }
+
+    for (auto &result : results) {
+        REQUIRE(Await(std::move(result)) == ticks_count);
+    }
+    REQUIRE(std::chrono::steady_clock::now() - start >= 40ms);
+
+    for (auto &ticker : tickers) {
+        auto stats = ticker->GetStats();
+        REQUIRE(stats.ticks == ticks_count);
+        REQUIRE(stats.shared_with == tickers_count);
+        // one delayed task per tick for all of them
+        REQUIRE(stats.fires <= 2 * ticks_count);
+        REQUIRE(stats.max_lateness_us >= stats.mean_lateness_us);
+    }
+
+    Terminate();
+}
+
+
+TEST_CASE( "Ticker behind its clock takes the tick at once", "[ticker]" ) {
+    SetupRuntime();
+
+    Ticker ticker(10ms);
+    REQUIRE(Await(ticker.AsyncTick()));
+    std::this_thread::sleep_for(35ms);
+
+    auto tick = ticker.AsyncTick();
+    REQUIRE(tick.is_ready());
+    REQUIRE(Await(std::move(tick)));
+
+    auto stats = ticker.GetStats();
+    REQUIRE(stats.ticks == 2);
+    REQUIRE(stats.late_ticks == 1);
+    REQUIRE(stats.missed_ticks >= 2);
+
+    // back on the grid
+    REQUIRE_FALSE(ticker.AsyncTick().is_ready());
+
+    Terminate();
+}
+
+
+TEST_CASE( "Tick is resolved in the execution state of its waiter", "[ticker]" ) {
+    SetupRuntime({{{"ticks", 1.0, 1.0}}});
+    const auto group = GetWorkGroup("ticks");
+
+    Ticker ticker(10ms);
+    task::execution_state state;
+    state.work_group = group;
+    auto tick_group = ticker.AsyncTick(state).then([](future_t<bool> tick) {
+        return tick.get() ? Executor::CurrentWorkGroup() : INVALID_OBJECT_ID;
+    });
+    REQUIRE(Await(std::move(tick_group)) == group);
+
+    Terminate();
+}
+
+
+TEST_CASE( "Stop resumes a waiting coroutine", "[ticker]" ) {
+    SetupRuntime();
+
+    Ticker ticker(60s);
+    std::atomic_bool waiting = {false};
+    auto coro = make_coroutine<int>([&ticker, &waiting](CoroutineHandler *handler, yield<int> &yield) {
+        waiting = true;
+        return ticker.AwaitTick(handler) ? 1 : 0;
+    });
+    auto result = Async(coro);
+    while (!waiting) {
+        std::this_thread::sleep_for(1ms);
+    }
+    std::this_thread::sleep_for(10ms);
+
+    ticker.Stop();
+    REQUIRE(Await(std::move(result)) == 0);
+    REQUIRE(ticker.GetStats().shared_with == 0);
+
+    Terminate();
+}